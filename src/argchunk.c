@@ -0,0 +1,144 @@
+/*
+ * Running commands whose argument list exceeds ARG_MAX.
+ *
+ * Linux limits the combined size of the argument and environment
+ * strings, plus their pointers, to a quarter of the stack limit,
+ * which sysconf(_SC_ARG_MAX) reports.  Chunks are sized against that
+ * limit, minus the environment and a safety margin, as POSIX suggests
+ * for xargs.
+ */
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "argchunk.h"
+#include "utils.h"
+
+/* Space left unused for the auxiliary vector and the program name */
+#define HEADROOM 4096
+
+/* Bytes that word takes on the new process's stack */
+static size_t
+word_size(const char *word)
+{
+    return strlen(word) + 1 + sizeof(char *);
+}
+
+static size_t
+words_size(char **words, size_t n)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < n; i++)
+        size += word_size(words[i]);
+    return size;
+}
+
+static size_t
+count_words(char **words)
+{
+    size_t n = 0;
+    while (words[n] != NULL)
+        n++;
+    return n;
+}
+
+/* Return the number of bytes available for argv and envp */
+static size_t
+arg_max(void)
+{
+    long max = sysconf(_SC_ARG_MAX);
+    return (max > 0 ? (size_t) max : 128 * 1024) - HEADROOM;
+}
+
+/* Return true if argv and envp together exceed the size that execve
+ * accepts */
+bool
+argchunk_needed(char **argv, char **envp)
+{
+    size_t limit = arg_max();
+    size_t size = words_size(envp, count_words(envp));
+
+    for (char **p = argv; *p != NULL; p++) {
+        size += word_size(*p);
+        if (size > limit)
+            return true;
+    }
+    return false;
+}
+
+/* Return the exit status encoded in a wait status */
+static int
+exit_status(int status)
+{
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+/* Run argv in as many invocations as needed, at most parallel at a
+ * time, and wait for all of them */
+int
+argchunk_run(char **argv, char **envp, size_t prefix, size_t suffix,
+             long parallel)
+{
+    size_t argc = count_words(argv);
+    size_t fixed = words_size(argv, prefix) + words_size(argv + argc - suffix, suffix);
+    size_t env = words_size(envp, count_words(envp));
+    size_t limit = arg_max();
+    size_t budget = limit > env + fixed ? limit - env - fixed : 0;
+
+    /* The chunk is assembled in place: prefix, words, suffix, NULL */
+    char **chunk = malloc((argc + 1) * sizeof *chunk);
+    if (chunk == NULL)
+        utils_fatal_error("out of memory: ");
+    memcpy(chunk, argv, prefix * sizeof *chunk);
+
+    int result = 0;
+    long running = 0;
+    bool started = false;
+    size_t next = prefix, end = argc - suffix;
+    while (next < end || !started || running > 0) {
+        if ((next < end || !started) && running < parallel) {
+            /* Take as many words as fit, but always at least one */
+            size_t n = 0, size = 0;
+            while (next + n < end && (n == 0 || size + word_size(argv[next + n]) <= budget))
+                size += word_size(argv[next + n++]);
+
+            memcpy(chunk + prefix, argv + next, n * sizeof *chunk);
+            memcpy(chunk + prefix + n, argv + end, suffix * sizeof *chunk);
+            chunk[prefix + n + suffix] = NULL;
+            next += n;
+            started = true;
+
+            pid_t pid;
+            int rc = posix_spawnp(&pid, chunk[0], NULL, NULL, chunk, envp);
+            if (rc != 0) {
+                errno = rc;
+                utils_error("%s: ", chunk[0]);
+                result = rc == ENOENT ? 127 : 126;
+                break;
+            }
+            running++;
+            continue;
+        }
+
+        int status;
+        if (waitpid(-1, &status, 0) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        running--;
+        if (exit_status(status) > result)
+            result = exit_status(status);
+    }
+
+    /* Collect invocations still running after a spawn failure */
+    for (int status; running > 0 && waitpid(-1, &status, 0) != -1; running--)
+        ;
+
+    free(chunk);
+    return result;
+}
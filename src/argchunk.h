@@ -0,0 +1,31 @@
+#ifndef __ARGCHUNK_H
+#define __ARGCHUNK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Splitting of argument lists that are too long for a single exec,
+ * enabled with 'set -o argchunk=N'.
+ *
+ * The words of argv are divided into a fixed prefix (the command and
+ * its leading options), a fixed suffix (such as the target directory
+ * of cp), and the words in between, which are distributed over as
+ * many invocations as needed, like xargs does.  Each invocation gets
+ * the prefix and suffix.  N is the number of invocations that may
+ * run at the same time; 1 runs them one after another.
+ */
+
+/* Return true if argv and envp together exceed the size that execve
+ * accepts */
+bool argchunk_needed(char **argv, char **envp);
+
+/* Run argv in as many invocations as needed, at most parallel at a
+ * time, and wait for all of them.  prefix and suffix are the numbers
+ * of leading and trailing words passed to every invocation.  Returns
+ * 0 if every invocation succeeded, otherwise the largest exit status
+ * (128+n for a signal n). */
+int argchunk_run(char **argv, char **envp, size_t prefix, size_t suffix,
+                 long parallel);
+
+#endif /* __ARGCHUNK_H */
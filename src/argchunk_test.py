@@ -0,0 +1,72 @@
+#!/usr/bin/python
+#
+# argchunk_test: tests the argchunk option, which splits a command whose
+# arguments exceed ARG_MAX into several invocations.
+#
+# Checks that every argument arrives exactly once, that the literal words
+# before and after the expanded ones are passed to each invocation, and
+# that the exit status combines those of all invocations.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+import tempfile, shutil
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+tmpdir = tempfile.mkdtemp("-cush-argchunk-tests")
+atexit.register(lambda: shutil.rmtree(tmpdir))
+
+# the command logs its first and last argument and its arguments, and
+# fails with status 3 if it gets the argument w250000
+command = os.path.join(tmpdir, "record")
+log = os.path.join(tmpdir, "log")
+args = os.path.join(tmpdir, "args")
+with open(command, "w") as f:
+    f.write('#!/bin/sh\n'
+            'eval last=\\${$#}\n'
+            'echo "$1 $last" >> %s\n'
+            'for a; do echo "$a"; done >> %s\n'
+            'for a; do [ "$a" = w250000 ] && exit 3; done\n'
+            'exit 0\n' % (log, args))
+os.chmod(command, 0o755)
+
+def invocations():
+    with open(log) as f:
+        lines = f.read().splitlines()
+    os.remove(log)
+    return lines
+
+def arguments():
+    with open(args) as f:
+        words = f.read().split()
+    os.remove(args)
+    return words
+
+sendline("set -o argchunk=2")
+expect_prompt("Shell did not print expected prompt after set")
+
+# 200000 words of about 7 bytes are more than the default 2 MB ARG_MAX
+words = ["w%d" % i for i in range(1, 200001)]
+sendline("%s -x w{1..200000} END && echo all succeeded" % command)
+expect_exact("all succeeded", "split command did not succeed")
+expect_prompt()
+
+calls = invocations()
+assert len(calls) > 1, "command was not split"
+assert all(c == "-x END" for c in calls), "prefix or suffix missing: %s" % calls[:3]
+received = arguments()
+assert sorted(w for w in received if w not in ("-x", "END")) == sorted(words), \
+    "arguments were lost or repeated"
+
+# a failing invocation fails the whole command
+sendline("%s -x w{1..300000} END || echo one failed" % command)
+expect_exact("one failed", "status of the failed invocation was lost")
+expect_prompt()
+assert len(invocations()) > 1, "command was not split"
+arguments()
+
+test_success()
@@ -0,0 +1,73 @@
+#!/usr/bin/python
+#
+# autosuggest_test: tests the autosuggest option, which shows the rest
+# of a history line, dimmed, while a command line is typed.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+
+# suggestions come from the history list only
+os.environ.pop("HISTFILE", None)
+
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("echo hello world")
+expect_exact("hello world\r\n")
+expect_prompt()
+sendline("echo help me")
+expect_exact("help me\r\n")
+expect_prompt()
+
+# without the option, nothing is suggested
+console.send("echo h")
+expect_exact("echo h")
+console.send("\r")
+expect_exact("\rh\r\n", "line was changed without the option")
+expect_prompt()
+assert "\033[2m" not in console.before, "suggestion shown without the option"
+
+sendline("set -o autosuggest")
+expect_prompt()
+
+# the newest line that begins with the typed text is suggested, and the
+# cursor is moved back to the end of the text
+console.send("echo he")
+expect_exact("\033[2mlp me\033[0m\033[5D", "newest line was not suggested")
+
+# the suggestion follows the text as it is typed
+console.send("ll")
+expect_exact("ll\033[2mo world\033[0m\033[7D", "suggestion did not follow the text")
+
+# the right arrow inserts the suggestion
+console.send("\033[C")
+expect_exact("\033[Ko world", "suggestion was not inserted")
+console.send("\r")
+expect_exact("\rhello world\r\n", "inserted suggestion did not run")
+expect_prompt()
+
+# a line used more often is suggested over a slightly newer one
+for i in range(3):
+    sendline("echo help me")
+    expect_prompt()
+sendline("echo hello world")
+expect_prompt()
+console.send("echo he")
+expect_exact("\033[2mlp me\033[0m", "more frequent line was not suggested")
+
+# Return erases the suggestion and runs the typed text only
+console.send("\r")
+expect_exact("\033[K\r\n", "suggestion was not erased")
+expect_exact("\rhe\r\n", "typed text did not run")
+expect_prompt()
+
+# Ctrl-F inserts the suggestion too
+console.send("echo hel\006\r")
+expect_exact("\rhelp me\r\n", "Ctrl-F did not insert the suggestion")
+expect_prompt()
+
+test_success()
@@ -0,0 +1,48 @@
+#!/usr/bin/python
+#
+# fanout_bench: compares the throughput and CPU time of writing a stream
+# to two files with cush's 'cmd >a >b' relay and with coreutils tee.
+#
+# Usage: python bench/fanout_bench.py [path-to-cush] [gigabytes] [directory]
+#
+# The files are created in a temporary directory, by default under
+# /tmp; pass a directory on a disk file system to include its writeback.
+# CPU time is the user and system time of all processes of the pipeline,
+# taken from getrusage(RUSAGE_CHILDREN).  Each pipeline is run 3 times,
+# and the fastest run is reported.
+#
+
+import os, resource, subprocess, sys, tempfile, time
+
+cush = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else "./cush")
+gigabytes = int(sys.argv[2]) if len(sys.argv) > 2 else 2
+directory = sys.argv[3] if len(sys.argv) > 3 else None
+
+# Both forms have the same stages: head writes into a pipe, which the
+# relay or tee reads and copies to the files.
+pipelines = [
+    ("cush >a >b", "head -c %dG /dev/zero > a > b" % gigabytes),
+    ("tee a >b", "head -c %dG /dev/zero | tee a > b" % gigabytes),
+    ("cush >a >b >c", "head -c %dG /dev/zero > a > b > c" % gigabytes),
+    ("tee a b >c", "head -c %dG /dev/zero | tee a b > c" % gigabytes),
+]
+
+def run(pipeline, cwd):
+    before = resource.getrusage(resource.RUSAGE_CHILDREN)
+    start = time.perf_counter()
+    subprocess.run([cush, "-c", pipeline], cwd=cwd, check=True)
+    elapsed = time.perf_counter() - start
+    after = resource.getrusage(resource.RUSAGE_CHILDREN)
+    cpu = (after.ru_utime - before.ru_utime) + (after.ru_stime - before.ru_stime)
+    return elapsed, cpu
+
+def best(pipeline):
+    results = []
+    for _ in range(3):
+        with tempfile.TemporaryDirectory(dir=directory) as cwd:
+            results.append(run(pipeline, cwd))
+    return min(results)
+
+for label, pipeline in pipelines:
+    elapsed, cpu = best(pipeline)
+    print("%-14s %8.0f MB/s %8.2f s CPU" % (label, gigabytes * 1024 / elapsed, cpu))
@@ -0,0 +1,53 @@
+#!/usr/bin/python
+#
+# history_index_bench: compares 'history -s' against a linear scan of
+# history logs of 10^6 and 10^7 lines.
+#
+# Usage: python bench/history_index_bench.py [path-to-cush] [directory]
+#
+# Each log holds N lines of generated commands.  The first search
+# builds <log>.idx, and is timed separately; later searches are the
+# best of 5 runs of 'cush -c', less the time of 'cush -c true'.  The
+# linear scan is grep -F over the same log.  Both write to a pipe.
+#
+
+import os, random, subprocess, sys, time
+
+cush = sys.argv[1] if len(sys.argv) > 1 else "./cush"
+directory = sys.argv[2] if len(sys.argv) > 2 else "/tmp"
+
+words = ["git", "commit", "status", "make", "ls", "cd", "grep", "docker",
+         "run", "ssh", "vim", "python", "build", "test", "src", "main.c"]
+
+def make_log(path, n):
+    rand = random.Random(n)
+    with open(path, "w") as f:
+        for start in range(0, n, 100000):
+            f.write("".join(" ".join(rand.choice(words) for _ in range(3))
+                            + " %d\n" % rand.randrange(100000)
+                            for _ in range(start, min(n, start + 100000))))
+
+def run(argv, env):
+    start = time.perf_counter()
+    subprocess.run(argv, env=env, stdout=subprocess.PIPE)
+    return time.perf_counter() - start
+
+def best(argv, env):
+    return min(run(argv, env) for _ in range(5))
+
+for n in [10 ** 6, 10 ** 7]:
+    path = os.path.join(directory, "cush-history-bench")
+    make_log(path, n)
+    env = dict(os.environ, HISTFILE=path)
+    base = best([cush, "-c", "true"], env)
+    build = run([cush, "-c", "history -s zzz"], env) - base
+    print("%9d lines %10d bytes, index built in %.0f ms (%d bytes)"
+          % (n, os.path.getsize(path), build * 1000,
+             os.path.getsize(path + ".idx")))
+    for pattern in ["docker run 4242", "main.c 777", "ssh vim", "git"]:
+        indexed = best([cush, "-c", "history -s \"%s\"" % pattern], env) - base
+        scan = best(["grep", "-F", pattern, path], env)
+        print("  %-16s index %8.2f ms   grep -F %8.2f ms"
+              % (pattern, indexed * 1000, scan * 1000))
+    os.unlink(path)
+    os.unlink(path + ".idx")
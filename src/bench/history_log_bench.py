@@ -0,0 +1,40 @@
+#!/usr/bin/python
+#
+# history_log_bench: measures the startup time of an interactive cush
+# with history logs of growing size.
+#
+# Usage: python bench/history_log_bench.py [path-to-cush] [directory]
+#
+# Each log holds N lines of 'echo entry-i'.  The shell runs on a pty,
+# reads 'exit', and the time until it exits is the best of 5 runs.
+#
+
+import os, pexpect, sys, time
+
+cush = sys.argv[1] if len(sys.argv) > 1 else "./cush"
+directory = sys.argv[2] if len(sys.argv) > 2 else "/tmp"
+
+def make_log(path, n):
+    with open(path, "w") as f:
+        for start in range(0, n, 100000):
+            f.write("".join("echo entry-%d\n" % i
+                            for i in range(start, min(n, start + 100000))))
+
+def startup(path):
+    env = dict(os.environ, HISTFILE=path)
+    best = None
+    for _ in range(5):
+        start = time.perf_counter()
+        shell = pexpect.spawn(cush, env=env, timeout=30)
+        shell.sendline("exit")
+        shell.expect(pexpect.EOF)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+for n in [0, 10 ** 4, 10 ** 6, 10 ** 7]:
+    path = os.path.join(directory, "cush-history-bench")
+    make_log(path, n)
+    print("%9d lines %10d bytes %8.1f ms"
+          % (n, os.path.getsize(path), startup(path) * 1000))
+    os.unlink(path)
@@ -0,0 +1,38 @@
+#!/usr/bin/python
+#
+# pipe_size_bench: measures the throughput and context switches per GB
+# of cush pipelines with 64 KB and 1 MB pipes.
+#
+# Usage: python bench/pipe_size_bench.py [path-to-cush] [gigabytes]
+#
+# Each pipeline runs in a fresh cush with 'set -o pipesize=N'.  Context
+# switches are the voluntary and involuntary switches of all processes
+# of the pipeline, taken from getrusage(RUSAGE_CHILDREN).
+#
+
+import os, resource, subprocess, sys, time
+
+cush = sys.argv[1] if len(sys.argv) > 1 else "./cush"
+gigabytes = int(sys.argv[2]) if len(sys.argv) > 2 else 4
+
+pipelines = [
+    "head -c %dG /dev/zero | cat | cat > /dev/null" % gigabytes,
+    'head -c %dG /dev/zero | tr "\\0" x | wc -c > /dev/null' % gigabytes,
+]
+
+def run(pipesize, pipeline):
+    before = resource.getrusage(resource.RUSAGE_CHILDREN)
+    start = time.perf_counter()
+    subprocess.run([cush, "-c", "set -o pipesize=%d\n%s" % (pipesize, pipeline)],
+                   check=True)
+    elapsed = time.perf_counter() - start
+    after = resource.getrusage(resource.RUSAGE_CHILDREN)
+    switches = (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw)
+    return elapsed, switches
+
+for pipeline in pipelines:
+    print(pipeline)
+    for pipesize, label in [(65536, "64 KB"), (1 << 20, "1 MB")]:
+        elapsed, switches = run(pipesize, pipeline)
+        print("  %-6s %8.0f MB/s %10.0f context switches/GB"
+              % (label, gigabytes * 1024 / elapsed, switches / gigabytes))
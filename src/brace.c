@@ -0,0 +1,361 @@
+/*
+ * Brace expansion.
+ *
+ * The expansion is generated depth-first: the words are assembled in
+ * a single buffer that holds the prefix common to the words still to
+ * come, and each complete word is passed to the callback before the
+ * buffer is truncated for the next alternative.  The memory needed is
+ * bounded from above before anything is generated, from the number
+ * of alternatives and the longest one of each brace expression.
+ */
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brace.h"
+#include "expand.h"
+#include "utils.h"
+
+/* A brace expression within a word */
+struct brace {
+    const char *open, *close;   /* Positions of '{' and the matching '}' */
+    bool sequence;              /* {x..y[..step]} rather than a list */
+    bool letters;               /* The sequence runs over characters */
+    long first, last, step;
+    int width;                  /* Zero-pad numbers to this width */
+};
+
+/* A part of a word still to be expanded */
+struct range {
+    const char *start, *end;
+};
+
+/* Return the matching '}' for the '{' at open, or NULL */
+static const char *
+find_close(const char *open, const char *end)
+{
+    int depth = 0;
+    for (const char *p = open; p < end; p++) {
+        if (*p == '\\' && p + 1 < end)
+            p++;
+        else if (*p == '{')
+            depth++;
+        else if (*p == '}' && --depth == 0)
+            return p;
+    }
+    return NULL;
+}
+
+/* Return true if [open + 1, close) contains a comma outside of nested
+ * braces */
+static bool
+has_top_level_comma(const char *open, const char *close)
+{
+    int depth = 0;
+    for (const char *p = open + 1; p < close; p++) {
+        if (*p == '\\' && p + 1 < close)
+            p++;
+        else if (*p == '{')
+            depth++;
+        else if (*p == '}')
+            depth--;
+        else if (*p == ',' && depth == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Parse an integer of a sequence; returns NULL if there is none */
+static const char *
+parse_number(const char *p, long *value, int *width)
+{
+    const char *start = p;
+    if (*p == '-' || *p == '+')
+        p++;
+    if (!isdigit((unsigned char) *p))
+        return NULL;
+
+    bool padded = *p == '0' && isdigit((unsigned char) p[1]);
+    char *end;
+    *value = strtol(start, &end, 10);
+    if (padded && end - start > *width)
+        *width = end - start;
+    return end;
+}
+
+/* Parse the contents of [b->open + 1, b->close) as x..y[..step] */
+static bool
+parse_sequence(struct brace *b)
+{
+    size_t len = b->close - b->open - 1;
+    char text[64];
+    if (len >= sizeof text)
+        return false;
+    memcpy(text, b->open + 1, len);
+    text[len] = '\0';
+
+    const char *p = text;
+    b->width = 0;
+    b->step = 1;
+    b->letters = isalpha((unsigned char) p[0]) && strncmp(p + 1, "..", 2) == 0;
+    if (b->letters) {
+        if (!isalpha((unsigned char) p[3]))
+            return false;
+        b->first = p[0];
+        b->last = p[3];
+        p += 4;
+    } else {
+        p = parse_number(p, &b->first, &b->width);
+        if (p == NULL || strncmp(p, "..", 2) != 0)
+            return false;
+        p = parse_number(p + 2, &b->last, &b->width);
+        if (p == NULL)
+            return false;
+    }
+
+    if (strncmp(p, "..", 2) == 0) {
+        int ignored = 0;
+        p = parse_number(p + 2, &b->step, &ignored);
+        if (p == NULL)
+            return false;
+        if (b->step < 0)
+            b->step = -b->step;
+        if (b->step == 0)
+            b->step = 1;
+    }
+    return *p == '\0';
+}
+
+/* Find the first brace expression in [start, end) */
+static bool
+find_brace(const char *start, const char *end, struct brace *b)
+{
+    for (const char *p = start; p < end; p++) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+            continue;
+        }
+
+        /* Braces inside $(...), $\(...), or a process substitution
+         * belong to the substituted command */
+        const char *open = *p == '$' ? expand_substitution_open(p) : NULL;
+        if (open != NULL) {
+            const char *close = expand_substitution_end(open);
+            if (close == NULL || close >= end)
+                return false;
+            p = close;
+            continue;
+        }
+
+        if (*p != '{' || (p > start && p[-1] == '$'))
+            continue;
+
+        b->open = p;
+        b->close = find_close(p, end);
+        if (b->close == NULL)
+            return false;
+
+        b->sequence = !has_top_level_comma(b->open, b->close);
+        if (!b->sequence || parse_sequence(b))
+            return true;
+    }
+    return false;
+}
+
+/* Number of words in a sequence */
+static size_t
+sequence_length(struct brace *b)
+{
+    unsigned long span = b->first <= b->last ? (unsigned long) b->last - b->first
+                                             : (unsigned long) b->first - b->last;
+    return span / b->step + 1;
+}
+
+/* Store the text of the i-th element of a sequence in buf */
+static size_t
+sequence_element(struct brace *b, size_t i, char *buf, size_t size)
+{
+    long offset = (long) i * b->step;
+    long value = b->first <= b->last ? b->first + offset : b->first - offset;
+
+    if (b->letters) {
+        buf[0] = value;
+        buf[1] = '\0';
+        return 1;
+    }
+    return snprintf(buf, size, "%0*ld", b->width, value);
+}
+
+static size_t
+saturating_mul(size_t a, size_t b)
+{
+    return b != 0 && a > SIZE_MAX / b ? SIZE_MAX : a * b;
+}
+
+static size_t
+saturating_add(size_t a, size_t b)
+{
+    return a > SIZE_MAX - b ? SIZE_MAX : a + b;
+}
+
+/* Compute the number of words [start, end) expands to and an upper
+ * bound on their length */
+static void
+estimate(const char *start, const char *end, size_t *count, size_t *maxlen)
+{
+    struct brace b;
+    if (!find_brace(start, end, &b)) {
+        *count = 1;
+        *maxlen = end - start;
+        return;
+    }
+
+    size_t n = 0, len = 0;
+    if (b.sequence) {
+        char element[32];
+        n = sequence_length(&b);
+        len = sequence_element(&b, 0, element, sizeof element);
+        size_t last = sequence_element(&b, n - 1, element, sizeof element);
+        if (last > len)
+            len = last;
+    } else {
+        const char *alt = b.open + 1;
+        for (const char *p = alt; p <= b.close; p++) {
+            if (*p == '\\' && p + 1 < b.close) {
+                p++;
+            } else if (*p == '{') {
+                const char *close = find_close(p, b.close);
+                if (close != NULL)
+                    p = close;
+            } else if (*p == ',' || p == b.close) {
+                size_t c, l;
+                estimate(alt, p, &c, &l);
+                n = saturating_add(n, c);
+                if (l > len)
+                    len = l;
+                alt = p + 1;
+            }
+        }
+    }
+
+    size_t rest_count, rest_len;
+    estimate(b.close + 1, end, &rest_count, &rest_len);
+    *count = saturating_mul(n, rest_count);
+    *maxlen = saturating_add((b.open - start) + len, rest_len);
+}
+
+/* The word being assembled */
+struct generator {
+    char *buf;
+    size_t len, capacity;
+    brace_emit_fn *emit;
+    void *ctx;
+};
+
+static void
+append(struct generator *g, const char *s, size_t len)
+{
+    if (g->len + len + 1 > g->capacity) {
+        while (g->len + len + 1 > g->capacity)
+            g->capacity = g->capacity ? 2 * g->capacity : 64;
+        g->buf = realloc(g->buf, g->capacity);
+        if (g->buf == NULL)
+            utils_fatal_error("out of memory: ");
+    }
+    memcpy(g->buf + g->len, s, len);
+    g->len += len;
+    g->buf[g->len] = '\0';
+}
+
+static void generate(struct generator *g, struct range *ranges, size_t n);
+
+/* Expand the alternative [start, end) of a brace expression, followed
+ * by the text after the expression and the remaining ranges */
+static void
+generate_alternative(struct generator *g, const char *start, const char *end,
+                     const char *after, const char *word_end,
+                     struct range *ranges, size_t n)
+{
+    struct range next[n + 2];
+    next[0] = (struct range) { start, end };
+    next[1] = (struct range) { after, word_end };
+    memcpy(next + 2, ranges, n * sizeof *ranges);
+    generate(g, next, n + 2);
+}
+
+/* Append the expansions of the concatenated ranges to the buffer and
+ * emit each complete word.  The buffer is restored before returning. */
+static void
+generate(struct generator *g, struct range *ranges, size_t n)
+{
+    if (n == 0) {
+        g->emit(g->buf, g->ctx);
+        return;
+    }
+
+    struct brace b;
+    const char *start = ranges[0].start, *end = ranges[0].end;
+    if (!find_brace(start, end, &b)) {
+        size_t len = g->len;
+        append(g, start, end - start);
+        generate(g, ranges + 1, n - 1);
+        g->len = len;
+        g->buf[len] = '\0';
+        return;
+    }
+
+    size_t len = g->len;
+    append(g, start, b.open - start);
+
+    if (b.sequence) {
+        size_t count = sequence_length(&b);
+        for (size_t i = 0; i < count; i++) {
+            char element[32];
+            size_t elen = sequence_element(&b, i, element, sizeof element);
+            generate_alternative(g, element, element + elen, b.close + 1, end,
+                                 ranges + 1, n - 1);
+        }
+    } else {
+        const char *alt = b.open + 1;
+        for (const char *p = alt; p <= b.close; p++) {
+            if (*p == '\\' && p + 1 < b.close) {
+                p++;
+            } else if (*p == '{') {
+                const char *close = find_close(p, b.close);
+                if (close != NULL)
+                    p = close;
+            } else if (*p == ',' || p == b.close) {
+                generate_alternative(g, alt, p, b.close + 1, end, ranges + 1, n - 1);
+                alt = p + 1;
+            }
+        }
+    }
+    g->len = len;
+    g->buf[len] = '\0';
+}
+
+/* Call emit for each word that word expands to, in order */
+int
+brace_expand(const char *word, size_t max_bytes, brace_emit_fn *emit, void *ctx)
+{
+    const char *end = word + strlen(word);
+    size_t count, maxlen;
+    estimate(word, end, &count, &maxlen);
+
+    size_t bytes = saturating_mul(count, saturating_add(maxlen, 1 + sizeof(char *)));
+    if (max_bytes != 0 && bytes > max_bytes) {
+        fprintf(stderr, "%s: brace expansion too large (%zu words, "
+                "limit is %zu bytes)\n", word, count, max_bytes);
+        return -1;
+    }
+
+    struct generator g = { NULL, 0, 0, emit, ctx };
+    struct range range = { word, end };
+    append(&g, "", 0);
+    generate(&g, &range, 1);
+    free(g.buf);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef __BRACE_H
+#define __BRACE_H
+
+#include <stddef.h>
+
+/*
+ * Brace expansion: a{b,c}d stands for abd acd, {1..5} for 1 2 3 4 5,
+ * {01..10..3} for 01 04 07 10, and {a..e} for a b c d e.  Lists may
+ * be nested.  A brace that does not start a list or sequence, that
+ * is escaped, or that follows a '$' is left as it is.
+ *
+ * The words are produced one at a time and handed to a callback, so
+ * no list of intermediate strings is built.
+ */
+
+/* Callback receiving each word; word is only valid during the call */
+typedef void brace_emit_fn(const char *word, void *ctx);
+
+/* Call emit for each word that word expands to, in order.  A word
+ * without a brace expression is passed on unchanged.  Returns -1 and
+ * prints an error, without calling emit, if the words would take
+ * more than max_bytes of memory (0: no limit). */
+int brace_expand(const char *word, size_t max_bytes,
+                 brace_emit_fn *emit, void *ctx);
+
+#endif /* __BRACE_H */
@@ -0,0 +1,46 @@
+#!/usr/bin/python
+#
+# brace_expansion_test: tests {a,b} lists, {x..y} sequences, and the
+# bracemax limit.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# lists, with nesting and an empty alternative
+sendline("echo pre{a,b{1,2},}post")
+expect_exact("preapost preb1post preb2post prepost", "brace list was not expanded")
+expect_prompt()
+
+# numeric sequences, descending, zero padded, and with a step
+sendline("echo {1..4} {3..1} {08..11} {1..10..4}")
+expect_exact("1 2 3 4 3 2 1 08 09 10 11 1 5 9", "sequence was not expanded")
+expect_prompt()
+
+# letter sequences and several expressions in one word
+sendline("echo {a..c}{1,2}")
+expect_exact("a1 a2 b1 b2 c1 c2", "letter sequence or product is wrong")
+expect_prompt()
+
+# quoted and escaped braces, ${name}, and non-expressions stay as they are
+sendline('X=v; echo "{a,b}" \\{c,d\\} ${X} {e} {f')
+expect_exact("{a,b} {c,d} v {e} {f", "brace was expanded where it should not be")
+expect_prompt()
+
+# a large sequence is streamed into the command's arguments
+sendline("echo {1..100000} | wc -w")
+expect_exact("100000", "large sequence has the wrong number of words")
+expect_prompt()
+
+# an expansion over the limit is an error and the command does not run
+sendline("echo {1..1000000}{1..1000} || echo refused")
+expect_exact("brace expansion too large", "bracemax limit was not enforced")
+expect_exact("refused", "failed expansion did not fail the command")
+expect_prompt()
+
+test_success()
@@ -0,0 +1,135 @@
+/*
+ * Capturing the output of a child process.
+ */
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "capture.h"
+#include "utils.h"
+
+/* Wait until fd is readable.  Returns -1 if cancelled or on error. */
+static int
+wait_readable(int fd, const sigset_t *wait_mask,
+              capture_cancel_fn *cancelled, void *ctx)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    for (;;) {
+        if (cancelled(ctx))
+            return -1;
+        if (ppoll(&pfd, 1, NULL, wait_mask) > 0)
+            return 0;
+        if (errno != EINTR) {
+            utils_error("poll: ");
+            return -1;
+        }
+    }
+}
+
+/* Move the output still in the pipe, after the len bytes already read
+ * into buf, into a memfd and map it */
+static int
+capture_to_memfd(int fd, struct capture *out, const sigset_t *wait_mask,
+                 capture_cancel_fn *cancelled, void *ctx)
+{
+    int memfd = memfd_create("cush-capture", MFD_CLOEXEC);
+    if (memfd == -1) {
+        utils_error("memfd_create: ");
+        return -1;
+    }
+
+    int rc = -1;
+    if (write(memfd, out->data, out->len) != (ssize_t) out->len) {
+        utils_error("write: ");
+        goto out;
+    }
+
+    size_t len = out->len;
+    for (;;) {
+        if (wait_readable(fd, wait_mask, cancelled, ctx) == -1)
+            goto out;
+
+        ssize_t n = splice(fd, NULL, memfd, NULL, CAPTURE_BUFFER_MAX, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0)
+            break;
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            utils_error("splice: ");
+            goto out;
+        }
+        len += n;
+    }
+
+    char *data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, memfd, 0);
+    if (data == MAP_FAILED) {
+        utils_error("mmap: ");
+        goto out;
+    }
+
+    free(out->data);
+    out->data = data;
+    out->len = len;
+    out->mapped = len;
+    rc = 0;
+
+out:
+    close(memfd);
+    return rc;
+}
+
+/* Read fd until end of file into out */
+int
+capture_fd(int fd, struct capture *out, const sigset_t *wait_mask,
+           capture_cancel_fn *cancelled, void *ctx)
+{
+    size_t capacity = 4096;
+    out->data = malloc(capacity);
+    out->len = 0;
+    out->mapped = 0;
+    if (out->data == NULL)
+        utils_fatal_error("out of memory: ");
+
+    for (;;) {
+        if (out->len == capacity) {
+            if (capacity == CAPTURE_BUFFER_MAX)
+                return capture_to_memfd(fd, out, wait_mask, cancelled, ctx);
+
+            capacity *= 2;
+            out->data = realloc(out->data, capacity);
+            if (out->data == NULL)
+                utils_fatal_error("out of memory: ");
+        }
+
+        if (wait_readable(fd, wait_mask, cancelled, ctx) == -1)
+            return -1;
+
+        ssize_t n = read(fd, out->data + out->len, capacity - out->len);
+        if (n == 0)
+            return 0;
+        if (n == -1) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            utils_error("read: ");
+            return -1;
+        }
+        out->len += n;
+    }
+}
+
+/* Release the memory of a capture */
+void
+capture_free(struct capture *capture)
+{
+    if (capture->mapped)
+        munmap(capture->data, capture->mapped);
+    else
+        free(capture->data);
+    capture->data = NULL;
+    capture->len = capture->mapped = 0;
+}
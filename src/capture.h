@@ -0,0 +1,38 @@
+#ifndef __CAPTURE_H
+#define __CAPTURE_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Collecting everything a child writes into a pipe, as needed for
+ * command substitution.
+ *
+ * Output is read into a growable buffer.  Once it outgrows
+ * CAPTURE_BUFFER_MAX, the rest is spliced from the pipe into a memfd
+ * without passing through user space, and the memfd is mapped so
+ * that the output can still be used as one contiguous string.
+ */
+#define CAPTURE_BUFFER_MAX (1 << 20)
+
+struct capture {
+    char *data;             /* The output, not NUL-terminated */
+    size_t len;             /* Its length */
+    size_t mapped;          /* If not 0, data is a mapping of this size */
+};
+
+/* Called while waiting for output; returning true stops the capture */
+typedef bool capture_cancel_fn(void *ctx);
+
+/* Read fd until end of file into out.  While waiting, the signal mask
+ * is replaced by wait_mask, and cancelled is checked after each signal.
+ * Returns -1 if cancelled or on error.  In either case, out must be
+ * released with capture_free. */
+int capture_fd(int fd, struct capture *out, const sigset_t *wait_mask,
+               capture_cancel_fn *cancelled, void *ctx);
+
+/* Release the memory of a capture */
+void capture_free(struct capture *capture);
+
+#endif /* __CAPTURE_H */
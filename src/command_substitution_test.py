@@ -0,0 +1,46 @@
+#!/usr/bin/python
+#
+# command_substitution_test: tests $(...) splitting, quoting, nesting,
+# assignments, large outputs, and interrupting a substitution.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# unquoted output is split into words, trailing newlines are removed
+sendline('for w in $(printf "a b\\nc\\n\\n"); do echo [$w]; done')
+expect_exact("[a]", "substitution was not split")
+expect_exact("[b]", "substitution was not split")
+expect_exact("[c]", "substitution was not split")
+expect_prompt()
+
+# quoted output and assignments stay one word; substitutions nest
+sendline('X=$(printf "1   2"); echo "[$(echo $(echo in)  "$X")]"')
+expect_exact("[in 1   2]", "quoted or nested substitution is wrong")
+expect_prompt()
+
+# pipes and lists inside a substitution
+sendline("echo $(echo abc | tr a-c x-z; false || echo ok)")
+expect_exact("xyz ok", "pipeline inside substitution failed")
+expect_prompt()
+
+# a large output goes through a memfd
+sendline("echo $(seq 1 500000) | wc -w")
+expect_exact("500000", "large substitution has the wrong number of words")
+expect_prompt()
+
+# Ctrl-C fails the substitution and the command that contains it
+sendline("echo $(sleep 10) && echo ran")
+time.sleep(0.5)
+console.sendintr()
+expect_prompt("shell did not return to the prompt after Ctrl-C")
+sendline("echo after")
+expect_exact("after", "shell did not recover from an interrupted substitution")
+expect_prompt()
+
+test_success()
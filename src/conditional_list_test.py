@@ -0,0 +1,58 @@
+#!/usr/bin/python
+#
+# conditional_list_test: tests the && and || operators.
+#
+# A pipeline after && runs only if the previous one succeeded, and a
+# pipeline after || only if it failed. Skipped pipelines keep the
+# previous exit status.
+#
+
+import sys, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("true && echo and-ran")
+expect_exact("and-ran", "&& did not run after a successful command")
+expect_prompt()
+
+sendline("false && echo and-skipped; echo next")
+expect_prompt("Shell did not print expected prompt after skipped &&")
+assert "and-skipped" not in console.before, "&& ran after a failed command"
+
+sendline("false || echo or-ran")
+expect_exact("or-ran", "|| did not run after a failed command")
+expect_prompt()
+
+sendline("true || echo or-skipped; echo next")
+expect_prompt("Shell did not print expected prompt after skipped ||")
+assert "or-skipped" not in console.before, "|| ran after a successful command"
+
+# the status of a skipped pipeline carries over: 'false && x || y' runs y
+sendline("false && echo skipped || echo fallback")
+expect_exact("fallback", "status did not carry over a skipped pipeline")
+expect_prompt()
+
+# the status of a pipeline is that of its last command
+sendline("false | true && echo pipe-ok")
+expect_exact("pipe-ok", "pipeline status was not taken from its last command")
+expect_prompt()
+
+# commands that cannot be started count as failures
+sendline("no-such-command-cush || echo not-found")
+expect_exact("not-found", "a command that failed to spawn did not count as failed")
+expect_prompt()
+
+# '&' runs the whole list in the background, not only its last pipeline
+start = time.time()
+sendline("sleep 1 && echo list-done &")
+expect_prompt("Shell did not print expected prompt after a background list")
+assert time.time() - start < 0.8, "the first pipeline of a background list ran in the foreground"
+sendline("wait")
+expect_exact("list-done\r\n", "the background list did not run to its end")
+expect_prompt()
+
+test_success()
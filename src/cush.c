@@ -21,6 +21,10 @@
 #include <readline/history.h>
 #include <linux/limits.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <ctype.h>
+#include <limits.h>
 
 /* Since the handed out code contains a number of unused functions. */
 #pragma GCC diagnostic ignored "-Wunused-function"
@@ -29,6 +33,21 @@
 #include "signal_support.h"
 #include "shell-ast.h"
 #include "utils.h"
+#include "line_reader.h"
+#include "shell_options.h"
+#include "suggest.h"
+#include "variables.h"
+#include "expand.h"
+#include "fastglob.h"
+#include "argchunk.h"
+#include "capture.h"
+#include "fanout.h"
+#include "histindex.h"
+#include "histlog.h"
+#include "linemerge.h"
+#include "pipecount.h"
+#include "profile.h"
+#include "ringbuf.h"
 
 static void handle_child_status(pid_t pid, int status);
 static void execute_command_line(struct ast_command_line *);
@@ -37,13 +56,20 @@ static void delete_dead_jobs(void);
 
 // Built-in function prototypes
 static int call_builtin(char **argv, struct job *job);
-static void jobs_builtin(void);
-static void exit_builtin(void);
+static bool is_builtin(char *cmd);
+static void jobs_builtin(bool long_format);
+static void exit_builtin(char *arg);
 static void stop_builtin(int jid, struct job *job);
 static void fg_builtin(char *arg);
 static void bg_builtin(char *arg);
 static void kill_builtin(int jid, struct job *job);
-static void history_builtin(char *arg);
+static void history_builtin(char **argv);
+static void output_builtin(char **argv);
+static void parallel_builtin(char **argv, struct job *job);
+static void set_builtin(char **argv);
+static void wait_builtin(char **argv, struct job *job);
+static void export_builtin(char **argv);
+static void unset_builtin(char **argv);
 static int check_expansion(char **argv);
 
 // Custom Prompt function prototypes
@@ -53,8 +79,10 @@ char *get_only_current_dir(void);
 static void
 usage(char *progname)
 {
-    printf("Usage: %s -h\n"
-           " -h            print this help\n",
+    printf("Usage: %s [-h] [-c command] [script]\n"
+           " -h            print this help\n"
+           " -c command    execute command and exit\n"
+           " script        execute the commands in file script and exit\n",
            progname);
 
     exit(EXIT_SUCCESS);
@@ -156,6 +184,10 @@ enum job_status
     STOPPED,       /* job is stopped via SIGSTOP */
     NEEDSTERMINAL, /* job is stopped because it was a background job
                       and requires exclusive terminal access */
+    QUEUED,        /* background job that has not been started yet because
+                      the maxjobs limit was reached */
+    DONE,          /* job has finished, but is kept until its captured
+                      output has been shown */
 };
 
 struct job
@@ -170,16 +202,61 @@ struct job
     struct termios saved_tty_state; /* The state of the terminal when this job was
                                        stopped after having been in foreground */
     bool termstate_saved;           /* Tracks whether or not the terminal state has been saved before. */
+    int output_fd;                  /* If not -1, stdout and stderr of the job's processes go here. */
+    pid_t last_pid;                 /* Process running the pipeline's last command. */
+    int exit_status;                /* Exit status of the last command, 128+n if killed by signal n. */
+    char ***argv;                   /* Expanded argv of each command; aliases the command's argv if it
+                                       needed no expansion. */
+    char *iored_input;              /* Expanded redirections of the pipeline, or aliases of the */
+    char *iored_output;             /* pipeline's own if they needed no expansion. */
+    char **extra_outputs;           /* Expanded further targets of 'cmd >a >b'. */
+    int relay_fd;                   /* If not -1, the last command's output goes here, to the
+                                       relay that copies it to all output targets. */
+    struct linemerge_source *merged; /* If not NULL, the pipe through which the shell prints
+                                        or captures the output of this background job. */
+    struct ringbuf *capture;        /* If not NULL, the last output of this background job. */
+    struct profile *profile;        /* If not NULL, samples of this foreground job's stages. */
+    struct pipecount *pipecount;    /* If not NULL, counters of the relays in this job's pipes. */
+    bool expansion_failed;          /* An expansion error was reported; the job does not run. */
+    bool notified;                  /* The jobs builtin listed this finished job as Done. */
+    struct process_substitution *procsubs; /* The <(...) and >(...) of the job's commands, */
+    int num_procsubs;                      /* started with the job. */
 
     /* Add additional fields here if needed. */
 };
 
+/* A <(command) or >(command) word of a job. The command is started as part
+   of the job, connected through a pipe to the job's command that names
+   the other end of the pipe by its /dev/fd path. */
+struct process_substitution
+{
+    struct ast_command *group; /* The command, as a subshell group. */
+    bool output;               /* True for >(command), which reads the pipe. */
+    int fd;                    /* End of the pipe for the job's command, which
+                                  is named by /dev/fd/<fd> in the shell and in
+                                  the command; -1 once closed. */
+    int inner_fd;              /* End of the pipe for the substituted command. */
+    int command;               /* Index of the job's command whose argv names
+                                  fd, -1 for a redirection. */
+};
+
 struct pid
 {
     pid_t pid;             /* PID stored within wrapper struct. */
     struct list_elem elem; /* Link element for pids list. */
 };
 
+static void start_job(struct job *job);
+static void execute_compound(struct ast_command *cmd);
+static void fork_group(struct job *job, struct ast_command *cmd, int in_fd, int out_fd, int (*pipefds)[2], int num_pipes);
+static bool needs_chunking(char **assignments, int num_assignments);
+static int open_heredoc(const char *text);
+static int command_index(struct job *job, struct ast_command *cmd);
+static void start_process_substitutions(struct job *job);
+static void resize_pipe(int fd, long size);
+static void start_pipe_counter(struct job *job, int i, long size, int (*pipefds)[2], int num_pipes);
+static int start_output_relay(struct job *job);
+
 /* Utility functions for job list management.
  * We use 2 data structures:
  * (a) an array jid2job to quickly find a job based on its id
@@ -192,6 +269,24 @@ static struct job *jid2job[MAXJOBS];
 
 static int err;
 
+/* True if the shell reads commands from a terminal.  A non-interactive
+   shell (script, -c, or piped stdin) does not touch the terminal, does
+   not put jobs into their own process groups, and does not print job
+   notifications. */
+static bool interactive;
+
+/* Exit status of the most recent foreground job or builtin. */
+static int last_exit_status;
+
+/* True while executing the final line of a -c command string.  The last
+   simple foreground command of that line may replace the shell. */
+static bool tail_exec_allowed;
+
+/* Set when Ctrl-C or Ctrl-Z ends a foreground job, or when Ctrl-C interrupts
+   a builtin that waits. Stops the rest of the command line, including any
+   loops that are running. */
+static bool interrupt_pending;
+
 /* Return job corresponding to jid */
 static struct job *
 get_job_from_jid(int jid)
@@ -202,17 +297,158 @@ get_job_from_jid(int jid)
     return NULL;
 }
 
+/* The job whose words are being expanded, and the index of the command
+   being expanded (-1 for redirections). Process substitutions found during
+   expansion are added to this job. */
+static struct job *expanding_job;
+static int expanding_command;
+
+/* Returns the expansion of a pipeline's input file, here-document or
+   here-string, or NULL if it needs none. The text of a here-document is
+   not a word, so only its variables and substitutions are expanded. */
+static char *
+expand_input(struct ast_pipeline *pipe, bool *failed)
+{
+    if (pipe->input_kind == AST_INPUT_HEREDOC)
+        return expand_heredoc(pipe->iored_input, failed);
+    return expand_word(pipe->iored_input, failed);
+}
+
+/* Expands the words of a job's pipeline. This happens when the job is
+   created, so that a queued job sees the variables of the moment it was
+   entered and a loop body is expanded anew on each iteration. The words
+   of a literal pipeline are used as they are. */
+static void
+expand_job(struct job *job)
+{
+    struct ast_pipeline *pipe = job->pipe;
+    job->argv = malloc(list_size(&pipe->commands) * sizeof *job->argv);
+
+    // A command substitution expands its own job in the middle of this one.
+    struct job *saved_job = expanding_job;
+    int saved_command = expanding_command;
+    expanding_job = job;
+
+    int i = 0;
+    for (struct list_elem *e = list_begin(&pipe->commands); e != list_end(&pipe->commands); e = list_next(e))
+    {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        expanding_command = i;
+        char **argv = pipe->literal ? NULL : expand_argv(cmd->argv, &job->expansion_failed);
+        job->argv[i++] = argv != NULL ? argv : cmd->argv;
+    }
+
+    expanding_command = -1;
+    job->iored_input = pipe->iored_input;
+    job->iored_output = pipe->iored_output;
+    if (pipe->iored_input != NULL && pipe->input_kind != AST_INPUT_HEREDOC_LITERAL && !pipe->literal
+        && (job->iored_input = expand_input(pipe, &job->expansion_failed)) == NULL)
+    {
+        job->iored_input = pipe->iored_input;
+    }
+    if (pipe->iored_output != NULL && !pipe->literal && (job->iored_output = expand_word(pipe->iored_output, &job->expansion_failed)) == NULL)
+    {
+        job->iored_output = pipe->iored_output;
+    }
+    job->extra_outputs = malloc(pipe->num_extra_outputs * sizeof *job->extra_outputs);
+    for (i = 0; i < pipe->num_extra_outputs; i++)
+    {
+        char *path = pipe->extra_outputs[i].path;
+        if (pipe->literal || (job->extra_outputs[i] = expand_word(path, &job->expansion_failed)) == NULL)
+        {
+            job->extra_outputs[i] = strdup(path);
+        }
+    }
+    expanding_job = saved_job;
+    expanding_command = saved_command;
+}
+
+/* Releases the expansions made by expand_job. */
+static void
+free_job_expansions(struct job *job)
+{
+    struct ast_pipeline *pipe = job->pipe;
+
+    int i = 0;
+    for (struct list_elem *e = list_begin(&pipe->commands); e != list_end(&pipe->commands); e = list_next(e))
+    {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        if (job->argv[i] != cmd->argv)
+        {
+            argv_free(job->argv[i]);
+        }
+        i++;
+    }
+    free(job->argv);
+
+    if (job->iored_input != pipe->iored_input)
+    {
+        free(job->iored_input);
+    }
+    if (job->iored_output != pipe->iored_output)
+    {
+        free(job->iored_output);
+    }
+    for (int i = 0; i < pipe->num_extra_outputs; i++)
+    {
+        free(job->extra_outputs[i]);
+    }
+    free(job->extra_outputs);
+
+    // Process substitutions of a job that never started are closed here.
+    for (int i = 0; i < job->num_procsubs; i++)
+    {
+        struct process_substitution *p = &job->procsubs[i];
+        if (p->fd != -1)
+            close(p->fd);
+        if (p->inner_fd != -1)
+            close(p->inner_fd);
+        ast_command_free(p->group);
+    }
+    free(job->procsubs);
+}
+
+/* Returns true if a job id is free */
+static bool
+jid_available(void)
+{
+    for (int i = 1; i < MAXJOBS; i++)
+    {
+        if (jid2job[i] == NULL)
+            return true;
+    }
+    return false;
+}
+
 /* Add a new job to the job list */
 static struct job *
 add_job(struct ast_pipeline *pipe)
 {
+    // Finished background jobs that were never waited for are given up
+    // before they fill the job table.
+    if (!jid_available())
+        delete_dead_jobs();
+
     struct job *job = malloc(sizeof *job);
     job->pgid = 0;
     job->pipe = pipe;
     job->num_processes_alive = 0;
     job->termstate_saved = false;
+    job->output_fd = -1;
+    job->last_pid = 0;
+    job->exit_status = 0;
+    job->expansion_failed = false;
+    job->notified = false;
+    job->procsubs = NULL;
+    job->num_procsubs = 0;
+    job->relay_fd = -1;
+    job->merged = NULL;
+    job->capture = NULL;
+    job->profile = NULL;
+    job->pipecount = NULL;
     list_init(&job->pids);
     list_push_back(&job_list, &job->elem);
+    expand_job(job);
 
     if (pipe->bg_job)
     {
@@ -248,6 +484,37 @@ add_pid_to_job(pid_t pid, struct job *job)
     job->num_processes_alive++;
 }
 
+/* Records a newly started process of a job. The first process determines the
+   job's process group; a foreground job is then given the terminal and a
+   background job is announced. The last process started supplies the job's
+   exit status. */
+static void
+add_process_to_job(struct job *job, pid_t pid)
+{
+    if (job->pgid == 0 && !interactive)
+    {
+        job->pgid = pid; /* No process group; remember the first process instead. */
+    }
+    else if (job->pgid == 0)
+    {
+        job->pgid = getpgid(pid);
+        if (job->pipe->bg_job)
+        {
+            printf("[%d] %d\n", job->jid, job->pgid);
+        }
+        else if (job->status == FOREGROUND)
+        {
+            err = tcsetpgrp(termstate_get_tty_fd(), job->pgid);
+            if (err == -1)
+            {
+                printf("%s", strerror(errno));
+            }
+        }
+    }
+    add_pid_to_job(pid, job);
+    job->last_pid = pid;
+}
+
 /* Iterates through the current job list and each job list's pid list to find the job
    belonging to the given pid. */
 static struct job *
@@ -279,25 +546,55 @@ find_job_of_pid(pid_t g_pid)
 static void
 delete_job(struct job *job)
 {
-    list_remove(&job->elem);
-
-    if (job->pipe->bg_job)
+    if (job->status != DONE)
     {
-        printf("[%d]\tDone\n", job->jid);
-    }
+        // Lines the job wrote are printed before it is reported done.
+        if (job->merged != NULL)
+        {
+            fflush(stdout);
+            linemerge_release(job->merged, STDOUT_FILENO);
+        }
 
-    // Frees internal job PID list.
-    while (!list_empty(&job->pids))
-    {
-        struct list_elem *e = list_pop_front(&job->pids);
-        struct pid *to_free = list_entry(e, struct pid, elem);
-        free(to_free);
+        if (job->pipe->bg_job && interactive && !job->notified)
+        {
+            printf("[%d]\tDone\n", job->jid);
+        }
+
+        // Frees internal job PID list.
+        while (!list_empty(&job->pids))
+        {
+            struct list_elem *e = list_pop_front(&job->pids);
+            struct pid *to_free = list_entry(e, struct pid, elem);
+            free(to_free);
+        }
+
+        // A job with captured output stays in the job list until the output
+        // builtin has shown it.
+        if (job->capture != NULL)
+        {
+            job->status = DONE;
+            return;
+        }
     }
+    list_remove(&job->elem);
 
     int jid = job->jid;
     assert(jid != -1);
     jid2job[jid]->jid = -1;
     jid2job[jid] = NULL;
+    if (job->output_fd != -1)
+    {
+        close(job->output_fd);
+    }
+    if (job->capture != NULL)
+    {
+        ringbuf_free(job->capture);
+    }
+    if (job->pipecount != NULL)
+    {
+        pipecount_free(job->pipecount);
+    }
+    free_job_expansions(job);
     ast_pipeline_free(job->pipe);
     free(job);
 }
@@ -307,20 +604,42 @@ delete_job(struct job *job)
 static void
 delete_dead_jobs(void)
 {
-    for (int i = list_size(&job_list); i > 0; i--)
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list);)
     {
-        struct list_elem *e = list_pop_front(&job_list);
         struct job *curr_job = list_entry(e, struct job, elem);
+        e = list_next(e);
 
-        if (curr_job->num_processes_alive <= 0)
+        if (curr_job->num_processes_alive <= 0 && curr_job->status != QUEUED && curr_job->status != DONE)
         {
             delete_job(curr_job);
         }
-        else
+    }
+}
+
+/* Send signal sig to a job.  With job control, each job forms its own
+   process group; otherwise its processes are signaled one by one. */
+static int
+signal_job(struct job *job, int sig)
+{
+    if (job->pgid == 0)
+    {
+        return 0; /* Not started yet; never signal our own process group. */
+    }
+
+    if (interactive)
+    {
+        return killpg(job->pgid, sig);
+    }
+
+    int rc = 0;
+    for (struct list_elem *e = list_begin(&job->pids); e != list_end(&job->pids); e = list_next(e))
+    {
+        if (kill(list_entry(e, struct pid, elem)->pid, sig) == -1 && errno != ESRCH)
         {
-            list_push_back(&job_list, e);
+            rc = -1;
         }
     }
+    return rc;
 }
 
 static const char *
@@ -336,11 +655,29 @@ get_status(enum job_status status)
         return "Stopped";
     case NEEDSTERMINAL:
         return "Stopped (tty)";
+    case QUEUED:
+        return "Queued";
+    case DONE:
+        return "Done";
     default:
         return "Unknown";
     }
 }
 
+static void print_cmdline(struct ast_pipeline *pipeline);
+
+/* Print the pipelines of a list, separated by semicolons. */
+static void
+print_cmdline_list(struct ast_command_line *cline)
+{
+    for (struct list_elem *e = list_begin(&cline->pipes); e != list_end(&cline->pipes); e = list_next(e))
+    {
+        if (e != list_begin(&cline->pipes))
+            printf("; ");
+        print_cmdline(list_entry(e, struct ast_pipeline, elem));
+    }
+}
+
 /* Print the command line that belongs to one job. */
 static void
 print_cmdline(struct ast_pipeline *pipeline)
@@ -351,6 +688,36 @@ print_cmdline(struct ast_pipeline *pipeline)
         struct ast_command *cmd = list_entry(e, struct ast_command, elem);
         if (e != list_begin(&pipeline->commands))
             printf("| ");
+
+        // Groups print their pipelines between parentheses or braces.
+        if (cmd->group != NULL)
+        {
+            printf("%s", cmd->subshell ? "(" : "{ ");
+            print_cmdline_list(cmd->group);
+            printf("%s", cmd->subshell ? ")" : "; }");
+            continue;
+        }
+
+        if (cmd->loop != NULL)
+        {
+            struct ast_loop *loop = cmd->loop;
+            if (loop->kind == AST_LOOP_FOR)
+            {
+                printf("for %s in", loop->variable);
+                for (char **w = loop->words; *w; w++)
+                    printf(" %s", *w);
+            }
+            else
+            {
+                printf("while ");
+                print_cmdline_list(loop->condition);
+            }
+            printf("; do ");
+            print_cmdline_list(loop->body);
+            printf("; done");
+            continue;
+        }
+
         char **p = cmd->argv;
         printf("%s", *p++);
         while (*p)
@@ -362,7 +729,8 @@ print_cmdline(struct ast_pipeline *pipeline)
 static void
 print_job(struct job *job)
 {
-    printf("[%d]\t%s\t\t(", job->jid, get_status(job->status));
+    bool finished = job->status == BACKGROUND && job->num_processes_alive <= 0;
+    printf("[%d]\t%s\t\t(", job->jid, get_status(finished ? DONE : job->status));
     print_cmdline(job->pipe);
     printf(")\n");
 }
@@ -396,6 +764,169 @@ sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
     }
 }
 
+/* Returns the number of background jobs that are currently running. */
+static int
+count_running_background_jobs(void)
+{
+    int running = 0;
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+    {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job->pipe->bg_job && job->status == BACKGROUND && job->num_processes_alive > 0)
+            running++;
+    }
+    return running;
+}
+
+/* Returns true if a new background job may start without exceeding maxjobs. */
+static bool
+background_slot_available(void)
+{
+    long maxjobs = shell_option_get(OPT_MAXJOBS);
+    return maxjobs == 0 || count_running_background_jobs() < maxjobs;
+}
+
+/* Starts queued jobs in the order they were submitted while the maxjobs
+   limit permits. Called when a background job finishes or the limit changes. */
+static void
+start_queued_jobs(void)
+{
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+    {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job->status != QUEUED)
+            continue;
+
+        if (!background_slot_available())
+            break;
+
+        job->status = BACKGROUND;
+        start_job(job);
+    }
+}
+
+/* Returns true if any job is waiting in the queue. */
+static bool
+have_queued_jobs(void)
+{
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+    {
+        if (list_entry(e, struct job, elem)->status == QUEUED)
+            return true;
+    }
+    return false;
+}
+
+/* Set by handle_child_status when a background job finishes, which may let
+   queued jobs start. handle_child_status also runs in the SIGCHLD handler,
+   where jobs cannot be started, so they are started by start_freed_jobs. */
+static volatile sig_atomic_t job_slot_freed;
+
+/* Starts the queued jobs that finished background jobs made room for, with
+   SIGCHLD blocked. Returns true if jobs are still queued. */
+static bool
+start_freed_jobs(void)
+{
+    bool sigchld_was_blocked = signal_block(SIGCHLD);
+    if (job_slot_freed)
+    {
+        job_slot_freed = 0;
+        start_queued_jobs();
+    }
+    bool queued = have_queued_jobs();
+    if (!sigchld_was_blocked)
+        signal_unblock(SIGCHLD);
+    return queued;
+}
+
+/* Waits until every queued job has been started. A non-interactive shell
+   calls this at end of input so that queued work is not dropped. */
+static void
+drain_job_queue(void)
+{
+    signal_block(SIGCHLD);
+    while (have_queued_jobs())
+    {
+        int status;
+        pid_t child = waitpid(-1, &status, WUNTRACED);
+        if (child == -1)
+            utils_fatal_error("waitpid failed while draining job queue: ");
+        handle_child_status(child, status);
+        start_freed_jobs();
+    }
+    signal_unblock(SIGCHLD);
+}
+
+/* Blocks until one of the signals in set, which must be blocked, is pending
+   and accepts it, or until timeout milliseconds have passed (no limit if -1),
+   in which case it returns 0. While background jobs' output is merged, their
+   lines are printed meanwhile; the signals are then read from a signalfd. */
+static int
+wait_for_signal(const sigset_t *set, int timeout)
+{
+    int fd = linemerge_active() ? signalfd(-1, set, SFD_CLOEXEC) : -1;
+    if (fd != -1)
+    {
+        struct signalfd_siginfo info;
+        int ready;
+        while ((ready = linemerge_wait(fd, timeout, NULL, STDOUT_FILENO, NULL, NULL)) == -1 && errno == EINTR)
+            ;
+        ssize_t n = ready == 1 ? read(fd, &info, sizeof info) : 0;
+        close(fd);
+        if (n == sizeof info)
+            return info.ssi_signo;
+        if (ready == 0)
+            return 0;
+    }
+
+    struct timespec limit = {timeout / 1000, timeout % 1000 * 1000000L};
+    int sig;
+    do
+    {
+        sig = timeout < 0 ? sigwaitinfo(set, NULL) : sigtimedwait(set, NULL, &limit);
+    } while (sig == -1 && errno == EINTR);
+    return sig == -1 && errno == EAGAIN ? 0 : sig;
+}
+
+/* Blocks until a child process changes state or Ctrl-C is typed, and reaps
+   every child that changed state. Builtins that wait for several jobs use
+   this instead of wait_for_job. SIGCHLD and SIGINT must be blocked.
+   Returns SIGCHLD or SIGINT. */
+static int
+wait_for_child_event(void)
+{
+    assert(signal_is_blocked(SIGCHLD) && signal_is_blocked(SIGINT));
+
+    sigset_t waitset;
+    sigemptyset(&waitset);
+    sigaddset(&waitset, SIGCHLD);
+    sigaddset(&waitset, SIGINT);
+
+    int sig = wait_for_signal(&waitset, -1);
+    if (sig == SIGCHLD)
+    {
+        pid_t child;
+        int status;
+        while ((child = waitpid(-1, &status, WUNTRACED | WNOHANG)) > 0)
+            handle_child_status(child, status);
+        start_freed_jobs();
+    }
+    return sig;
+}
+
+/* Discards a Ctrl-C that arrived while SIGINT was blocked, so that
+   unblocking it does not terminate the shell. */
+static void
+discard_pending_sigint(void)
+{
+    sigset_t intset;
+    sigemptyset(&intset);
+    sigaddset(&intset, SIGINT);
+    struct timespec no_wait = {0, 0};
+    while (sigtimedwait(&intset, NULL, &no_wait) == SIGINT)
+        ;
+}
+
 /* Wait for all processes in this job to complete, or for
  * the job no longer to be in the foreground.
  * You should call this function from a) where you wait for
@@ -428,6 +959,32 @@ wait_for_job(struct job *job)
     {
         int status;
 
+        // Background jobs that finished meanwhile may let queued ones start.
+        start_freed_jobs();
+
+        // Background output is printed while the job runs, and a profiled
+        // job is sampled at a fixed interval. Exited children are inspected
+        // before they are reaped, so that their final counters can be read.
+        if (linemerge_active() || job->profile != NULL)
+        {
+            sigset_t chldset;
+            sigemptyset(&chldset);
+            sigaddset(&chldset, SIGCHLD);
+            wait_for_signal(&chldset, job->profile != NULL ? PROFILE_INTERVAL_MS : -1);
+            if (job->profile != NULL)
+                profile_sample(job->profile);
+
+            siginfo_t info;
+            while ((info.si_pid = 0, waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WNOHANG | WNOWAIT)) == 0 && info.si_pid != 0)
+            {
+                if (job->profile != NULL && info.si_code != CLD_STOPPED && info.si_code != CLD_TRAPPED)
+                    profile_exited(job->profile, info.si_pid);
+                if (waitpid(info.si_pid, &status, WUNTRACED | WNOHANG) > 0)
+                    handle_child_status(info.si_pid, status);
+            }
+            continue;
+        }
+
         pid_t child = waitpid(-1, &status, WUNTRACED);
 
         // When called here, any error returned by waitpid indicates a logic
@@ -444,7 +1001,25 @@ wait_for_job(struct job *job)
         else
             utils_fatal_error("waitpid failed, see code for explanation");
     }
-    delete_dead_jobs();
+
+    // A profiled job is reported once it leaves the foreground.
+    if (job->profile != NULL)
+    {
+        fflush(stdout);
+        profile_report(job->profile, stderr);
+        profile_free(job->profile);
+        job->profile = NULL;
+    }
+
+    if (job->status == FOREGROUND)
+        last_exit_status = job->exit_status;
+    else if (job->status == STOPPED)
+        last_exit_status = 128 + SIGTSTP;
+
+    // Other finished jobs keep their exit status for the wait builtin until
+    // their Done notice is printed at the prompt.
+    if (job->num_processes_alive <= 0 && job->status != QUEUED && job->status != DONE)
+        delete_job(job);
 }
 
 /* Provides proper bookkeeping upon receiving a child signal. */
@@ -468,13 +1043,24 @@ handle_child_status(pid_t pid, int status)
     if (WIFEXITED(status))
     {
         job->num_processes_alive--;
+        if (pid == job->last_pid)
+        {
+            job->exit_status = WEXITSTATUS(status);
+        }
+        if (job->num_processes_alive == 0 && job->pipe->bg_job)
+        {
+            job_slot_freed = 1;
+        }
 
         // Only sample the terminal if the process exited correctly
-        if (WEXITSTATUS(status) == 0 && job->status == FOREGROUND)
+        if (interactive)
         {
-            termstate_sample();
+            if (WEXITSTATUS(status) == 0 && job->status == FOREGROUND)
+            {
+                termstate_sample();
+            }
+            termstate_give_terminal_back_to_shell();
         }
-        termstate_give_terminal_back_to_shell();
     }
     else if (WIFSTOPPED(status))
     {
@@ -484,19 +1070,26 @@ handle_child_status(pid_t pid, int status)
         /* If user stopped foreground process with Ctrl + Z */
         case SIGTSTP:
             job->status = STOPPED;
-            termstate_save(&job->saved_tty_state);
-            job->termstate_saved = true;
-            if (job->pgid == pid)
+            interrupt_pending = true;
+            if (interactive)
             {
-                print_job(job);
+                termstate_save(&job->saved_tty_state);
+                job->termstate_saved = true;
+                if (job->pgid == pid)
+                {
+                    print_job(job);
+                }
+                termstate_give_terminal_back_to_shell();
             }
-            termstate_give_terminal_back_to_shell();
             break;
 
         /* If user stopped background process with stop command */
         case SIGSTOP:
             job->status = STOPPED;
-            termstate_give_terminal_back_to_shell();
+            if (interactive)
+            {
+                termstate_give_terminal_back_to_shell();
+            }
             break;
 
         /* If non-foreground process wants terminal access */
@@ -512,7 +1105,18 @@ handle_child_status(pid_t pid, int status)
     {
         /* If the process was killed at all, decrement live processes and return terminal control to shell. */
         job->num_processes_alive--;
-        termstate_give_terminal_back_to_shell();
+        if (pid == job->last_pid)
+        {
+            job->exit_status = 128 + WTERMSIG(status);
+        }
+        if (job->num_processes_alive == 0 && job->pipe->bg_job)
+        {
+            job_slot_freed = 1;
+        }
+        if (interactive)
+        {
+            termstate_give_terminal_back_to_shell();
+        }
         char *buf;
         switch (WTERMSIG(status))
         {
@@ -520,6 +1124,10 @@ handle_child_status(pid_t pid, int status)
         /* User terminates process with CTRL+C */
         case SIGINT:
             printf("\n");
+            if (job->status == FOREGROUND)
+            {
+                interrupt_pending = true;
+            }
             break;
 
         /* User terminates process with kill command OR user terminates process with kill -9 */
@@ -545,27 +1153,41 @@ handle_child_status(pid_t pid, int status)
 }
 
 /* Jobs built-in shell function. Outputs the current information about logged, live jobs to the current "standard" output.
-   Deletes dead jobs as it iterates to prevent redundant, inaccurate information due to finished background processes. */
+   Deletes dead jobs as it iterates to prevent redundant, inaccurate information due to finished background processes;
+   a finished background job is listed as Done once.
+   With -l, the counts of jobs whose pipes are counted follow each job. */
 static void
-jobs_builtin(void)
+jobs_builtin(bool long_format)
 {
     struct list_elem *e = list_begin(&job_list);
     while (e != list_end(&job_list))
     {
         struct job *j = list_entry(e, struct job, elem);
-        if (j->pgid != 0)
+        e = list_next(e);
+        if (j->pgid != 0 && j->num_processes_alive <= 0 && j->status == BACKGROUND)
+        {
+            print_job(j);
+            j->notified = true;
+            delete_job(j);
+        }
+        else if (j->pgid != 0 || j->status == QUEUED)
         { // Does not print the "jobs" job
             print_job(j);
+            for (int i = 0; long_format && j->pipecount != NULL && i < (int)list_size(&j->pipe->commands) - 1; i++)
+            {
+                printf("\tpipe %d: ", i + 1);
+                pipecount_print(j->pipecount, i, stdout);
+            }
         }
-        e = list_next(e);
     }
 }
 
-/* Exit built-in shell function. Exits cush and returns you to the bash shell.*/
+/* Exit built-in shell function. Exits cush and returns you to the bash shell.
+   Exits with the given status, or with that of the last command. */
 static void
-exit_builtin(void)
+exit_builtin(char *arg)
 {
-    exit(0);
+    exit(arg != NULL ? atoi(arg) : last_exit_status);
 }
 
 /* Stop built-in shell function. Stops the job specified by arg. */
@@ -580,7 +1202,19 @@ stop_builtin(int jid, struct job *job)
         return;
     }
 
-    err = killpg(to_stop->pgid, SIGSTOP);
+    if (to_stop->status == QUEUED)
+    {
+        printf("stop %d: job has not started\n", jid);
+        return;
+    }
+
+    if (to_stop->status == DONE)
+    {
+        printf("stop %d: job has finished\n", jid);
+        return;
+    }
+
+    err = signal_job(to_stop, SIGSTOP);
     if (err == -1)
     {
         printf("%s", strerror(errno));
@@ -592,13 +1226,33 @@ stop_builtin(int jid, struct job *job)
 static void
 fg_builtin(char *arg)
 {
+    if (!interactive)
+    {
+        fprintf(stderr, "fg: no job control\n");
+        return;
+    }
+
     struct job *job = get_job_from_jid(atoi(arg));
+    if (job->status == DONE)
+    {
+        printf("fg %d: job has finished\n", job->jid);
+        return;
+    }
+    bool queued = job->status == QUEUED;
     job->status = FOREGROUND;
 
     /* Output fg command line message. */
     print_cmdline(job->pipe);
     printf("\n");
 
+    /* A queued job starts directly in the foreground, bypassing maxjobs. */
+    if (queued)
+    {
+        start_job(job);
+        wait_for_job(job);
+        return;
+    }
+
     if (job->termstate_saved == false)
     { // Ensures it calls NULL for unsaved termstates
         termstate_give_terminal_to(NULL, job->pgid);
@@ -620,8 +1274,28 @@ fg_builtin(char *arg)
 static void
 bg_builtin(char *arg)
 {
-    struct job *job = get_job_from_jid(atoi(arg));
-    job->status = BACKGROUND;
+    if (!interactive)
+    {
+        fprintf(stderr, "bg: no job control\n");
+        return;
+    }
+
+    struct job *job = get_job_from_jid(atoi(arg));
+    if (job->status == DONE)
+    {
+        printf("bg %d: job has finished\n", job->jid);
+        return;
+    }
+
+    /* bg explicitly starts a queued job, bypassing maxjobs. */
+    if (job->status == QUEUED)
+    {
+        job->status = BACKGROUND;
+        start_job(job);
+        return;
+    }
+
+    job->status = BACKGROUND;
     printf("[%d] %d\n", job->jid, job->pgid);
     termstate_give_terminal_back_to_shell();
     err = killpg(job->pgid, SIGCONT);
@@ -643,88 +1317,2093 @@ kill_builtin(int jid, struct job *job)
         return;
     }
 
-    err = killpg(to_kill->pgid, SIGTERM);
+    /* A queued job has no processes yet; just drop it from the queue.
+       A finished job is dropped with its captured output. */
+    if (to_kill->status == QUEUED || to_kill->status == DONE)
+    {
+        delete_job(to_kill);
+        return;
+    }
+
+    err = signal_job(to_kill, SIGTERM);
     if (err == -1)
     {
         printf("%s", strerror(errno));
     }
 }
 
-/* History built-in shell function. Displays past command history and allows
-   for querying of commands. */
-static void history_builtin(char *arg)
+/* The lines of the history list, offered as suggestions by the autosuggest
+   option. */
+static struct suggest *suggestions;
+
+/* The trigram index of the history log, opened with the log at startup, or
+   by the first search of a shell that does not load the log. */
+static struct histindex *history_index;
+static pid_t history_index_owner;
+
+/* Saves what the shell added to the history index. Registered with atexit,
+   which forked children of the shell also run. */
+static void
+close_history_index(void)
+{
+    if (getpid() == history_index_owner)
+        histindex_close(history_index);
+}
+
+/* Opens the index of the history log at path and indexes the lines that it
+   does not cover yet. An interactive shell leaves a large backlog to a
+   background process, so that the prompt is not held up. */
+static void
+open_history_index(const char *path)
+{
+    history_index = histindex_open(path);
+    if (history_index == NULL)
+        return;
+
+    history_index_owner = getpid();
+    atexit(close_history_index);
+
+    // The builder process is reaped by histindex_build, not by the handler.
+    bool sigchld_was_blocked = signal_block(SIGCHLD);
+    histindex_build(history_index, interactive);
+    if (!sigchld_was_blocked)
+        signal_unblock(SIGCHLD);
+}
+
+/* Prints a line found by a history search. */
+static void
+print_history_match(const char *line, size_t len, void *ctx)
+{
+    fwrite(line, 1, len, stdout);
+    putchar('\n');
+}
+
+/* Prints every line of the history log named by $HISTFILE that contains
+   pattern, using its trigram index. Without a log, the history list is
+   searched instead. */
+static void
+search_history(const char *pattern)
 {
+    const char *path = variable_get("HISTFILE");
+    if (history_index == NULL && path != NULL && path[0] != '\0')
+        open_history_index(path);
+
+    if (history_index != NULL)
+    {
+        histindex_search(history_index, pattern, print_history_match, NULL);
+        return;
+    }
+
     HIST_ENTRY **list = history_list();
-    for (int i = (history_base - 1); i < (history_base + history_length - 1); i++)
+    for (int i = 0; list != NULL && list[i] != NULL; i++)
     {
-        printf("%5d  %s\n", (i + 1), list[i]->line);
+        if (strstr(list[i]->line, pattern) != NULL)
+            printf("%s\n", list[i]->line);
     }
 }
 
-/* Checks for a command-line history expansion. If an expansion is successful, the command
-   given in argv is replaced with the expansion. Returns 0 if the expansion was successful
-   and the command can be executed. Returns 1 if there was an issue with expansion or
-   the command does not need to be executed. Handles output of the expansion function. */
-static int check_expansion(char **cmd)
+/* Parses a non-negative number that ends at end, or at the end of the
+   string if end is NULL. Returns false if it is not one. */
+static bool
+parse_history_number(const char *text, const char *end, long *number)
 {
-    switch (history_expand(*cmd, cmd))
+    char *stop;
+    errno = 0;
+    *number = strtol(text, &stop, 10);
+    return stop != text && errno == 0 && *number >= 0 && (end != NULL ? stop == end : *stop == '\0');
+}
+
+/* Parses a range of entry numbers A..B, in which either bound may be left
+   out, into the indices [*first, *last) of the history list. Numbers
+   outside the list are clamped to it. */
+static bool
+parse_history_range(const char *range, int *first, int *last)
+{
+    const char *dots = strstr(range, "..");
+    long from = history_base, to = history_base + history_length - 1;
+    if (dots == NULL || (dots > range && !parse_history_number(range, dots, &from))
+        || (dots[2] != '\0' && !parse_history_number(dots + 2, NULL, &to)))
+        return false;
+
+    from -= history_base;
+    to -= history_base - 1;
+    *first = from < 0 ? 0 : from > history_length ? history_length : from;
+    *last = to < *first ? *first : to > history_length ? history_length : to;
+    return true;
+}
+
+/* Writes the entries of the history list with indices in [first, last),
+   numbered, to stdout. They are formatted into one buffer and written at
+   once, instead of a write per line on a terminal or a pipe. */
+static void
+print_history(int first, int last)
+{
+    HIST_ENTRY **list = history_list();
+    // Each entry takes at most 10 digits, two spaces, and a newline besides
+    // its line; sprintf adds a final NUL.
+    size_t size = 1;
+    for (int i = first; i < last; i++)
+        size += strlen(list[i]->line) + 13;
+
+    char *buf = malloc(size), *out = buf;
+    for (int i = first; i < last; i++)
+        out += sprintf(out, "%5d  %s\n", history_base + i, list[i]->line);
+
+    fflush(stdout);
+    if (utils_write_all(STDOUT_FILENO, buf, out - buf) == -1)
     {
-    case -1:
-        fprintf(stderr, "%s\n", *cmd);
-        return 1;
-    case 2:
-        printf("%s\n", *cmd);
-        return 1;
-    default:
-        return 0;
+        utils_error("history: ");
+        last_exit_status = 1;
+    }
+    free(buf);
+}
+
+/* History built-in shell function. Displays past command history, all of
+   it, its last N entries, or the entries numbered A through B with -r A..B.
+   -c clears the history list, and -s searches the whole history for lines
+   that contain a pattern. */
+static void history_builtin(char **argv)
+{
+    if (argv[1] != NULL && strcmp(argv[1], "-s") == 0 && argv[2] != NULL && argv[3] == NULL)
+    {
+        search_history(argv[2]);
+        return;
+    }
+    if (argv[1] != NULL && strcmp(argv[1], "-c") == 0 && argv[2] == NULL)
+    {
+        clear_history();
+        if (suggestions != NULL)
+        {
+            suggest_free(suggestions);
+            suggestions = suggest_create();
+        }
+        return;
+    }
+
+    int first = 0, last = history_length;
+    long count;
+    bool valid = true;
+    if (argv[1] != NULL && strcmp(argv[1], "-r") == 0)
+        valid = argv[2] != NULL && argv[3] == NULL && parse_history_range(argv[2], &first, &last);
+    else if (argv[1] != NULL && (valid = argv[2] == NULL && parse_history_number(argv[1], NULL, &count)))
+        first = count < last ? last - count : 0;
+
+    if (!valid)
+    {
+        fprintf(stderr, "usage: history [N | -r A..B | -c | -s pattern]\n");
+        last_exit_status = 1;
+        return;
+    }
+    print_history(first, last);
+}
+
+/* Returns a copy of word in which every occurrence of {} is replaced by line. */
+static char *
+substitute_placeholder(const char *word, const char *line)
+{
+    size_t count = 0;
+    for (const char *p = strstr(word, "{}"); p != NULL; p = strstr(p + 2, "{}"))
+        count++;
+
+    size_t linelen = strlen(line);
+    char *result = malloc(strlen(word) + count * linelen + 1);
+    char *out = result;
+    for (const char *p = word; *p != '\0';)
+    {
+        if (p[0] == '{' && p[1] == '}')
+        {
+            memcpy(out, line, linelen);
+            out += linelen;
+            p += 2;
+        }
+        else
+            *out++ = *p++;
+    }
+    *out = '\0';
+    return result;
+}
+
+/* Starts one parallel task for an input line as a background job whose
+   output is collected in a memfd so it can be printed in one piece. The
+   template was expanded with the parallel command, and the line is data,
+   so the task's words are not expanded again. */
+static struct job *
+parallel_start_task(char **template, const char *line)
+{
+    int argc = 0;
+    bool has_placeholder = false;
+    while (template[argc] != NULL)
+    {
+        has_placeholder |= strstr(template[argc], "{}") != NULL;
+        argc++;
+    }
+
+    char **argv = calloc(argc + 2, sizeof(char *));
+    for (int i = 0; i < argc; i++)
+        argv[i] = substitute_placeholder(template[i], line);
+    if (!has_placeholder)
+        argv[argc] = strdup(line);
+
+    struct ast_pipeline *pipe = ast_pipeline_create(strdup("/dev/null"), NULL, false);
+    ast_pipeline_add_command(pipe, ast_command_create(argv, false));
+    pipe->literal = true;
+
+    struct job *job = add_job(pipe);
+    job->status = BACKGROUND;
+    job->output_fd = memfd_create("cush-parallel", MFD_CLOEXEC);
+    if (job->output_fd == -1)
+    {
+        utils_error("memfd_create: "); /* Output will not be grouped. */
+    }
+    start_job(job);
+    return job;
+}
+
+/* Writes a finished task's collected output to stdout and deletes its job. */
+static void
+parallel_finish_task(struct job *job)
+{
+    if (job->output_fd != -1)
+    {
+        fflush(stdout);
+        off_t size = lseek(job->output_fd, 0, SEEK_END);
+        if (utils_copy_range(job->output_fd, 0, size, 1) == -1)
+        {
+            utils_error("parallel: ");
+        }
+    }
+    delete_job(job);
+}
+
+/* Upper bound for parallel -j. Each task is a job, and many more tasks than
+   this would only contend for the CPUs. */
+#define PARALLEL_MAX_TASKS 1024
+
+/* Parallel built-in shell function. Reads argument lines from stdin, the
+   input redirection, or the file given with -a, and runs the command
+   template once per line with at most N (-j, default: number of CPUs, at
+   most PARALLEL_MAX_TASKS) tasks in flight. Each occurrence of {} in the
+   template is replaced by the line; without {}, the line is appended as
+   the last argument. Tasks are regular jobs, and each task's output is
+   printed in one piece when it finishes. Ctrl-C is forwarded to the
+   running tasks and stops reading input. */
+static void
+parallel_builtin(char **argv, struct job *job)
+{
+    long max_tasks = sysconf(_SC_NPROCESSORS_ONLN);
+    char *input = job->iored_input;
+    enum ast_input_kind input_kind = job->pipe->input_kind;
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && argv[i + 1] != NULL)
+        {
+            char *end;
+            errno = 0;
+            max_tasks = strtol(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || errno == ERANGE)
+                max_tasks = 0;
+        }
+        else if (strcmp(argv[i], "-a") == 0 && argv[i + 1] != NULL)
+        {
+            input = argv[++i];
+            input_kind = AST_INPUT_FILE;
+        }
+        else
+            break;
+    }
+
+    if (argv[i] == NULL || argv[i][0] == '-' || max_tasks < 1)
+    {
+        fprintf(stderr, "usage: parallel [-j N] [-a file] command [args...]\n");
+        return;
+    }
+    if (is_builtin(argv[i]))
+    {
+        fprintf(stderr, "parallel: %s: cannot run a builtin\n", argv[i]);
+        return;
+    }
+    if (max_tasks > PARALLEL_MAX_TASKS)
+        max_tasks = PARALLEL_MAX_TASKS;
+
+    struct job **tasks = calloc(max_tasks, sizeof *tasks);
+    if (tasks == NULL)
+    {
+        utils_error("parallel: ");
+        return;
+    }
+
+    int fd = 0;
+    if (input != NULL && input_kind != AST_INPUT_FILE)
+    {
+        if ((fd = open_heredoc(input)) == -1)
+        {
+            free(tasks);
+            return;
+        }
+    }
+    else if (input != NULL && (fd = open(input, O_RDONLY | O_CLOEXEC)) == -1)
+    {
+        utils_error("parallel: %s: ", input);
+        free(tasks);
+        return;
+    }
+    struct line_reader reader;
+    line_reader_init_fd(&reader, fd);
+
+    /* Tasks do not own the terminal, so Ctrl-C reaches the shell instead.
+       Wait for it synchronously alongside SIGCHLD and forward it. */
+    bool sigint_was_blocked = signal_block(SIGINT);
+
+    long running = 0;
+    int failed = 0;
+    bool more_input = true;
+
+    for (;;)
+    {
+        // Retire finished tasks (including ones that failed to spawn) and refill their slots.
+        for (long t = 0; t < max_tasks; t++)
+        {
+            if (tasks[t] != NULL && tasks[t]->num_processes_alive == 0)
+            {
+                failed += tasks[t]->exit_status != 0;
+                parallel_finish_task(tasks[t]);
+                tasks[t] = NULL;
+                running--;
+            }
+
+            while (tasks[t] == NULL && more_input)
+            {
+                char *line = line_reader_next(&reader);
+                if (line == NULL)
+                    more_input = false;
+                else if (*line != '\0')
+                {
+                    tasks[t] = parallel_start_task(&argv[i], line);
+                    running++;
+                }
+            }
+        }
+
+        if (running == 0)
+            break;
+
+        bool reaped = false;
+        for (long t = 0; t < max_tasks && !reaped; t++)
+            reaped = tasks[t] != NULL && tasks[t]->num_processes_alive == 0;
+        if (reaped)
+            continue;
+
+        if (wait_for_child_event() == SIGINT)
+        {
+            more_input = false;
+            interrupt_pending = true;
+            for (long t = 0; t < max_tasks; t++)
+            {
+                if (tasks[t] != NULL)
+                    signal_job(tasks[t], SIGINT);
+            }
+        }
+    }
+
+    discard_pending_sigint();
+    if (!sigint_was_blocked)
+        signal_unblock(SIGINT);
+
+    // Like GNU parallel, the exit status is the number of failed tasks.
+    last_exit_status = failed < 101 ? failed : 101;
+
+    free(tasks);
+    line_reader_destroy(&reader);
+    if (fd != 0)
+        close(fd);
+}
+
+/* Set built-in shell function. Lists shell options, or sets them with
+   "set -o name[=value]" and clears them with "set +o name". Fails with
+   status 1 if an option name or value is invalid. */
+static void
+set_builtin(char **argv)
+{
+    if (argv[1] == NULL || (strcmp(argv[1], "-o") == 0 && argv[2] == NULL))
+    {
+        shell_options_print();
+        return;
+    }
+
+    for (int i = 1; argv[i] != NULL; i += 2)
+    {
+        bool enable = strcmp(argv[i], "-o") == 0;
+        if ((!enable && strcmp(argv[i], "+o") != 0) || argv[i + 1] == NULL)
+        {
+            fprintf(stderr, "usage: set [-o name[=value]] [+o name]\n");
+            last_exit_status = 2;
+            return;
+        }
+
+        char *name = strdup(argv[i + 1]);
+        char *value = strchr(name, '=');
+        if (value != NULL)
+            *value++ = '\0';
+        if (!enable)
+            value = "0";
+        if (shell_option_set(name, value != NULL ? value : "1") != 0)
+            last_exit_status = 1;
+        free(name);
+    }
+
+    // A raised limit may let queued jobs start.
+    start_queued_jobs();
+}
+
+/* Sets the shell variables of name=value words in argv. */
+static void
+assign_variables(char **argv, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        size_t len = variable_assignment_length(argv[i]);
+        char name[len + 1];
+        memcpy(name, argv[i], len);
+        name[len] = '\0';
+        variable_set(name, argv[i] + len + 1);
+    }
+}
+
+/* Export built-in shell function. "export name[=value]..." marks variables
+   for the environment of spawned commands, optionally setting them first.
+   Without arguments, lists the exported variables. */
+static void
+export_builtin(char **argv)
+{
+    if (argv[1] == NULL)
+    {
+        variables_print_exported();
+        return;
+    }
+
+    for (int i = 1; argv[i] != NULL; i++)
+    {
+        size_t len = variable_assignment_length(argv[i]);
+        if (len > 0)
+        {
+            assign_variables(&argv[i], 1);
+            argv[i][len] = '\0';
+        }
+        else if (!variable_name_valid(argv[i]))
+        {
+            fprintf(stderr, "export: %s: not a valid name\n", argv[i]);
+            last_exit_status = 1;
+            continue;
+        }
+        variable_export(argv[i]);
+        if (len > 0)
+            argv[i][len] = '=';
+    }
+}
+
+/* Unset built-in shell function. Removes the named variables. */
+static void
+unset_builtin(char **argv)
+{
+    for (int i = 1; argv[i] != NULL; i++)
+    {
+        variable_unset(argv[i]);
+    }
+}
+
+/* Output built-in shell function. "output %n" prints the output captured
+   for background job n with the capture option, "output %n --tail N" only
+   its last N lines. A finished job is removed once its output was shown. */
+static void
+output_builtin(char **argv)
+{
+    long tail = 0;
+    if (argv[1] == NULL || (argv[2] != NULL && (strcmp(argv[2], "--tail") != 0 || argv[3] == NULL || (tail = atol(argv[3])) <= 0)))
+    {
+        fprintf(stderr, "usage: output %%n [--tail N]\n");
+        last_exit_status = 2;
+        return;
+    }
+
+    char *arg = argv[1][0] == '%' ? argv[1] + 1 : argv[1];
+    struct job *job = get_job_from_jid(atoi(arg));
+    if (job == NULL || job->capture == NULL)
+    {
+        fprintf(stderr, "output: %s: No captured output\n", argv[1]);
+        last_exit_status = 1;
+        return;
+    }
+
+    fflush(stdout);
+    if (ringbuf_write(job->capture, STDOUT_FILENO, tail) == -1)
+    {
+        utils_error("output: ");
+        last_exit_status = 1;
+    }
+    if (job->status == DONE)
+    {
+        delete_job(job);
+    }
+}
+
+/* Returns true while a job still has to finish: it is queued, or it has
+   live processes and is not stopped. */
+static bool
+job_is_pending(struct job *job)
+{
+    return job->status == QUEUED ||
+           (job->num_processes_alive > 0 && job->status != STOPPED && job->status != NEEDSTERMINAL);
+}
+
+/* Returns a finished background job, or NULL if there is none. If
+   'pending' is non-NULL, it is set to whether any background job can
+   still finish. */
+static struct job *
+find_finished_background_job(bool *pending)
+{
+    if (pending != NULL)
+        *pending = false;
+
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+    {
+        struct job *job = list_entry(e, struct job, elem);
+        if (!job->pipe->bg_job || job->status == DONE)
+            continue;
+        if (job->num_processes_alive == 0 && job->status != QUEUED)
+            return job;
+        if (pending != NULL && job_is_pending(job))
+            *pending = true;
+    }
+    return NULL;
+}
+
+/* Wait built-in shell function. "wait" waits for all background jobs,
+   "wait %n..." for the given jobs, and "wait -n" for the next background
+   job to finish. The exit status is that of the last job waited for, or
+   127 if a job does not exist. Children are reaped with blocking waits;
+   Ctrl-C interrupts the wait with status 130. */
+static void
+wait_builtin(char **argv, struct job *job)
+{
+    bool sigint_was_blocked = signal_block(SIGINT);
+    bool interrupted = false;
+    int status = 0;
+
+    if (argv[1] == NULL)
+    {
+        // Wait until no background job can finish anymore.
+        bool pending = true;
+        while (!interrupted && pending)
+        {
+            for (struct job *done; (done = find_finished_background_job(&pending)) != NULL;)
+                delete_job(done);
+            if (pending)
+                interrupted = wait_for_child_event() == SIGINT;
+        }
+    }
+    else if (strcmp(argv[1], "-n") == 0)
+    {
+        status = 127;
+        for (;;)
+        {
+            bool pending;
+            struct job *done = find_finished_background_job(&pending);
+            if (done != NULL)
+            {
+                status = done->exit_status;
+                delete_job(done);
+                break;
+            }
+            if (!pending || (interrupted = wait_for_child_event() == SIGINT))
+                break;
+        }
+    }
+    else
+    {
+        for (int i = 1; argv[i] != NULL && !interrupted; i++)
+        {
+            char *arg = argv[i][0] == '%' ? argv[i] + 1 : argv[i];
+            struct job *target = get_job_from_jid(atoi(arg));
+            if (target == NULL || target == job)
+            {
+                fprintf(stderr, "wait: %s: No such job\n", argv[i]);
+                status = 127;
+                continue;
+            }
+
+            while (job_is_pending(target) && !interrupted)
+                interrupted = wait_for_child_event() == SIGINT;
+
+            if (!interrupted)
+            {
+                status = target->exit_status;
+                if (target->num_processes_alive == 0 && target->status != QUEUED && target->status != DONE)
+                    delete_job(target);
+            }
+        }
+    }
+
+    discard_pending_sigint();
+    if (!sigint_was_blocked)
+        signal_unblock(SIGINT);
+
+    interrupt_pending |= interrupted;
+    last_exit_status = interrupted ? 128 + SIGINT : status;
+}
+
+/* The persistent history log named by $HISTFILE, or NULL. */
+static struct histlog *history_log;
+
+/* Number of the log's newest lines loaded into the history list at startup. */
+#define HISTORY_LOAD 1000
+
+/* Keeps the history list within the histsize option. Once it is full,
+   readline drops its oldest entry for each one added, so its memory stays
+   bounded however long the shell runs; entries keep their numbers. */
+static void
+bound_history(void)
+{
+    long max = shell_option_get(OPT_HISTSIZE);
+    if (max > 0 && (!history_is_stifled() || history_max_entries != max))
+    {
+        // Readline sets history_base to the number of entries it trims
+        // rather than adding it.
+        int base = history_base, length = history_length;
+        stifle_history(max < INT_MAX ? max : INT_MAX);
+        history_base = base + (length - history_length);
+    }
+    else if (max == 0 && history_is_stifled())
+        unstifle_history();
+}
+
+/* Opens the history log named by $HISTFILE, if set, and adds its newest lines
+   to the history list. Only the lines that are loaded are read from the log.
+   Its index is opened as well, and kept up to date by record_history. */
+static void
+load_history(void)
+{
+    const char *path = variable_get("HISTFILE");
+    if (path == NULL || path[0] == '\0' || (history_log = histlog_open(path)) == NULL)
+        return;
+
+    open_history_index(path);
+
+    bound_history();
+    for (size_t k = histlog_tail(history_log, HISTORY_LOAD); k-- > 0;)
+    {
+        size_t len;
+        const char *line = histlog_line(history_log, k, &len);
+        if (len == 0)
+            continue;
+        char *copy = strndup(line, len);
+        add_history(copy);
+        suggest_add(suggestions, copy, len);
+        free(copy);
+    }
+}
+
+/* Adds a command line to the history list, bounded by the histsize option,
+   and appends it to the history log. Empty lines are not logged. */
+static void
+record_history(const char *line)
+{
+    bound_history();
+    add_history(line);
+    if (suggestions != NULL)
+        suggest_add(suggestions, line, strlen(line));
+    if (history_log != NULL && line[0] != '\0')
+        histlog_append(history_log, line);
+    if (history_index != NULL)
+        histindex_update(history_index);
+}
+
+/* A !string or !?string? event of a command line, and the newest line of the
+   history log that it matches. */
+struct logged_event
+{
+    char *text;
+    bool substring;
+    const char *line; /* In the mapped log, not NUL-terminated. */
+    size_t len;
+    char *found;      /* A copy of line, taken after the search. */
+};
+
+/* Keeps the line of the history log if it matches the event. Lines are
+   found oldest first, so the last one kept is the newest. */
+static void
+match_logged_event(const char *line, size_t len, void *ctx)
+{
+    struct logged_event *event = ctx;
+    size_t text_len = strlen(event->text);
+    if (event->substring || (len >= text_len && memcmp(line, event->text, text_len) == 0))
+    {
+        event->line = line;
+        event->len = len;
+    }
+}
+
+/* Returns true if an entry of the history list matches the event. */
+static bool
+history_list_matches(struct logged_event *event)
+{
+    HIST_ENTRY **list = history_list();
+    for (int i = 0; list != NULL && list[i] != NULL; i++)
+    {
+        const char *line = list[i]->line;
+        if (event->substring ? strstr(line, event->text) != NULL : strncmp(line, event->text, strlen(event->text)) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Lets the !string and !?string? events of cmdline find lines of the history
+   log older than the history list. For each event that matches no entry of
+   the list, the newest line of the log that it matches, found through the
+   log's index, is added to the list for history_expand. A line with an
+   event that counts back from the newest entry, such as !! or !-2, is left
+   alone, as the added entries would shift it. Returns the number of entries
+   added, which remove_logged_events takes away again. */
+static int
+add_logged_events(const char *cmdline)
+{
+    if (history_index == NULL)
+        return 0;
+
+    int count = 0, added = 0;
+    struct logged_event events[strlen(cmdline) / 2 + 1];
+    for (const char *p = strchr(cmdline, '!'); p != NULL; p = strchr(p + 1, '!'))
+    {
+        const char *s = p + 1;
+        if ((p > cmdline && p[-1] == '\\') || *s == '\0' || strchr(" \t\n\r=#", *s) != NULL || isdigit((unsigned char)*s))
+            continue;
+        if (strchr("!-$^*:%", *s) != NULL)
+            goto done;
+
+        bool substring = *s == '?';
+        s += substring;
+        size_t len = substring ? strcspn(s, "?\n") : strcspn(s, " \t\n:^$*%-\"");
+        events[count++] = (struct logged_event){strndup(s, len), substring, NULL, 0, NULL};
+        p = s + len - 1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (events[i].text[0] != '\0' && !history_list_matches(&events[i]))
+            histindex_search(history_index, events[i].text, match_logged_event, &events[i]);
+        if (events[i].line != NULL)
+            events[i].found = strndup(events[i].line, events[i].len);
+    }
+
+    // Added entries must not push the oldest ones out of the list.
+    unstifle_history();
+    for (int i = 0; i < count; i++)
+    {
+        if (events[i].found != NULL)
+        {
+            add_history(events[i].found);
+            added++;
+        }
+    }
+
+done:
+    for (int i = 0; i < count; i++)
+    {
+        free(events[i].text);
+        free(events[i].found);
+    }
+    return added;
+}
+
+/* Removes the entries added by add_logged_events. */
+static void
+remove_logged_events(int added)
+{
+    while (added-- > 0)
+        free_history_entry(remove_history(history_length - 1));
+    bound_history();
+}
+
+/* Checks for a command-line history expansion. If an expansion is successful, the command
+   given in argv is replaced with the expansion. Returns 0 if the expansion was successful
+   and the command can be executed. Returns 1 if there was an issue with expansion or
+   the command does not need to be executed. Handles output of the expansion function. */
+static int check_expansion(char **cmd)
+{
+    int added = add_logged_events(*cmd);
+    int result = history_expand(*cmd, cmd);
+    remove_logged_events(added);
+
+    switch (result)
+    {
+    case -1:
+        fprintf(stderr, "%s\n", *cmd);
+        return 1;
+    case 2:
+        printf("%s\n", *cmd);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Calls the builtin function specified by the cmd parameter. If the command matches a supported builtin,
+ * it calls the builtin function and returns 0 to indicate a successful builtin call. If the command
+ * does not match a supported builtin function, it returns 1 to indicate a non-matching command that needs
+ * to be spawned.
+ */
+static int
+call_builtin(char **argv, struct job *job)
+{
+    char *cmd = argv[0];
+    if (!is_builtin(cmd))
+    {
+        return 1;
+    }
+
+    last_exit_status = 0;
+    if (strcmp(cmd, "kill") == 0)
+    {
+        kill_builtin(atoi(argv[1]), job);
+        return 0;
+    }
+    else if (strcmp(cmd, "fg") == 0)
+    {
+        fg_builtin(argv[1]);
+        return 0;
+    }
+    else if (strcmp(cmd, "bg") == 0)
+    {
+        bg_builtin(argv[1]);
+        return 0;
+    }
+    else if (strcmp(cmd, "jobs") == 0)
+    {
+        jobs_builtin(argv[1] != NULL && strcmp(argv[1], "-l") == 0);
+        return 0;
+    }
+    else if (strcmp(cmd, "stop") == 0)
+    {
+        stop_builtin(atoi(argv[1]), job);
+        return 0;
+    }
+    else if (strcmp(cmd, "exit") == 0)
+    {
+        exit_builtin(argv[1]);
+    }
+    else if (strcmp(cmd, "history") == 0)
+    {
+        history_builtin(argv);
+        return 0;
+    }
+    else if (strcmp(cmd, "parallel") == 0)
+    {
+        parallel_builtin(argv, job);
+        return 0;
+    }
+    else if (strcmp(cmd, "set") == 0)
+    {
+        set_builtin(argv);
+        return 0;
+    }
+    else if (strcmp(cmd, "wait") == 0)
+    {
+        wait_builtin(argv, job);
+        return 0;
+    }
+    else if (strcmp(cmd, "export") == 0)
+    {
+        export_builtin(argv);
+        return 0;
+    }
+    else if (strcmp(cmd, "unset") == 0)
+    {
+        unset_builtin(argv);
+        return 0;
+    }
+    else if (strcmp(cmd, "output") == 0)
+    {
+        output_builtin(argv);
+        return 0;
+    }
+    return 1;
+}
+
+/* Names of all builtins dispatched by call_builtin. */
+static const char *builtin_names[] = {
+    "kill", "fg", "bg", "jobs", "stop", "exit", "history", "parallel", "set", "wait",
+    "export", "unset", "output", NULL
+};
+
+/* Returns true if cmd names a builtin. */
+static bool
+is_builtin(char *cmd)
+{
+    for (const char **name = builtin_names; *name != NULL; name++)
+    {
+        if (strcmp(cmd, *name) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Opens path with the given flags and moves it onto descriptor fd.
+   Returns -1 and prints an error if the file cannot be opened. */
+static int
+redirect_fd(const char *path, int flags, int fd)
+{
+    int newfd = open(path, flags, 0666);
+    if (newfd == -1)
+    {
+        utils_error("%s: ", path);
+        return -1;
+    }
+    if (newfd != fd)
+    {
+        err = dup2(newfd, fd);
+        close(newfd);
+        if (err == -1)
+        {
+            utils_error("dup2: ");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Returns a memfd holding the text of a here-document or here-string,
+   sealed against changes and positioned at its start. Commands read it
+   like a file, so a large text neither waits on a pipe's capacity nor
+   touches the filesystem. Returns -1 and prints an error on failure. */
+static int
+open_heredoc(const char *text)
+{
+    int fd = memfd_create("cush-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1)
+    {
+        utils_error("memfd_create: ");
+        return -1;
+    }
+
+    size_t len = strlen(text);
+    for (size_t done = 0; done < len;)
+    {
+        ssize_t n = write(fd, text + done, len - done);
+        if (n == -1)
+        {
+            utils_error("here-document: ");
+            close(fd);
+            return -1;
+        }
+        done += n;
+    }
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+/* Moves the pipeline's input, a file named input or the text of a
+   here-document, onto descriptor 0. Returns -1 on failure. */
+static int
+redirect_input(enum ast_input_kind kind, const char *input)
+{
+    if (kind == AST_INPUT_FILE)
+        return redirect_fd(input, O_RDONLY, 0);
+
+    int fd = open_heredoc(input);
+    if (fd == -1)
+        return -1;
+    dup2(fd, 0);
+    close(fd);
+    return 0;
+}
+
+/* Returns true if this just-created job can replace the shell process: it
+   must be the last thing the shell will ever run, a single foreground
+   command that is not a builtin, and no other job may still need the shell.
+   A job whose expansion failed is left to start_job, which fails it. */
+static bool
+can_tail_exec(struct ast_command_line *cline, struct job *job)
+{
+    struct ast_pipeline *pipe = job->pipe;
+    if (!tail_exec_allowed || job->expansion_failed || list_next(&pipe->elem) != list_end(&cline->pipes)
+        || list_size(&job_list) != 1)
+        return false;
+
+    if (pipe->bg_job || pipe->profile || list_size(&pipe->commands) != 1 || pipe->num_extra_outputs > 0)
+        return false;
+
+    struct ast_command *cmd = list_entry(list_begin(&pipe->commands), struct ast_command, elem);
+    char **argv = job->argv[0] + cmd->num_assignments;
+    return cmd->group == NULL && cmd->loop == NULL && argv[0] != NULL && !is_builtin(argv[0])
+        && !needs_chunking(job->argv[0], cmd->num_assignments);
+}
+
+/* Performs a command's redirections in the current process, mirroring the
+   file actions that start_job sets up for spawned commands: the job's output
+   descriptor, the pipes in_fd and out_fd (-1 if none), and the pipeline's
+   file redirections. Used in forked children of the shell and before a
+   tail exec. Returns -1 if a file cannot be opened. */
+static int
+apply_redirections(struct job *job, struct ast_command *cmd, int in_fd, int out_fd)
+{
+    struct ast_pipeline *pipe = job->pipe;
+    bool first = &cmd->elem == list_begin(&pipe->commands);
+    bool last = &cmd->elem == list_back(&pipe->commands);
+
+    if (job->output_fd != -1)
+    {
+        dup2(job->output_fd, 1);
+        dup2(job->output_fd, 2);
+    }
+
+    if (first && job->iored_input != NULL)
+    {
+        if (redirect_input(pipe->input_kind, job->iored_input) == -1)
+            return -1;
+    }
+    else if (first && !interactive && pipe->bg_job)
+    {
+        if (redirect_fd("/dev/null", O_RDONLY, 0) == -1)
+            return -1;
+    }
+
+    if (last && job->relay_fd != -1)
+    {
+        dup2(job->relay_fd, 1);
+        if (cmd->dup_stderr_to_stdout)
+            dup2(1, 2);
+    }
+    else if (last && job->iored_output != NULL)
+    {
+        int flags = O_WRONLY | O_CREAT | (pipe->append_to_output ? O_APPEND : O_TRUNC);
+        if (redirect_fd(job->iored_output, flags, 1) == -1)
+            return -1;
+
+        if (cmd->dup_stderr_to_stdout)
+            dup2(1, 2);
+    }
+
+    if (out_fd != -1)
+    {
+        dup2(out_fd, 1);
+        if (cmd->dup_stderr_to_stdout)
+            dup2(out_fd, 2);
+    }
+
+    if (in_fd != -1)
+        dup2(in_fd, 0);
+
+    // Keep the pipes of process substitutions that this command names in its
+    // argv open across exec, and close all others.
+    int index = command_index(job, cmd);
+    for (int i = 0; i < job->num_procsubs; i++)
+    {
+        struct process_substitution *p = &job->procsubs[i];
+        if (p->fd != -1 && p->command == index)
+            fcntl(p->fd, F_SETFD, 0);
+        else if (p->fd != -1)
+            close(p->fd);
+        if (p->inner_fd != -1)
+            close(p->inner_fd);
+    }
+    if (job->relay_fd != -1)
+        close(job->relay_fd);
+    return 0;
+}
+
+/* Replaces the shell with the job's only command, applying the same
+   redirections that the spawn path would set up as file actions.
+   Does not return; exits with 127 or 126 if the command cannot run. */
+static void
+tail_exec_job(struct job *job)
+{
+    struct ast_command *cmd = list_entry(list_begin(&job->pipe->commands), struct ast_command, elem);
+    char **argv = job->argv[0] + cmd->num_assignments;
+    char **envp = cmd->num_assignments > 0 ? variables_environ_with(job->argv[0], cmd->num_assignments) : variables_environ();
+
+    start_process_substitutions(job);
+    if (apply_redirections(job, cmd, -1, -1) == -1)
+        exit(EXIT_FAILURE);
+
+    /* The signal mask survives exec; output buffered by builtins would not. */
+    fflush(NULL);
+    signal_unblock(SIGCHLD);
+
+    execvpe(argv[0], argv, envp);
+    utils_error("%s: ", argv[0]);
+    exit(errno == ENOENT ? 127 : 126);
+}
+
+/* Sets the capacity of the pipe fd to size bytes, or to the pipesize option
+   if size is 0. A larger pipe lets the commands of a high-throughput
+   pipeline run longer before one of them blocks on a full or empty pipe.
+   Sizes are capped at /proc/sys/fs/pipe-max-size; if the kernel refuses
+   a size, the pipe keeps its current capacity. */
+static void
+resize_pipe(int fd, long size)
+{
+    static long max_size;
+
+    if (size == 0)
+        size = shell_option_get(OPT_PIPESIZE);
+    if (size == 0)
+        return;
+
+    if (max_size == 0)
+    {
+        FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
+        if (f == NULL || fscanf(f, "%ld", &max_size) != 1)
+            max_size = 1 << 20;
+        if (f != NULL)
+            fclose(f);
+    }
+    fcntl(fd, F_SETPIPE_SZ, size < max_size ? size : max_size);
+}
+
+/* Closes the job's ends of the pipes of its process substitutions once its
+   commands have been started. */
+static void
+close_process_substitutions(struct job *job)
+{
+    for (int i = 0; i < job->num_procsubs; i++)
+    {
+        close(job->procsubs[i].fd);
+        job->procsubs[i].fd = -1;
+    }
+}
+
+/* Closes the shell's copy of the write end of a job's merged output pipe
+   once its commands have been started. */
+static void
+close_merged_output(struct job *job)
+{
+    if (job->merged != NULL && job->output_fd != -1)
+    {
+        close(job->output_fd);
+        job->output_fd = -1;
+    }
+}
+
+/* Returns the name of a pipeline stage in profile reports. */
+static const char *
+stage_name(struct ast_command *cmd, char **argv)
+{
+    if (cmd->loop != NULL)
+        return cmd->loop->kind == AST_LOOP_FOR ? "for ..." : "while ...";
+    if (cmd->group != NULL)
+        return cmd->subshell ? "( ... )" : "{ ... }";
+    return argv[0] != NULL ? argv[0] : "";
+}
+
+/* Spawns the processes of a job's pipeline, connecting consecutive commands
+   with pipes and applying the pipeline's redirections. Builtins that appear
+   in the pipeline are run by the shell itself. Expects SIGCHLD to be blocked. */
+static void
+start_job(struct job *job)
+{
+    struct ast_pipeline *pipe = job->pipe;
+
+    if (job->expansion_failed)
+    {
+        job->last_pid = 0;
+        job->exit_status = 1;
+        return;
+    }
+
+    // With the mergeoutput option, the shell prints the output of a
+    // background job by lines, read from a pipe. With the capture option,
+    // it keeps the last output in a ring buffer for the output builtin.
+    bool merge = shell_option_get(OPT_MERGEOUTPUT) != 0;
+    long capture = shell_option_get(OPT_CAPTURE);
+    if (interactive && pipe->bg_job && job->output_fd == -1 && (merge || capture > 0))
+    {
+        if (capture > 0)
+            job->capture = ringbuf_create(capture);
+        if (merge || job->capture != NULL)
+            job->merged = linemerge_open(job->jid, job->capture, merge, &job->output_fd);
+    }
+
+    // Process substitutions start first, so that their pipes are connected
+    // when the commands that name them run.
+    start_process_substitutions(job);
+
+    // Output to several targets passes through a relay, started before the
+    // commands so that the job's last process is still its last command.
+    if (pipe->num_extra_outputs > 0 && (job->relay_fd = start_output_relay(job)) == -1)
+    {
+        close_process_substitutions(job);
+        close_merged_output(job);
+        job->last_pid = 0;
+        job->exit_status = 1;
+        return;
+    }
+
+    // Create matrix of 2*(n-1) pipe fds.
+    // Matrix is of size 2*n to make logic simpler.
+    int num_pipes = list_size(&pipe->commands) - 1;
+    int pipefds[num_pipes + 1][2];
+
+    // The stages and pipes of a profiled pipeline are sampled while it runs.
+    if (pipe->profile && !pipe->bg_job)
+    {
+        job->profile = profile_start(num_pipes + 1);
+    }
+
+    struct list_elem *writer = list_begin(&pipe->commands);
+    for (int i = 0; i < num_pipes; i++, writer = list_next(writer))
+    {
+        int currfds[2];
+        err = pipe2(currfds, O_CLOEXEC);
+        if (err == -1)
+        {
+            printf("%s", strerror(errno));
+        }
+        else
+        {
+            resize_pipe(currfds[1], list_entry(writer, struct ast_command, elem)->pipe_size);
+        }
+
+        pipefds[i][0] = currfds[0];
+        pipefds[i][1] = currfds[1];
+    }
+
+    // With the pipecount option, a relay of the job counts what passes
+    // through each pipe. The relays start before the commands, like the
+    // output relay.
+    long pipecount = shell_option_get(OPT_PIPECOUNT);
+    if (pipecount > 0 && num_pipes > 0 && (job->pipecount = pipecount_create(num_pipes, pipecount > 1)) != NULL)
+    {
+        writer = list_begin(&pipe->commands);
+        for (int i = 0; i < num_pipes; i++, writer = list_next(writer))
+        {
+            start_pipe_counter(job, i, list_entry(writer, struct ast_command, elem)->pipe_size, pipefds, num_pipes);
+        }
+    }
+
+    int cmd_index = 0;
+
+    // Iterates through the list of commands within a pipeline.
+    for (struct list_elem *cList = list_begin(&pipe->commands); cList != list_end(&pipe->commands); cList = list_next(cList))
+    {
+
+        // Spawns a child process for each command within the pipeline.
+        struct ast_command *cmd = list_entry(cList, struct ast_command, elem);
+        pid_t previous_pid = job->last_pid;
+
+        // Leading name=value words apply to this command only.
+        char **assignments = job->argv[cmd_index];
+        int num_assignments = cmd->num_assignments;
+        char **argv = assignments + num_assignments;
+
+        // Groups and loops in a pipeline or in the background, and all subshells, run in a forked shell.
+        if (cmd->group != NULL || cmd->loop != NULL)
+        {
+            int in_fd = cList != list_begin(&pipe->commands) ? pipefds[cmd_index - 1][0] : -1;
+            int out_fd = cList != list_back(&pipe->commands) ? pipefds[cmd_index][1] : -1;
+            fork_group(job, cmd, in_fd, out_fd, pipefds, num_pipes);
+        }
+        // A command of only assignments sets shell variables. One whose words all
+        // expanded to nothing does nothing.
+        else if (argv[0] == NULL)
+        {
+            assign_variables(assignments, num_assignments);
+            job->last_pid = 0;
+            job->exit_status = 0;
+        }
+        // If the command does not match a supported builtin, follow process spawning procedures.
+        else if (call_builtin(argv, job) == 0)
+        {
+            job->last_pid = 0;
+            job->exit_status = last_exit_status;
+        }
+        // An argv too long for one exec is split into several invocations by a forked child.
+        else if (needs_chunking(assignments, num_assignments))
+        {
+            int in_fd = cList != list_begin(&pipe->commands) ? pipefds[cmd_index - 1][0] : -1;
+            int out_fd = cList != list_back(&pipe->commands) ? pipefds[cmd_index][1] : -1;
+            fork_group(job, cmd, in_fd, out_fd, pipefds, num_pipes);
+        }
+        else
+        {
+            posix_spawn_file_actions_t child_file_attr;
+            posix_spawnattr_t child_spawn_attr;
+            err = posix_spawnattr_init(&child_spawn_attr);
+            if (err != 0)
+            {
+                printf("%s", strerror(errno));
+            }
+            err = posix_spawn_file_actions_init(&child_file_attr);
+            if (err != 0)
+            {
+                printf("%s", strerror(errno));
+            }
+
+            // Send output to the job's output descriptor. Pipes and redirections below take precedence.
+            if (job->output_fd != -1)
+            {
+                err = posix_spawn_file_actions_adddup2(&child_file_attr, job->output_fd, 1);
+                if (err != 0)
+                {
+                    printf("%s", strerror(errno));
+                }
+                err = posix_spawn_file_actions_adddup2(&child_file_attr, job->output_fd, 2);
+                if (err != 0)
+                {
+                    printf("%s", strerror(errno));
+                }
+            }
+
+            // Spawn the process as part of a process group. If the PGID of the job is 0, create a new group.
+            // Without job control, children stay in the shell's process group.
+            if (interactive)
+            {
+                err = posix_spawnattr_setflags(&child_spawn_attr, POSIX_SPAWN_SETPGROUP);
+                if (err != 0)
+                {
+                    printf("%s", strerror(errno));
+                }
+                err = posix_spawnattr_setpgroup(&child_spawn_attr, job->pgid);
+                if (err != 0)
+                {
+                    printf("%s", strerror(errno));
+                }
+            }
+
+            // Redirect input.
+            int heredoc_fd = -1;
+            if (job->iored_input != NULL && cList == list_begin(&pipe->commands) && pipe->input_kind == AST_INPUT_FILE)
+            {
+                err = posix_spawn_file_actions_addopen(&child_file_attr, 0, job->iored_input, O_RDONLY, 0666);
+                if (err != 0)
+                {
+                    printf("%s", strerror(errno));
+                }
+            }
+            // A here-document is passed in a memfd; if it cannot be created, the command reads nothing.
+            else if (job->iored_input != NULL && cList == list_begin(&pipe->commands))
+            {
+                heredoc_fd = open_heredoc(job->iored_input);
+                if (heredoc_fd != -1)
+                    err = posix_spawn_file_actions_adddup2(&child_file_attr, heredoc_fd, 0);
+                else
+                    err = posix_spawn_file_actions_addopen(&child_file_attr, 0, "/dev/null", O_RDONLY, 0666);
+                if (err != 0)
+                {
+                    printf("%s", strerror(errno));
+                }
+            }
+            // Without job control, background jobs must not compete for the shell's input.
+            else if (!interactive && pipe->bg_job && cList == list_begin(&pipe->commands))
+            {
+                err = posix_spawn_file_actions_addopen(&child_file_attr, 0, "/dev/null", O_RDONLY, 0666);
+                if (err != 0)
+                {
+                    printf("%s", strerror(errno));
+                }
+            }
+
+            // Redirect output to the relay of a multi-target redirection.
+            if (job->relay_fd != -1 && cList == list_end(&pipe->commands)->prev)
+            {
+                err = posix_spawn_file_actions_adddup2(&child_file_attr, job->relay_fd, 1);
+                if (err != 0)
+                {
+                    printf("%s", strerror(errno));
+                }
+                if (cmd->dup_stderr_to_stdout)
+                {
+                    err = posix_spawn_file_actions_adddup2(&child_file_attr, 1, 2);
+                    if (err != 0)
+                    {
+                        printf("%s", strerror(errno));
+                    }
+                }
+            }
+            // Redirect output.
+            else if (job->iored_output != NULL && cList == list_end(&pipe->commands)->prev)
+            {
+                // Append output.
+                if (pipe->append_to_output)
+                {
+                    err = posix_spawn_file_actions_addopen(&child_file_attr, 1, job->iored_output, O_WRONLY | O_CREAT | O_APPEND, 0666);
+                    if (err != 0)
+                    {
+                        printf("%s", strerror(errno));
+                    }
+                }
+                // Overwrite output.
+                else
+                {
+                    err = posix_spawn_file_actions_addopen(&child_file_attr, 1, job->iored_output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                    if (err != 0)
+                    {
+                        printf("%s", strerror(errno));
+                    }
+                }
+
+                // >& implementation.
+                if (cmd->dup_stderr_to_stdout)
+                {
+                    err = posix_spawn_file_actions_adddup2(&child_file_attr, 1, 2);
+                    if (err != 0)
+                    {
+                        printf("%s", strerror(errno));
+                    }
+                }
+            }
+
+            // Linking pipe output.
+            if (num_pipes > 0 && cList != list_end(&pipe->commands)->prev)
+            {
+                err = posix_spawn_file_actions_adddup2(&child_file_attr, pipefds[cmd_index][1], 1);
+                if (err != 0)
+                {
+                    printf("%s", strerror(errno));
+                }
+
+                if (cmd->dup_stderr_to_stdout)
+                {
+                    err = posix_spawn_file_actions_adddup2(&child_file_attr, pipefds[cmd_index][1], 2);
+                    if (err != 0)
+                    {
+                        printf("%s", strerror(errno));
+                    }
+                }
+            }
+
+            // Linking pipe input.
+            if (num_pipes > 0 && cList != list_begin(&pipe->commands))
+            {
+                err = posix_spawn_file_actions_adddup2(&child_file_attr, pipefds[cmd_index - 1][0], 0);
+                if (err != 0)
+                {
+                    printf("%s", strerror(errno));
+                }
+            }
+
+            // The /dev/fd paths of process substitutions in argv must stay open across exec.
+            for (int i = 0; i < job->num_procsubs; i++)
+            {
+                if (job->procsubs[i].command == cmd_index)
+                {
+                    err = posix_spawn_file_actions_adddup2(&child_file_attr, job->procsubs[i].fd, job->procsubs[i].fd);
+                    if (err != 0)
+                    {
+                        printf("%s", strerror(errno));
+                    }
+                }
+            }
+
+            /* Spawn process and add the process to the job PID list if the spawn is successful. Otherwise, output command not found error. */
+            /* The cached environment is shared by all spawns; assignments get their own array. */
+            pid_t cpid;
+            char **envp = num_assignments > 0 ? variables_environ_with(assignments, num_assignments) : variables_environ();
+            int spawn_error = posix_spawnp(&cpid, argv[0], &child_file_attr, &child_spawn_attr, argv, envp);
+            if (heredoc_fd != -1)
+            {
+                close(heredoc_fd);
+            }
+            if (num_assignments > 0)
+            {
+                free(envp);
+            }
+            if (spawn_error == 0)
+            {
+                add_process_to_job(job, cpid);
+            }
+            else
+            {
+                errno = spawn_error;
+                job->last_pid = 0;
+                job->exit_status = errno == ENOENT ? 127 : 126;
+                utils_error("%s: ", argv[0]); /* Outputs suitable error message when a process doesn't spawn */
+            }
+
+            err = posix_spawnattr_destroy(&child_spawn_attr);
+            if (err != 0)
+            {
+                printf("%s", strerror(errno));
+            }
+            err = posix_spawn_file_actions_destroy(&child_file_attr);
+            if (err != 0)
+            {
+                printf("%s", strerror(errno));
+            }
+        }
+
+        if (job->profile != NULL)
+        {
+            pid_t pid = job->last_pid != previous_pid ? job->last_pid : 0;
+            profile_set_stage(job->profile, cmd_index, pid, stage_name(cmd, argv));
+        }
+
+        cmd_index++;
+    }
+    close_process_substitutions(job);
+    close_merged_output(job);
+    if (job->relay_fd != -1)
+    {
+        close(job->relay_fd);
+        job->relay_fd = -1;
+    }
+
+    // Close pipes. A profile keeps its own read ends to measure their fill.
+    for (int i = 0; i < num_pipes; i++)
+    {
+        if (job->profile != NULL)
+        {
+            profile_set_pipe(job->profile, i, pipefds[i][0]);
+        }
+        err = close(pipefds[i][0]);
+        if (err == -1)
+        {
+            printf("%s", strerror(errno));
+        }
+        err = close(pipefds[i][1]);
+        if (err == -1)
+        {
+            printf("%s", strerror(errno));
+        }
+    }
+}
+
+/* Returns the position of cmd in the job's pipeline, or the number of
+   commands if cmd is not part of it. */
+static int
+command_index(struct job *job, struct ast_command *cmd)
+{
+    int index = 0;
+    for (struct list_elem *e = list_begin(&job->pipe->commands); e != list_end(&job->pipe->commands) && e != &cmd->elem; e = list_next(e))
+    {
+        index++;
+    }
+    return index;
+}
+
+/* Returns true if the argchunk option is set and a simple command's
+   expanded words are too long to be passed to a single exec. */
+static bool
+needs_chunking(char **assignments, int num_assignments)
+{
+    if (shell_option_get(OPT_ARGCHUNK) == 0)
+        return false;
+
+    char **envp = num_assignments > 0 ? variables_environ_with(assignments, num_assignments) : variables_environ();
+    bool needed = argchunk_needed(assignments + num_assignments, envp);
+    if (num_assignments > 0)
+    {
+        free(envp);
+    }
+    return needed;
+}
+
+/* Runs a simple command of job as several invocations and returns their
+   combined exit status. The literal words before and after the first and
+   last word that needed expansion, such as 'rm -f' or the target of 'cp',
+   are passed to every invocation. */
+static int
+run_chunked(struct job *job, struct ast_command *cmd)
+{
+    char **assignments = job->argv[command_index(job, cmd)];
+    char **argv = assignments + cmd->num_assignments;
+    char **words = cmd->argv + cmd->num_assignments;
+
+    size_t argc = 0, num_words = 0, prefix = 0, suffix = 0;
+    while (argv[argc] != NULL)
+        argc++;
+    while (words[num_words] != NULL)
+        num_words++;
+
+    while (prefix < num_words && expand_is_literal(words[prefix]))
+        prefix++;
+    while (prefix < num_words && suffix < num_words - prefix && expand_is_literal(words[num_words - 1 - suffix]))
+        suffix++;
+
+    // The command name is always repeated; without expanded words, nothing else is.
+    if (prefix == 0 || prefix == num_words || prefix + suffix > argc)
+    {
+        prefix = 1;
+        suffix = 0;
+    }
+
+    char **envp = cmd->num_assignments > 0 ? variables_environ_with(assignments, cmd->num_assignments) : variables_environ();
+    return argchunk_run(argv, envp, prefix, suffix, shell_option_get(OPT_ARGCHUNK));
+}
+
+/* Forks a child shell that runs a group or loop as one process of job,
+   reading from in_fd and writing to out_fd (-1 if not part of a pipe).
+   The child is not interactive; its own jobs stay in the job's process
+   group, and it execs its final simple command directly. A simple
+   command is forked only if its argv must be split, which the child
+   does, waiting for all invocations before it exits. */
+static void
+fork_group(struct job *job, struct ast_command *cmd, int in_fd, int out_fd, int (*pipefds)[2], int num_pipes)
+{
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        utils_error("fork: ");
+        job->exit_status = 1;
+        return;
+    }
+
+    if (pid == 0)
+    {
+        if (interactive)
+            setpgid(0, job->pgid);
+
+        if (apply_redirections(job, cmd, in_fd, out_fd) == -1)
+            exit(EXIT_FAILURE);
+        for (int i = 0; i < num_pipes; i++)
+        {
+            close(pipefds[i][0]);
+            close(pipefds[i][1]);
+        }
+        linemerge_reset();
+
+        if (cmd->group == NULL && cmd->loop == NULL)
+        {
+            exit(run_chunked(job, cmd));
+        }
+
+        // Start over with an empty job list, as a non-interactive shell.
+        interactive = false;
+        list_init(&job_list);
+        memset(jid2job, 0, sizeof jid2job);
+        tail_exec_allowed = true;
+        signal_unblock(SIGCHLD);
+
+        execute_compound(cmd);
+        exit(last_exit_status);
+    }
+
+    // Set the process group here as well so that it exists before start_job continues.
+    if (interactive)
+        setpgid(pid, job->pgid != 0 ? job->pgid : pid);
+    add_process_to_job(job, pid);
+}
+
+/* Returns true once a command substitution's job is no longer running
+   in the foreground, i.e. it was stopped. */
+static bool
+substitution_stopped(void *ctx)
+{
+    struct job *job = ctx;
+    return job->status != FOREGROUND;
+}
+
+/* Runs the command line of a $(...) substitution as a foreground job,
+   like a subshell whose standard output is a pipe, and collects what it
+   writes. SIGCHLD is handled while waiting for output. The job is reaped
+   here rather than through wait_for_job, because the job being expanded
+   is already on the job list and must not be deleted. Ctrl-C or Ctrl-Z
+   fail the substitution; a stopped substitution is killed. */
+static int
+run_substitution(char *command, struct capture *output)
+{
+    struct capture empty = {NULL, 0, 0};
+    *output = empty;
+
+    struct ast_command_line *cline = ast_parse_command_line(command);
+    if (cline == NULL)
+    {
+        return -1;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+        utils_error("pipe: ");
+        ast_command_line_free(cline);
+        return -1;
+    }
+    resize_pipe(fds[0], 0);
+
+    bool sigchld_was_blocked = signal_block(SIGCHLD);
+    struct ast_pipeline *pipe = ast_pipeline_create(NULL, NULL, false);
+    struct ast_command *cmd = ast_command_create_group(cline, true, false);
+    ast_pipeline_add_command(pipe, cmd);
+    struct job *job = add_job(pipe);
+    fork_group(job, cmd, -1, fds[1], NULL, 0);
+    close(fds[1]);
+
+    sigset_t wait_mask;
+    sigprocmask(SIG_BLOCK, NULL, &wait_mask);
+    sigdelset(&wait_mask, SIGCHLD);
+    int rc = capture_fd(fds[0], output, &wait_mask, substitution_stopped, job);
+    close(fds[0]);
+
+    if (job->status == STOPPED)
+    {
+        signal_job(job, SIGKILL);
+        job->status = FOREGROUND;
+    }
+    while (job->num_processes_alive > 0)
+    {
+        int status;
+        pid_t child = waitpid(-1, &status, WUNTRACED);
+        if (child == -1)
+            utils_fatal_error("waitpid failed in command substitution: ");
+        handle_child_status(child, status);
+    }
+    delete_job(job);
+    if (!sigchld_was_blocked)
+    {
+        signal_unblock(SIGCHLD);
+    }
+    return interrupt_pending ? -1 : rc;
+}
+
+/* Sets up a <(...) or >(...) of the command being expanded and returns the
+   /dev/fd path that names its pipe. The substituted command is parsed now
+   and started with the job, in the job's process group, so that it appears
+   in the job's pid list and Ctrl-C and kill reach it. */
+static char *
+add_process_substitution(char *command, bool output)
+{
+    struct job *job = expanding_job;
+    if (job == NULL)
+    {
+        fprintf(stderr, "process substitution is only supported in commands\n");
+        return NULL;
+    }
+
+    struct ast_command_line *cline = ast_parse_command_line(command);
+    if (cline == NULL)
+    {
+        return NULL;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+        utils_error("pipe: ");
+        ast_command_line_free(cline);
+        return NULL;
+    }
+    resize_pipe(fds[0], 0);
+
+    job->procsubs = realloc(job->procsubs, (job->num_procsubs + 1) * sizeof *job->procsubs);
+    struct process_substitution *p = &job->procsubs[job->num_procsubs++];
+    p->group = ast_command_create_group(cline, true, false);
+    p->output = output;
+    p->fd = output ? fds[1] : fds[0];
+    p->inner_fd = output ? fds[0] : fds[1];
+    p->command = expanding_command;
+
+    char *path;
+    if (asprintf(&path, "/dev/fd/%d", p->fd) == -1)
+    {
+        utils_fatal_error("out of memory: ");
+    }
+    return path;
+}
+
+/* Starts the substituted commands of a job's process substitutions, each as
+   a subshell connected to its pipe. */
+static void
+start_process_substitutions(struct job *job)
+{
+    for (int i = 0; i < job->num_procsubs; i++)
+    {
+        struct process_substitution *p = &job->procsubs[i];
+        fork_group(job, p->group, p->output ? p->inner_fd : -1, p->output ? -1 : p->inner_fd, NULL, 0);
+        close(p->inner_fd);
+        p->inner_fd = -1;
+    }
+}
+
+/* Opens all output targets of a 'cmd >a >b' job and forks a relay, part of
+   the job, that copies what it reads from a pipe to each of them with
+   fanout_relay. The targets are opened by the shell, in order, so that an
+   error is reported before any command runs. Returns the write end of the
+   relay's pipe, or -1 after printing an error. */
+static int
+start_output_relay(struct job *job)
+{
+    struct ast_pipeline *pipe = job->pipe;
+    int n = pipe->num_extra_outputs + 1;
+    int fds[n], relay[2];
+
+    for (int i = 0; i < n; i++)
+    {
+        const char *path = i == 0 ? job->iored_output : job->extra_outputs[i - 1];
+        bool append = i == 0 ? pipe->append_to_output : pipe->extra_outputs[i - 1].append;
+        fds[i] = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0666);
+        if (fds[i] == -1)
+        {
+            utils_error("%s: ", path);
+            while (i-- > 0)
+                close(fds[i]);
+            return -1;
+        }
+    }
+
+    if (pipe2(relay, O_CLOEXEC) == -1)
+    {
+        utils_error("pipe: ");
+        relay[1] = -1;
+    }
+    else
+    {
+        resize_pipe(relay[1], 0);
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            if (interactive)
+                setpgid(0, job->pgid);
+            close(relay[1]);
+            for (int i = 0; i < job->num_procsubs; i++)
+                close(job->procsubs[i].fd);
+            exit(fanout_relay(relay[0], fds, n) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        if (pid == -1)
+        {
+            utils_error("fork: ");
+            close(relay[1]);
+            relay[1] = -1;
+        }
+        else
+        {
+            if (interactive)
+                setpgid(pid, job->pgid != 0 ? job->pgid : pid);
+            add_process_to_job(job, pid);
+        }
+        close(relay[0]);
+    }
+
+    for (int i = 0; i < n; i++)
+        close(fds[i]);
+    return relay[1];
+}
+
+/* Splits pipe i of a job in two with a relay process of the job that counts
+   the bytes passing through, moving them with splice. The reader's end in
+   pipefds is replaced by the end of the relay's own pipe of the given size.
+   If the relay cannot be started, the pipe stays as it is. */
+static void
+start_pipe_counter(struct job *job, int i, long size, int (*pipefds)[2], int num_pipes)
+{
+    int relay[2];
+    if (pipe2(relay, O_CLOEXEC) == -1)
+    {
+        utils_error("pipe: ");
+        return;
+    }
+    resize_pipe(relay[1], size);
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        if (interactive)
+            setpgid(0, job->pgid);
+        // Readers see the end of a pipe only once the relays of the
+        // other pipes have closed it too.
+        for (int k = 0; k < num_pipes; k++)
+        {
+            close(pipefds[k][1]);
+            if (k != i)
+                close(pipefds[k][0]);
+        }
+        close(relay[0]);
+        if (job->relay_fd != -1)
+            close(job->relay_fd);
+        if (job->output_fd != -1)
+            close(job->output_fd);
+        for (int k = 0; k < job->num_procsubs; k++)
+            close(job->procsubs[k].fd);
+        linemerge_reset();
+        exit(pipecount_relay(job->pipecount, i, pipefds[i][0], relay[1]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (pid == -1)
+    {
+        utils_error("fork: ");
+        close(relay[0]);
+        close(relay[1]);
+        return;
+    }
+
+    if (interactive)
+        setpgid(pid, job->pgid != 0 ? job->pgid : pid);
+    add_process_to_job(job, pid);
+    close(relay[1]);
+    close(pipefds[i][0]);
+    pipefds[i][0] = relay[0];
+}
+
+/* Returns true if a pipeline is a single '{ list; }' group or loop that
+   runs in the foreground, which the shell executes without forking. */
+static bool
+runs_in_shell(struct ast_pipeline *pipe)
+{
+    if (pipe->bg_job || pipe->profile || list_size(&pipe->commands) != 1 || pipe->num_extra_outputs > 0)
+        return false;
+
+    struct ast_command *cmd = list_entry(list_begin(&pipe->commands), struct ast_command, elem);
+    return (cmd->group != NULL && !cmd->subshell) || cmd->loop != NULL;
+}
+
+/* Moves descriptor fd out of the way so that it can be restored later. */
+static int
+save_fd(int fd)
+{
+    int saved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    if (saved == -1)
+        utils_error("cannot save descriptor %d: ", fd);
+    return saved;
+}
+
+/* Restores a descriptor saved with save_fd. */
+static void
+restore_fd(int saved, int fd)
+{
+    if (saved != -1)
+    {
+        dup2(saved, fd);
+        close(saved);
     }
 }
 
-/*
- * Calls the builtin function specified by the cmd parameter. If the command matches a supported builtin,
- * it calls the builtin function and returns 0 to indicate a successful builtin call. If the command
- * does not match a supported builtin function, it returns 1 to indicate a non-matching command that needs
- * to be spawned.
- */
+/* Opens the (expanded) redirection path onto descriptor fd. */
 static int
-call_builtin(char **argv, struct job *job)
+redirect_expanded(const char *path, int flags, int fd)
 {
-    char *cmd = argv[0];
-    if (strcmp(cmd, "kill") == 0)
+    bool failed = false;
+    char *expanded = expand_word(path, &failed);
+    int rc = failed ? -1 : redirect_fd(expanded != NULL ? expanded : path, flags, fd);
+    free(expanded);
+    return rc;
+}
+
+/* Runs a '{ list; }' group or a loop in the current shell. Its redirections
+   are applied to the shell's own descriptors, so each file is opened once
+   for the whole group and every command inherits it. */
+static void
+run_in_shell(struct ast_pipeline *pipe, bool tail_exec_ok)
+{
+    struct ast_command *cmd = list_entry(list_begin(&pipe->commands), struct ast_command, elem);
+    int saved_in = -1, saved_out = -1, saved_err = -1;
+    int rc = 0;
+
+    fflush(stdout);
+    if (pipe->iored_input != NULL && pipe->input_kind == AST_INPUT_FILE)
     {
-        kill_builtin(atoi(argv[1]), job);
-        return 0;
+        saved_in = save_fd(0);
+        rc = redirect_expanded(pipe->iored_input, O_RDONLY, 0);
     }
-    else if (strcmp(cmd, "fg") == 0)
+    else if (pipe->iored_input != NULL)
     {
-        fg_builtin(argv[1]);
-        return 0;
+        bool failed = false;
+        char *expanded = pipe->input_kind != AST_INPUT_HEREDOC_LITERAL ? expand_input(pipe, &failed) : NULL;
+        saved_in = save_fd(0);
+        rc = failed ? -1 : redirect_input(pipe->input_kind, expanded != NULL ? expanded : pipe->iored_input);
+        free(expanded);
     }
-    else if (strcmp(cmd, "bg") == 0)
+    if (pipe->iored_output != NULL && rc == 0)
     {
-        bg_builtin(argv[1]);
-        return 0;
+        saved_out = save_fd(1);
+        int flags = O_WRONLY | O_CREAT | (pipe->append_to_output ? O_APPEND : O_TRUNC);
+        rc = redirect_expanded(pipe->iored_output, flags, 1);
+        if (rc == 0 && cmd->dup_stderr_to_stdout)
+        {
+            saved_err = save_fd(2);
+            dup2(1, 2);
+        }
     }
-    else if (strcmp(cmd, "jobs") == 0)
+
+    if (rc == 0)
     {
-        jobs_builtin();
-        return 0;
+        bool saved_tail_exec = tail_exec_allowed;
+        tail_exec_allowed = tail_exec_ok;
+        execute_compound(cmd);
+        tail_exec_allowed = saved_tail_exec;
     }
-    else if (strcmp(cmd, "stop") == 0)
+    else
     {
-        stop_builtin(atoi(argv[1]), job);
-        return 0;
+        last_exit_status = 1;
     }
-    else if (strcmp(cmd, "exit") == 0)
+
+    fflush(stdout);
+    restore_fd(saved_in, 0);
+    restore_fd(saved_out, 1);
+    restore_fd(saved_err, 2);
+}
+
+/* Runs a for or while loop. The body was parsed once and is executed
+   again on every iteration; only its words are expanded each time.
+   The exit status is that of the last body executed, or 0 if the body
+   never ran. Ctrl-C and Ctrl-Z stop the loop. */
+static void
+execute_loop(struct ast_loop *loop)
+{
+    bool saved_tail_exec = tail_exec_allowed;
+    int status = 0;
+
+    // Nothing inside a loop is the last command the shell runs.
+    tail_exec_allowed = false;
+
+    if (loop->kind == AST_LOOP_FOR)
     {
-        exit_builtin();
+        bool failed = false;
+        char **words = expand_argv(loop->words, &failed);
+        char **values = words != NULL ? words : loop->words;
+        for (char **w = values; *w != NULL && !interrupt_pending && !failed; w++)
+        {
+            variable_set(loop->variable, *w);
+            execute_command_line(loop->body);
+            status = last_exit_status;
+        }
+        if (words != NULL)
+        {
+            argv_free(words);
+        }
+        if (failed)
+        {
+            status = 1;
+        }
     }
-    else if (strcmp(cmd, "history") == 0)
+    else
     {
-        history_builtin(argv[1]);
-        return 0;
+        for (;;)
+        {
+            execute_command_line(loop->condition);
+            if (last_exit_status != 0 || interrupt_pending)
+            {
+                break;
+            }
+            execute_command_line(loop->body);
+            status = last_exit_status;
+            if (interrupt_pending)
+            {
+                break;
+            }
+        }
+    }
+
+    tail_exec_allowed = saved_tail_exec;
+    if (!interrupt_pending)
+    {
+        last_exit_status = status;
+    }
+}
+
+/* Runs the list of a group or a loop in the current process. */
+static void
+execute_compound(struct ast_command *cmd)
+{
+    if (cmd->loop != NULL)
+    {
+        execute_loop(cmd->loop);
+    }
+    else
+    {
+        execute_command_line(cmd->group);
     }
-    return 1;
 }
 
 /**
@@ -732,233 +3411,320 @@ call_builtin(char **argv, struct job *job)
  * their respective commands, and executes their commands. Adds each
  * pipeline to the job list, maintains records of which PIDs belong
  * to which jobs via struct operations, and handles signaling via
- * wait_for_job() and handle_child_status().
+ * wait_for_job() and handle_child_status(). The command line is left
+ * intact, so that loop bodies can be executed again; each job holds its
+ * own reference to its pipeline.
  */
 static void
 execute_command_line(struct ast_command_line *cline)
 {
     // Iterates through the list of pipelines.
-    while (!list_empty(&cline->pipes))
+    for (struct list_elem *pList = list_begin(&cline->pipes); pList != list_end(&cline->pipes) && !interrupt_pending; pList = list_next(pList))
     {
-        struct list_elem *pList = list_pop_front(&cline->pipes);
+        struct ast_pipeline *pipe = list_entry(pList, struct ast_pipeline, elem);
+
+        // Skip pipelines of a conditional list whose condition does not hold.
+        // The previous exit status carries over to the next pipeline.
+        if ((pipe->list_op == AST_LIST_AND && last_exit_status != 0) ||
+            (pipe->list_op == AST_LIST_OR && last_exit_status == 0))
+        {
+            continue;
+        }
+
+        // Foreground { list; } groups and loops run without forking.
+        if (runs_in_shell(pipe))
+        {
+            run_in_shell(pipe, tail_exec_allowed && list_next(pList) == list_end(&cline->pipes));
+            continue;
+        }
 
         // Blocks the child signal, then adds a job for each pipeline.
         signal_block(SIGCHLD);
-        struct ast_pipeline *pipe = list_entry(pList, struct ast_pipeline, elem);
-        struct job *job = add_job(pipe);
+        bool background = pipe->bg_job;
+        struct job *job = add_job(ast_pipeline_ref(pipe));
 
-        // Create matrix of 2*(n-1) pipe fds.
-        // Matrix is of size 2*n to make logic simpler.
-        int num_pipes = list_size(&pipe->commands) - 1;
-        int pipefds[num_pipes + 1][2];
+        // Run the final command of a -c string in place of the shell.
+        if (can_tail_exec(cline, job))
+        {
+            tail_exec_job(job);
+        }
 
-        for (int i = 0; i < num_pipes; i++)
+        // Background jobs over the maxjobs limit wait in the queue.
+        if (job->status == BACKGROUND && !background_slot_available())
         {
-            int currfds[2];
-            err = pipe2(currfds, O_CLOEXEC);
-            if (err == -1)
+            job->status = QUEUED;
+            if (interactive)
             {
-                printf("%s", strerror(errno));
+                printf("[%d] Queued\n", job->jid);
             }
+        }
+        else
+        {
+            start_job(job);
+        }
 
-            pipefds[i][0] = currfds[0];
-            pipefds[i][1] = currfds[1];
+        // After all processes have been spawned, wait for the job if it is foreground.
+        wait_for_job(job);
+        if (background)
+        {
+            last_exit_status = 0;
         }
+        signal_unblock(SIGCHLD);
+    }
+}
 
-        int cmd_index = 0;
+/* Whether a suggestion is drawn after the cursor. */
+static bool suggestion_shown;
 
-        // Iterates through the list of commands within a pipeline.
-        for (struct list_elem *cList = list_begin(&pipe->commands); cList != list_end(&pipe->commands); cList = list_next(cList))
-        {
+/* Erases the suggestion drawn after the cursor, if any. */
+static void
+erase_suggestion(void)
+{
+    if (suggestion_shown)
+    {
+        fputs("\033[K", rl_outstream);
+        suggestion_shown = false;
+    }
+}
 
-            // Spawns a child process for each command within the pipeline.
-            struct ast_command *cmd = list_entry(cList, struct ast_command, elem);
+/* Returns the number of columns that the last line of the prompt and the
+   line being edited take up, before readline wraps them. */
+static int
+input_columns(void)
+{
+    int columns = 0;
+    bool invisible = false;
+    for (const char *p = rl_display_prompt; p != NULL && *p != '\0'; p++)
+    {
+        if (*p == RL_PROMPT_START_IGNORE || *p == RL_PROMPT_END_IGNORE)
+            invisible = *p == RL_PROMPT_START_IGNORE;
+        else if (*p == '\n')
+            columns = 0;
+        else if (!invisible && (*p & 0xc0) != 0x80)
+            columns++;
+    }
+    for (int i = 0; i < rl_end; i++)
+    {
+        if (iscntrl((unsigned char) rl_line_buffer[i]))
+            columns += 2;
+        else if ((rl_line_buffer[i] & 0xc0) != 0x80)
+            columns++;
+    }
+    return columns;
+}
 
-            // If the command does not match a supported builtin, follow process spawning procedures.
-            if (call_builtin(cmd->argv, job) != 0)
-            {
-                posix_spawn_file_actions_t child_file_attr;
-                posix_spawnattr_t child_spawn_attr;
-                err = posix_spawnattr_init(&child_spawn_attr);
-                if (err != 0)
-                {
-                    printf("%s", strerror(errno));
-                }
-                err = posix_spawn_file_actions_init(&child_file_attr);
-                if (err != 0)
-                {
-                    printf("%s", strerror(errno));
-                }
+/* Returns whether a suggestion may follow the line being edited. */
+static bool
+can_suggest(void)
+{
+    return shell_option_get(OPT_AUTOSUGGEST) != 0 && suggestions != NULL
+           && rl_end > 0 && rl_point == rl_end;
+}
 
-                // Spawn the process as part of a process group. If the PGID of the job is 0, create a new group.
-                err = posix_spawnattr_setflags(&child_spawn_attr, POSIX_SPAWN_SETPGROUP);
-                if (err != 0)
-                {
-                    printf("%s", strerror(errno));
-                }
-                err = posix_spawnattr_setpgroup(&child_spawn_attr, job->pgid);
-                if (err != 0)
-                {
-                    printf("%s", strerror(errno));
-                }
+/* Redisplays the line being edited, followed by the rest of the best history
+   line that begins with it, dimmed. The suggestion is cut to fit in the rest
+   of the screen's row so that the cursor can be moved back over it. */
+static void
+suggest_redisplay(void)
+{
+    erase_suggestion();
+    rl_redisplay();
 
-                // Redirect input.
-                if (pipe->iored_input != NULL && cList == list_begin(&pipe->commands))
-                {
-                    err = posix_spawn_file_actions_addopen(&child_file_attr, 0, pipe->iored_input, O_RDONLY, 0666);
-                    if (err != 0)
-                    {
-                        printf("%s", strerror(errno));
-                    }
-                }
+    char rest[1024];
+    if (!can_suggest() || suggest_lookup(suggestions, rl_line_buffer, rl_end, rest, sizeof rest) == 0)
+        return;
 
-                // Redirect output.
-                if (pipe->iored_output != NULL && cList == list_end(&pipe->commands)->prev)
-                {
-                    // Append output.
-                    if (pipe->append_to_output)
-                    {
-                        err = posix_spawn_file_actions_addopen(&child_file_attr, 1, pipe->iored_output, O_WRONLY | O_CREAT | O_APPEND, 0666);
-                        if (err != 0)
-                        {
-                            printf("%s", strerror(errno));
-                        }
-                    }
-                    // Overwrite output.
-                    else
-                    {
-                        err = posix_spawn_file_actions_addopen(&child_file_attr, 1, pipe->iored_output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-                        if (err != 0)
-                        {
-                            printf("%s", strerror(errno));
-                        }
-                    }
+    int rows, cols;
+    rl_get_screen_size(&rows, &cols);
+    int room = cols - 1 - input_columns() % cols;
+    int len = 0, shown = 0;
+    while (rest[len] != '\0' && !iscntrl((unsigned char) rest[len]))
+    {
+        if ((rest[len] & 0xc0) != 0x80)
+        {
+            if (shown == room)
+                break;
+            shown++;
+        }
+        len++;
+    }
+    if (shown == 0)
+        return;
 
-                    // >& implementation.
-                    if (cmd->dup_stderr_to_stdout)
-                    {
-                        err = posix_spawn_file_actions_adddup2(&child_file_attr, 1, 2);
-                        if (err != 0)
-                        {
-                            printf("%s", strerror(errno));
-                        }
-                    }
-                }
+    fprintf(rl_outstream, "\033[2m%.*s\033[0m\033[%dD", len, rest, shown);
+    fflush(rl_outstream);
+    suggestion_shown = true;
+}
 
-                // Linking pipe output.
-                if (num_pipes > 0 && cList != list_end(&pipe->commands)->prev)
-                {
-                    err = posix_spawn_file_actions_adddup2(&child_file_attr, pipefds[cmd_index][1], 1);
-                    if (err != 0)
-                    {
-                        printf("%s", strerror(errno));
-                    }
+/* Inserts the suggestion at the end of the line being edited, or moves the
+   cursor forward if there is none. Bound to the right arrow and Ctrl-F. */
+static int
+accept_suggestion(int count, int key)
+{
+    char rest[1024];
+    size_t len;
+    if (!can_suggest() || (len = suggest_lookup(suggestions, rl_line_buffer, rl_end, rest, sizeof rest)) == 0)
+        return rl_forward_char(count, key);
 
-                    if (cmd->dup_stderr_to_stdout)
-                    {
-                        err = posix_spawn_file_actions_adddup2(&child_file_attr, pipefds[cmd_index][1], 2);
-                        if (err != 0)
-                        {
-                            printf("%s", strerror(errno));
-                        }
-                    }
-                }
+    if (len < sizeof rest)
+    {
+        rl_insert_text(rest);
+        return 0;
+    }
+    char *full = malloc(len + 1);
+    suggest_lookup(suggestions, rl_line_buffer, rl_end, full, len + 1);
+    rl_insert_text(full);
+    free(full);
+    return 0;
+}
 
-                // Linking pipe input.
-                if (num_pipes > 0 && cList != list_begin(&pipe->commands))
-                {
-                    err = posix_spawn_file_actions_adddup2(&child_file_attr, pipefds[cmd_index - 1][0], 0);
-                    if (err != 0)
-                    {
-                        printf("%s", strerror(errno));
-                    }
-                }
+/* Erases the suggestion before the line is accepted, so that it does not
+   stay on the screen. Bound to Return. */
+static int
+accept_line(int count, int key)
+{
+    erase_suggestion();
+    return rl_newline(count, key);
+}
 
-                /* Spawn process and add the process to the job PID list if the spawn is successful. Otherwise, output command not found error. */
-                pid_t cpid;
-                extern char **environ;
-                if (posix_spawnp(&cpid, cmd->argv[0], &child_file_attr, &child_spawn_attr, &cmd->argv[0], environ) == 0)
-                {
-                    /* If this spawn created a new process group, store the PGID in the job's PGID field.
-                       Give new foreground jobs terminal access. Output job message if it's a background job. */
-                    if (job->pgid == 0)
-                    {
-                        job->pgid = getpgid(cpid);
-                        if (pipe->bg_job)
-                        {
-                            printf("[%d] %d\n", job->jid, job->pgid);
-                        }
-                        else
-                        {
-                            err = tcsetpgrp(termstate_get_tty_fd(), job->pgid);
-                            if (err == -1)
-                            {
-                                printf("%s", strerror(errno));
-                            }
-                        }
-                    }
-                    add_pid_to_job(cpid, job);
-                }
-                else
-                {
-                    utils_error("%s: ", cmd->argv[0]); /* Outputs suitable error message when a process doesn't spawn */
-                }
+/* Read the next command line, either from the terminal through readline
+   or from the block-buffered reader in non-interactive mode.
+   Lines returned by readline are owned by the caller; lines returned
+   from the reader live in its buffer. */
+static char *
+read_command_line(struct line_reader *reader)
+{
+    if (!interactive)
+    {
+        return line_reader_next(reader);
+    }
 
-                err = posix_spawnattr_destroy(&child_spawn_attr);
-                if (err != 0)
-                {
-                    printf("%s", strerror(errno));
-                }
-                err = posix_spawn_file_actions_destroy(&child_file_attr);
-                if (err != 0)
-                {
-                    printf("%s", strerror(errno));
-                }
-            }
+    /* Readline turns off bracketed paste if it starts with a redisplay
+       function of its own, so the one that draws suggestions is installed
+       only while the option is set */
+    rl_redisplay_function = shell_option_get(OPT_AUTOSUGGEST) ? suggest_redisplay : rl_redisplay;
 
-            cmd_index++;
-        }
+    /* Do not output a prompt unless shell's stdin is a terminal */
+    char *prompt = isatty(0) ? build_prompt() : NULL;
+    char *cmdline = readline(prompt);
+    free(prompt);
+    return cmdline;
+}
 
-        // Close pipes.
-        for (int i = 0; i < num_pipes; i++)
-        {
-            err = close(pipefds[i][0]);
-            if (err == -1)
-            {
-                printf("%s", strerror(errno));
-            }
-            err = close(pipefds[i][1]);
-            if (err == -1)
-            {
-                printf("%s", strerror(errno));
-            }
-        }
+/* Clears the line being edited so that merged output of background jobs
+   can be printed in its place. */
+static void
+hide_input_line(void)
+{
+    suggestion_shown = false;
+    rl_clear_visible_line();
+    fflush(rl_outstream);
+}
 
-        // After all processes have been spawned, wait for the job if it is foreground.
-        wait_for_job(job);
+/* Redraws the prompt and the line being edited below merged output. */
+static void
+show_input_line(void)
+{
+    rl_forced_update_display();
+}
+
+/* Reads a key for readline. While waiting, lines of background jobs' merged
+   output are printed above the prompt, and queued jobs are started as
+   others finish. A signal for readline is handled by rl_getc. */
+static int
+merged_output_getc(FILE *stream)
+{
+    // SIGCHLD is unblocked only during the wait, so that a job finishing
+    // after the queue was checked interrupts it and its slot is used.
+    sigset_t wait_mask;
+    sigprocmask(SIG_BLOCK, NULL, &wait_mask);
+    sigdelset(&wait_mask, SIGCHLD);
+    bool sigchld_was_blocked = signal_block(SIGCHLD);
+    for (;;)
+    {
+        if (!start_freed_jobs() && !linemerge_active())
+            break;
+        int ready = linemerge_wait(fileno(stream), -1, &wait_mask, STDOUT_FILENO, hide_input_line, show_input_line);
+        if (ready == 1 || (ready == -1 && (errno != EINTR || rl_pending_signal() != 0)))
+            break;
+    }
+    if (!sigchld_was_blocked)
         signal_unblock(SIGCHLD);
+    return rl_getc(stream);
+}
+
+/* Reads a line of here-document text for the parser. At a terminal, the
+   line is read through readline with a continuation prompt. */
+static char *
+read_heredoc_line(void *ctx)
+{
+    if (!interactive)
+    {
+        char *line = line_reader_next(ctx);
+        return line != NULL ? strdup(line) : NULL;
     }
+    return readline(isatty(0) ? "> " : NULL);
 }
 
 int main(int ac, char *av[])
 {
     int opt;
+    char *command_string = NULL;
     using_history(); /* Initializes history's variables. */
 
     /* Process command-line arguments. See getopt(3) */
-    while ((opt = getopt(ac, av, "h")) > 0)
+    while ((opt = getopt(ac, av, "hc:")) > 0)
     {
         switch (opt)
         {
         case 'h':
             usage(av[0]);
             break;
+        case 'c':
+            command_string = optarg;
+            break;
+        default:
+            usage(av[0]);
         }
     }
 
+    /* Commands come from -c, a script file, or stdin, in that order. */
+    struct line_reader reader;
+    if (command_string != NULL)
+    {
+        line_reader_init_string(&reader, command_string);
+    }
+    else if (optind < ac)
+    {
+        int fd = open(av[optind], O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            utils_fatal_error("%s: ", av[optind]);
+        line_reader_init_fd(&reader, fd);
+    }
+    else
+    {
+        interactive = isatty(0);
+        if (!interactive)
+            line_reader_init_shared(&reader, 0);
+    }
+
     list_init(&job_list);
+    variables_init(environ);
+    expand_set_command_runner(run_substitution);
+    expand_set_process_runner(add_process_substitution);
     signal_set_handler(SIGCHLD, sigchld_handler);
-    termstate_init();
+    if (interactive)
+    {
+        termstate_init();
+        rl_getc_function = merged_output_getc;
+        rl_bind_key('\r', accept_line);
+        rl_bind_key('\n', accept_line);
+        rl_bind_key(CTRL('F'), accept_suggestion);
+        rl_bind_keyseq("\\e[C", accept_suggestion);
+        rl_bind_keyseq("\\eOC", accept_suggestion);
+        suggestions = suggest_create();
+        load_history();
+    }
 
     /* Read/eval loop. */
     for (;;)
@@ -978,23 +3744,46 @@ int main(int ac, char *av[])
          * Make sure that you call termstate_give_terminal_back_to_shell()
          * before returning here on all paths.
          */
-        assert(termstate_get_current_terminal_owner() == getpgrp());
+        assert(!interactive || termstate_get_current_terminal_owner() == getpgrp());
+
+        // Background jobs that finished are reported before the prompt.
+        if (interactive)
+        {
+            signal_block(SIGCHLD);
+            delete_dead_jobs();
+            signal_unblock(SIGCHLD);
+        }
+        start_freed_jobs();
+        char *cmdline = read_command_line(&reader);
+        interrupt_pending = false;
 
-        /* Do not output a prompt unless shell's stdin is a terminal */
-        char *prompt = isatty(0) ? build_prompt() : NULL;
-        char *cmdline = readline(prompt);
-        free(prompt);
+        // Directory listings read by globbing are only reused within
+        // a single command line.
+        fastglob_cache_clear();
 
         if (cmdline == NULL)
         { /* User typed EOF */
-            free(cmdline);
             break;
         }
 
+        /* Scripts are neither subject to history expansion nor recorded. */
+        if (!interactive)
+        {
+            struct ast_command_line *cline = ast_parse_command_line_from(cmdline, read_heredoc_line, &reader);
+            if (cline != NULL)
+            {
+                tail_exec_allowed = command_string != NULL && line_reader_at_eof(&reader);
+                line_reader_sync(&reader);
+                execute_command_line(cline);
+                ast_command_line_free(cline);
+            }
+            continue;
+        }
+
         // Ensures any history expansion errors will not be ran
         bool execute = (check_expansion(&cmdline) == 0) ? true : false;
 
-        struct ast_command_line *cline = ast_parse_command_line(cmdline);
+        struct ast_command_line *cline = ast_parse_command_line_from(cmdline, read_heredoc_line, &reader);
 
         if (cline == NULL)
         { /* Error in command line */
@@ -1004,7 +3793,7 @@ int main(int ac, char *av[])
 
         if (list_empty(&cline->pipes))
         { /* User hit enter */
-            add_history(cmdline);
+            record_history(cmdline);
             ast_command_line_free(cline);
             free(cmdline);
             continue;
@@ -1012,11 +3801,17 @@ int main(int ac, char *av[])
 
         if (execute)
         {
-            add_history(cmdline);
+            record_history(cmdline);
             execute_command_line(cline);
         }
         free(cmdline);
         ast_command_line_free(cline);
     }
-    return 0;
+
+    if (!interactive)
+    {
+        drain_job_queue();
+        line_reader_destroy(&reader);
+    }
+    return last_exit_status;
 }
@@ -1,3 +1,27 @@
 = Tests for Custom Features
 1 history_builtin_test.py
-2 custom_prompt_test.py
\ No newline at end of file
+2 custom_prompt_test.py
+3 parallel_builtin_test.py
+4 wait_builtin_test.py
+5 conditional_list_test.py
+6 group_command_test.py
+7 loop_test.py
+8 variables_test.py
+9 gback_glob_test.py
+10 brace_expansion_test.py
+11 command_substitution_test.py
+12 heredoc_test.py
+13 process_substitution_test.py
+14 fanout_test.py
+15 merged_output_test.py
+16 output_builtin_test.py
+17 profile_test.py
+18 pipecount_test.py
+19 history_log_test.py
+20 history_index_test.py
+21 autosuggest_test.py
+22 history_range_test.py
+23 maxjobs_test.py
+24 argchunk_test.py
+25 noninteractive_test.py
+26 tail_exec_test.py
\ No newline at end of file
@@ -0,0 +1,495 @@
+/*
+ * Word expansion.
+ *
+ * Expansion works on the words stored in the AST; only command and
+ * process substitutions call back into the shell, which parses and
+ * runs them.
+ * Words without a '$', brace, glob character,
+ * or backslash are recognized with a single strpbrk and are not copied.
+ */
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expand.h"
+#include "fastglob.h"
+#include "brace.h"
+#include "capture.h"
+#include "shell_options.h"
+#include "variables.h"
+#include "utils.h"
+
+/* Initialize an empty builder */
+void
+argv_builder_init(struct argv_builder *builder)
+{
+    builder->argc = 0;
+    builder->capacity = 8;
+    builder->argv = malloc(builder->capacity * sizeof *builder->argv);
+    if (builder->argv == NULL)
+        utils_fatal_error("out of memory: ");
+}
+
+/* Append word to the builder, which takes ownership of it.  One slot
+ * is always kept free for the terminating NULL. */
+void
+argv_builder_push(struct argv_builder *builder, char *word)
+{
+    if (builder->argc + 1 == builder->capacity) {
+        builder->capacity *= 2;
+        builder->argv = realloc(builder->argv,
+                                builder->capacity * sizeof *builder->argv);
+        if (builder->argv == NULL)
+            utils_fatal_error("out of memory: ");
+    }
+    builder->argv[builder->argc++] = word;
+}
+
+/* Return the collected words as a NULL terminated array */
+char **
+argv_builder_finish(struct argv_builder *builder)
+{
+    char **argv = builder->argv;
+    argv[builder->argc] = NULL;
+    builder->argv = NULL;
+    builder->argc = builder->capacity = 0;
+    return argv;
+}
+
+/* Free a NULL terminated array of words */
+void
+argv_free(char **argv)
+{
+    for (char **p = argv; *p; p++)
+        free(*p);
+    free(argv);
+}
+
+/* A growable string used while expanding a word */
+struct strbuf {
+    char *s;
+    size_t len, capacity;
+};
+
+static void
+strbuf_append(struct strbuf *buf, const char *s, size_t len)
+{
+    if (buf->len + len + 1 > buf->capacity) {
+        while (buf->len + len + 1 > buf->capacity)
+            buf->capacity = buf->capacity ? 2 * buf->capacity : 64;
+        buf->s = realloc(buf->s, buf->capacity);
+        if (buf->s == NULL)
+            utils_fatal_error("out of memory: ");
+    }
+    memcpy(buf->s + buf->len, s, len);
+    buf->len += len;
+    buf->s[buf->len] = '\0';
+}
+
+/* Characters that a backslash makes literal */
+#define ESCAPABLE "$*?[]{}\\"
+
+/* Characters that make a word need expansion */
+#define SPECIAL "$*?[{\\"
+
+/* Append len bytes of text to buf, with a backslash before each
+ * character that expansion would interpret, so that the text is used
+ * literally */
+static void
+append_escaped(struct strbuf *buf, const char *text, size_t len)
+{
+    const char *end = text + len;
+    for (const char *p = text; p < end; ) {
+        const char *q = p;
+        while (q < end && strchr(ESCAPABLE, *q) == NULL)
+            q++;
+        strbuf_append(buf, p, q - p);
+        if (q < end) {
+            char escaped[2] = { '\\', *q++ };
+            strbuf_append(buf, escaped, 2);
+        }
+        p = q;
+    }
+}
+
+static bool
+is_name_char(char c, bool first)
+{
+    return isalpha((unsigned char) c) || c == '_'
+        || (!first && isdigit((unsigned char) c));
+}
+
+/* Append the value of the variable reference starting after the '$'
+ * at p, and return a pointer past the reference.  A '$' that does not
+ * start a reference is kept as is.  The value of a quoted reference is
+ * escaped, so that it is neither globbed nor changed. */
+static const char *
+expand_variable(struct strbuf *buf, const char *p, bool quoted)
+{
+    bool braced = *p == '{';
+    const char *name = braced ? p + 1 : p;
+    const char *end = name;
+
+    while (is_name_char(*end, end == name))
+        end++;
+
+    if (end == name || (braced && *end != '}')) {
+        strbuf_append(buf, "$", 1);
+        return p;
+    }
+
+    char varname[end - name + 1];
+    memcpy(varname, name, end - name);
+    varname[end - name] = '\0';
+
+    const char *value = variable_get(varname);
+    if (value != NULL && quoted)
+        append_escaped(buf, value, strlen(value));
+    else if (value != NULL)
+        strbuf_append(buf, value, strlen(value));
+
+    return braced ? end + 1 : end;
+}
+
+/* Remove the backslashes before escaped characters, in place */
+static void
+remove_escapes(char *word)
+{
+    char *d = word;
+    for (char *s = word; *s; s++) {
+        if (*s == '\\' && s[1] != '\0' && strchr(ESCAPABLE, s[1]))
+            s++;
+        *d++ = *s;
+    }
+    *d = '\0';
+}
+
+/* Return true if word expands to exactly itself */
+bool
+expand_is_literal(const char *word)
+{
+    return strpbrk(word, SPECIAL) == NULL;
+}
+
+/* Glob a word whose variables and substitutions have been replaced,
+ * or remove its escapes, and append the result to words.  Takes
+ * ownership of word. */
+static void
+finish_word(struct argv_builder *words, char *word)
+{
+    if (fastglob_has_magic(word) && fastglob_expand(word, words) > 0) {
+        free(word);
+        return;
+    }
+
+    /* A pattern that matches nothing is kept as is */
+    remove_escapes(word);
+    if (*word == '\0')
+        free(word);
+    else
+        argv_builder_push(words, word);
+}
+
+/* Runs the commands of $(...) substitutions; installed by the shell */
+static expand_command_fn *run_command;
+
+/* Install the function that runs the command of a substitution */
+void
+expand_set_command_runner(expand_command_fn *run)
+{
+    run_command = run;
+}
+
+/* Sets up process substitutions; installed by the shell */
+static expand_process_fn *run_process;
+
+/* Install the function that sets up process substitutions */
+void
+expand_set_process_runner(expand_process_fn *run)
+{
+    run_process = run;
+}
+
+/* Return the '(' of the substitution that starts with the '$' at
+ * dollar, or NULL if it does not start one */
+const char *
+expand_substitution_open(const char *dollar)
+{
+    if (dollar[1] == '(')
+        return dollar + 1;
+    if ((dollar[1] == '\\' || dollar[1] == '<' || dollar[1] == '>') && dollar[2] == '(')
+        return dollar + 2;
+    return NULL;
+}
+
+/* Return the ')' that closes the substitution whose '(' is at open,
+ * or NULL if there is none.  Parentheses inside double quotes or
+ * after a backslash do not count. */
+const char *
+expand_substitution_end(const char *open)
+{
+    int depth = 0;
+    bool quoted = false;
+    for (const char *p = open; *p; p++) {
+        if (*p == '\\' && p[1] != '\0')
+            p++;
+        else if (*p == '"')
+            quoted = !quoted;
+        else if (!quoted && *p == '(')
+            depth++;
+        else if (!quoted && *p == ')' && --depth == 0)
+            return p;
+    }
+    return NULL;
+}
+
+static bool
+is_field_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+/* Append captured output, without its trailing newlines, to buf.  If
+ * words is not NULL, the output is split into fields in place: each
+ * run of separators ends the word being built, which is passed to
+ * finish_word.  Otherwise, the output is escaped so that it is used
+ * literally. */
+static void
+append_output(struct strbuf *buf, const char *data, size_t len,
+              struct argv_builder *words)
+{
+    const char *end = data + len;
+    while (end > data && end[-1] == '\n')
+        end--;
+
+    if (words == NULL) {
+        append_escaped(buf, data, end - data);
+        return;
+    }
+
+    for (const char *p = data; p < end; ) {
+        const char *q = p;
+        if (is_field_separator(*p)) {
+            while (q < end && is_field_separator(*q))
+                q++;
+            if (buf->len > 0) {
+                finish_word(words, strdup(buf->s));
+                buf->len = 0;
+                buf->s[0] = '\0';
+            }
+        } else {
+            while (q < end && !is_field_separator(*q))
+                q++;
+            strbuf_append(buf, p, q - p);
+        }
+        p = q;
+    }
+}
+
+/* Run the substitution whose '(' is at open and append its output.
+ * Returns a pointer past the closing ')', or NULL on failure. */
+static const char *
+expand_substitution(struct strbuf *buf, const char *open, bool quoted,
+                    struct argv_builder *words)
+{
+    const char *close = expand_substitution_end(open);
+    if (close == NULL || run_command == NULL)
+        return NULL;
+
+    char *command = strndup(open + 1, close - open - 1);
+    struct capture output;
+    int rc = run_command(command, &output);
+    if (rc == 0)
+        append_output(buf, output.data, output.len, quoted ? NULL : words);
+    capture_free(&output);
+    free(command);
+    return rc == 0 ? close + 1 : NULL;
+}
+
+/* Set up the process substitution whose '(' is at open and append
+ * the path of its pipe.  Returns a pointer past the closing ')', or
+ * NULL on failure. */
+static const char *
+expand_process(struct strbuf *buf, const char *open, bool output)
+{
+    const char *close = expand_substitution_end(open);
+    if (close == NULL || run_process == NULL)
+        return NULL;
+
+    char *command = strndup(open + 1, close - open - 1);
+    char *path = run_process(command, output);
+    free(command);
+    if (path == NULL)
+        return NULL;
+
+    strbuf_append(buf, path, strlen(path));
+    free(path);
+    return close + 1;
+}
+
+/* Replace the variable references and command substitutions in word.
+ * Escapes are kept, so that escaped glob characters stay literal when
+ * the result is globbed.  If words is not NULL, the output of unquoted
+ * substitutions is split into words: all but the last are passed to
+ * finish_word, and the last one is returned.  Sets *quoted if the word
+ * has a quoted reference or substitution, which makes it a word even
+ * if it expands to nothing.  Returns NULL and sets *failed if a
+ * substitution fails. */
+static char *
+substitute(const char *word, struct argv_builder *words, bool *quoted,
+           bool *failed)
+{
+    struct strbuf buf = { NULL, 0, 0 };
+    const char *p = word;
+
+    strbuf_append(&buf, "", 0);
+    for (;;) {
+        const char *q = strpbrk(p, "$\\");
+        if (q == NULL)
+            break;
+
+        strbuf_append(&buf, p, q - p);
+        if (*q == '\\') {
+            size_t len = q[1] != '\0' ? 2 : 1;
+            strbuf_append(&buf, q, len);
+            p = q + len;
+        } else if (expand_substitution_open(q) != NULL) {
+            /* The lexer marks substitutions in quoted words as $\(, and
+             * process substitutions as $<( and $>( */
+            const char *open = expand_substitution_open(q);
+            *quoted |= q[1] == '\\';
+            if (q[1] == '<' || q[1] == '>')
+                p = expand_process(&buf, open, q[1] == '>');
+            else
+                p = expand_substitution(&buf, open, q[1] == '\\', words);
+            if (p == NULL) {
+                free(buf.s);
+                *failed = true;
+                return NULL;
+            }
+        } else if (q[1] == '\\' && q[2] == '{') {
+            /* and variable references in quoted words as $\{name} */
+            *quoted = true;
+            p = expand_variable(&buf, q + 2, true);
+        } else {
+            p = expand_variable(&buf, q + 1, false);
+        }
+    }
+    strbuf_append(&buf, p, strlen(p));
+    return buf.s;
+}
+
+/* Return the expansion of word, or NULL if there is nothing to expand.
+ * The result is neither split nor globbed. */
+char *
+expand_word(const char *word, bool *failed)
+{
+    if (strpbrk(word, "$\\") == NULL)
+        return NULL;
+
+    bool quoted = false;
+    char *expanded = substitute(word, NULL, &quoted, failed);
+    if (expanded == NULL)
+        return strdup("");
+
+    remove_escapes(expanded);
+    return expanded;
+}
+
+/* Return the expansion of a here-document's text, or NULL if there is
+ * nothing to expand */
+char *
+expand_heredoc(const char *text, bool *failed)
+{
+    if (strpbrk(text, "$\\") == NULL)
+        return NULL;
+
+    struct strbuf buf = { NULL, 0, 0 };
+    const char *p = text;
+
+    strbuf_append(&buf, "", 0);
+    for (;;) {
+        const char *q = strpbrk(p, "$\\");
+        if (q == NULL)
+            break;
+
+        strbuf_append(&buf, p, q - p);
+        if (*q == '\\') {
+            bool quotes = q[1] == '$' || q[1] == '\\';
+            strbuf_append(&buf, q + quotes, 1);
+            p = q + 1 + quotes;
+        } else if (q[1] == '(') {
+            /* The output comes back escaped, as in a quoted word */
+            size_t start = buf.len;
+            p = expand_substitution(&buf, q + 1, true, NULL);
+            if (p == NULL) {
+                free(buf.s);
+                *failed = true;
+                return strdup("");
+            }
+            remove_escapes(buf.s + start);
+            buf.len = start + strlen(buf.s + start);
+        } else {
+            p = expand_variable(&buf, q + 1, false);
+        }
+    }
+    strbuf_append(&buf, p, strlen(p));
+    return buf.s;
+}
+
+/* The state of expand_argv, passed through brace expansion */
+struct expansion {
+    struct argv_builder builder;
+    bool *failed;
+};
+
+/* Expand a word produced by brace expansion and append the result to
+ * the expansion passed as ctx */
+static void
+expand_into(const char *word, void *ctx)
+{
+    struct expansion *e = ctx;
+    if (expand_is_literal(word)) {
+        argv_builder_push(&e->builder, strdup(word));
+        return;
+    }
+
+    bool quoted = false;
+    char *expanded = substitute(word, &e->builder, &quoted, e->failed);
+    if (expanded != NULL && quoted && *expanded == '\0')
+        argv_builder_push(&e->builder, expanded);
+    else if (expanded != NULL)
+        finish_word(&e->builder, expanded);
+}
+
+/* Return the expansion of argv, or NULL if it needs none */
+char **
+expand_argv(char **argv, bool *failed)
+{
+    char **p = argv;
+    while (*p && expand_is_literal(*p))
+        p++;
+
+    if (*p == NULL)
+        return NULL;
+
+    struct expansion e = { .failed = failed };
+    argv_builder_init(&e.builder);
+    size_t max_bytes = shell_option_get(OPT_BRACEMAX);
+
+    /* Leading name=value words stay one word each, as the parser
+     * counted them as assignments */
+    for (p = argv; *p && variable_assignment_length(*p) > 0; p++) {
+        char *word = expand_word(*p, failed);
+        argv_builder_push(&e.builder, word != NULL ? word : strdup(*p));
+    }
+
+    for (; *p; p++) {
+        if (strchr(*p, '{') == NULL)
+            expand_into(*p, &e);
+        else if (brace_expand(*p, max_bytes, expand_into, &e) == -1)
+            *failed = true;
+    }
+    return argv_builder_finish(&e.builder);
+}
@@ -0,0 +1,99 @@
+#ifndef __EXPAND_H
+#define __EXPAND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Word expansion, done each time a command is about to run.
+ * Words are taken from the already parsed command line, so a loop
+ * body is expanded on every iteration without being lexed again.
+ *
+ * Words of argv first undergo brace expansion (see brace.h).  Then
+ * $name and ${name} are replaced by the variable's value, or by
+ * nothing if it is not set, and $(command) by the output of command
+ * without its trailing newlines.  Unless the substitution is quoted,
+ * its output is split into words at spaces, tabs, and newlines.
+ * <(command) and >(command) are replaced by a /dev/fd path connected
+ * to command through a pipe.  Words that contain *, ?, or [...] after
+ * that are replaced by the sorted pathnames they match, or kept as
+ * they are if nothing matches (see fastglob.h).  A backslash before
+ * $, *, ?, [, ], {, }, or a backslash makes it literal; the lexer adds
+ * one before the glob characters and braces of quoted words, and marks
+ * their variable references as $\{name}, whose values are escaped.
+ */
+
+/* Collects the words of an expanded argv.  Expansions that produce
+ * many words stream them into the builder one at a time. */
+struct argv_builder {
+    char **argv;            /* Words collected so far */
+    size_t argc;            /* Number of words in argv */
+    size_t capacity;        /* Allocated size of argv */
+};
+
+/* Initialize an empty builder */
+void argv_builder_init(struct argv_builder *builder);
+
+/* Append word to the builder, which takes ownership of it */
+void argv_builder_push(struct argv_builder *builder, char *word);
+
+/* Return the collected words as a NULL terminated array owned by the
+ * caller, and leave the builder empty */
+char **argv_builder_finish(struct argv_builder *builder);
+
+/* Free a NULL terminated array of words and the words themselves */
+void argv_free(char **argv);
+
+struct capture;
+
+/* Runs command, a command line, with its standard output captured in
+ * output; returns -1 if it cannot be run or is interrupted.  output
+ * is released by the caller with capture_free in either case. */
+typedef int expand_command_fn(char *command, struct capture *output);
+
+/* Install the function that runs the command of a $(...) substitution */
+void expand_set_command_runner(expand_command_fn *run);
+
+/* Sets up command as a process substitution, <(command) if output is
+ * false or >(command) if it is true, and returns the /dev/fd path
+ * that the expanded command reads from or writes to, in a newly
+ * allocated string.  Returns NULL if this is not possible. */
+typedef char *expand_process_fn(char *command, bool output);
+
+/* Install the function that sets up process substitutions */
+void expand_set_process_runner(expand_process_fn *run);
+
+/* If the '$' at dollar starts a $(...) substitution, the $\(...) of a
+ * quoted one, or the $<(...) or $>(...) that the lexer makes of a
+ * process substitution, return its '(', otherwise NULL */
+const char *expand_substitution_open(const char *dollar);
+
+/* Return the ')' that closes the substitution whose '(' is at open,
+ * or NULL if there is none */
+const char *expand_substitution_end(const char *open);
+
+/* Return true if word expands to exactly itself */
+bool expand_is_literal(const char *word);
+
+/* Return the expansion of word in a newly allocated string, or NULL if
+ * word contains nothing to expand.  Used where a single word is
+ * needed, such as redirection targets, and therefore neither split
+ * nor globbed.  Sets *failed if a substitution fails. */
+char *expand_word(const char *word, bool *failed);
+
+/* Return the expansion of the text of a here-document in a newly
+ * allocated string, or NULL if it contains nothing to expand.  As in
+ * double quotes, only $name, ${name}, and $(command) are replaced, and
+ * a backslash only quotes $ and a backslash.  Sets *failed if a
+ * substitution fails. */
+char *expand_heredoc(const char *text, bool *failed);
+
+/* Return a newly allocated argv holding the expansion of argv, or NULL
+ * if none of its words contains anything to expand.  Words that expand
+ * to the empty string are dropped; patterns are globbed.  Leading
+ * name=value words are neither split nor globbed.  If a brace
+ * expansion exceeds the bracemax option or a substitution fails, the
+ * word is dropped and *failed is set to true. */
+char **expand_argv(char **argv, bool *failed);
+
+#endif /* __EXPAND_H */
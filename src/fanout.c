@@ -0,0 +1,123 @@
+/*
+ * Copying one stream to several outputs with tee and splice.
+ */
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fanout.h"
+#include "utils.h"
+
+/* An output of the relay */
+struct output {
+    int fd;
+    int pipe[2];            /* Holds the pages tee'd for this output;
+                               unused for the last output */
+    bool splice;            /* False once splice was refused */
+};
+
+/* Move exactly len bytes from the pipe fd to out.  Falls back to read
+ * and write for outputs that do not support splice. */
+static int
+drain(int fd, struct output *out, size_t len)
+{
+    char buf[1 << 16];
+
+    while (len > 0) {
+        ssize_t n;
+        if (out->splice) {
+            n = splice(fd, NULL, out->fd, NULL, len, SPLICE_F_MOVE);
+            if (n == -1 && errno == EINVAL) {
+                out->splice = false;
+                continue;
+            }
+        } else {
+            n = read(fd, buf, len < sizeof buf ? len : sizeof buf);
+            for (ssize_t done = 0; n > 0 && done < n; ) {
+                ssize_t w = write(out->fd, buf + done, n - done);
+                if (w == -1) {
+                    n = -1;
+                    break;
+                }
+                done += w;
+            }
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            utils_error("relay: ");
+            return -1;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+/* Copy everything read from the pipe in_fd to the n >= 2 descriptors
+ * in out_fds */
+int
+fanout_relay(int in_fd, const int *out_fds, int n)
+{
+    struct output *outs = calloc(n, sizeof *outs);
+    int capacity = fcntl(in_fd, F_GETPIPE_SZ);
+    int rc = -1, k;
+
+    /* A tee'd chunk fits into an empty pipe as large as the input, so
+     * every output receives the same number of bytes each round */
+    for (k = 0; k < n; k++) {
+        outs[k].fd = out_fds[k];
+        outs[k].splice = true;
+        if (k == n - 1)
+            break;
+        if (pipe2(outs[k].pipe, O_CLOEXEC) == -1) {
+            utils_error("relay: pipe: ");
+            goto out;
+        }
+        if (capacity > 0)
+            fcntl(outs[k].pipe[1], F_SETPIPE_SZ, capacity);
+    }
+
+    for (;;) {
+        ssize_t len = tee(in_fd, outs[0].pipe[1], SIZE_MAX >> 1, 0);
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len == -1) {
+            utils_error("relay: ");
+            goto out;
+        }
+        if (len == 0)
+            break;
+
+        for (k = 1; k < n - 1; k++) {
+            ssize_t copied;
+            while ((copied = tee(in_fd, outs[k].pipe[1], len, 0)) == -1 && errno == EINTR)
+                ;
+            if (copied != len) {
+                fprintf(stderr, "relay: short tee\n");
+                goto out;
+            }
+        }
+        for (k = 0; k < n - 1; k++) {
+            if (drain(outs[k].pipe[0], &outs[k], len) == -1)
+                goto out;
+        }
+        if (drain(in_fd, &outs[n - 1], len) == -1)
+            goto out;
+    }
+    rc = 0;
+
+out:
+    for (k = 0; k < n - 1; k++) {
+        if (outs[k].pipe[0] > 0) {
+            close(outs[k].pipe[0]);
+            close(outs[k].pipe[1]);
+        }
+    }
+    free(outs);
+    return rc;
+}
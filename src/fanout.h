@@ -0,0 +1,20 @@
+#ifndef __FANOUT_H
+#define __FANOUT_H
+
+/*
+ * Copying one stream to several outputs, as needed for 'cmd >a >b'.
+ *
+ * The stream arrives in a pipe.  For every output but the last, tee(2)
+ * duplicates the pipe's pages into a private pipe, from which they are
+ * spliced into the output; the last output receives the pages of the
+ * input pipe itself.  Data does not pass through user space unless an
+ * output does not support splice, such as a file opened for
+ * appending.
+ */
+
+/* Copy everything read from the pipe in_fd to each of the n >= 2
+ * descriptors in out_fds until end of file.  Returns 0, or -1 after
+ * printing an error. */
+int fanout_relay(int in_fd, const int *out_fds, int n);
+
+#endif /* __FANOUT_H */
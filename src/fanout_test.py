@@ -0,0 +1,56 @@
+#!/usr/bin/python
+#
+# fanout_test: tests cmd >a >b, which writes the output of cmd to
+# several files through the shell's tee/splice relay.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+import tempfile, shutil
+tmpdir = tempfile.mkdtemp("-cush-fanout-tests")
+
+def cleanup():
+    shutil.rmtree(tmpdir)
+
+atexit.register(cleanup)
+
+def contents(name):
+    with open(os.path.join(tmpdir, name)) as f:
+        return f.read()
+
+# every target receives the whole output
+sendline("seq 1 100000 > %s/a > %s/b" % (tmpdir, tmpdir))
+expect_prompt("fan-out did not finish")
+expected = "".join("%d\n" % i for i in range(1, 100001))
+assert contents("a") == expected, "first target has the wrong contents"
+assert contents("b") == expected, "second target has the wrong contents"
+
+# >> appends to its target, > truncates, and >& includes stderr
+sendline("echo one > %s/c" % tmpdir)
+expect_prompt()
+sendline("echo two >> %s/c > %s/d >& %s/e" % (tmpdir, tmpdir, tmpdir))
+expect_prompt()
+assert contents("c") == "one\ntwo\n", ">> target was not appended to"
+assert contents("d") == "two\n", "> target has the wrong contents"
+assert contents("e") == "two\n", ">& target has the wrong contents"
+
+# the relay belongs to the job, which ends when the command ends
+sendline("seq 3 | cat > %s/f > %s/g" % (tmpdir, tmpdir))
+expect_prompt()
+sendline("cat %s/f %s/g | wc -l" % (tmpdir, tmpdir))
+expect_exact("6", "pipeline output was not copied to both targets")
+expect_prompt()
+
+# no command runs if a target cannot be opened
+sendline("echo x > %s/nodir/h > %s/i" % (tmpdir, tmpdir))
+expect_exact("No such file or directory", "missing error for a bad target")
+expect_prompt()
+assert not os.path.exists(os.path.join(tmpdir, "i")), "later target was opened"
+
+test_success()
@@ -0,0 +1,541 @@
+/*
+ * Pathname expansion.
+ *
+ * libc's glob() reads directories through readdir, calls fnmatch for
+ * every entry, and sorts the result with qsort and strcoll, which
+ * becomes slow for directories with millions of entries.  Here,
+ * directories are read in large getdents64 batches into a listing that
+ * is cached for the rest of the command line.  Common pattern shapes
+ * (*, prefix*, *suffix, prefix*suffix) are matched with memcmp; only
+ * other patterns use the general matcher.  Results are sorted with an
+ * MSD radix sort.
+ */
+#define _GNU_SOURCE 1
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "fastglob.h"
+#include "expand.h"
+#include "utils.h"
+
+#define GETDENTS_BUFSIZE (1024 * 1024)
+
+/* Layout of the records returned by getdents64 */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* The entries of one directory, except . and .. */
+struct dir_listing {
+    char *path;             /* Directory as it appears in the pattern */
+    dev_t dev;              /* Identity and modification time, used */
+    ino_t ino;              /* to check that the listing is current */
+    struct timespec mtime;
+    char *names;            /* All names, each NUL-terminated */
+    size_t *offsets;        /* Offset of each name in names */
+    unsigned char *types;   /* d_type of each entry */
+    size_t count;
+    struct dir_listing *next;
+};
+
+static struct dir_listing *cache;
+
+static void *
+xrealloc(void *p, size_t size)
+{
+    p = realloc(p, size);
+    if (p == NULL)
+        utils_fatal_error("out of memory: ");
+    return p;
+}
+
+static void
+free_listing(struct dir_listing *dir)
+{
+    free(dir->path);
+    free(dir->names);
+    free(dir->offsets);
+    free(dir->types);
+    free(dir);
+}
+
+/* Drop all cached directory listings */
+void
+fastglob_cache_clear(void)
+{
+    while (cache != NULL) {
+        struct dir_listing *next = cache->next;
+        free_listing(cache);
+        cache = next;
+    }
+}
+
+/* Read the directory open on fd into dir */
+static void
+read_listing(struct dir_listing *dir, int fd)
+{
+    size_t names_size = 0, names_capacity = 0, capacity = 0;
+    char *buf = malloc(GETDENTS_BUFSIZE);
+    if (buf == NULL)
+        utils_fatal_error("out of memory: ");
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf, GETDENTS_BUFSIZE);
+        if (n <= 0)
+            break;
+
+        for (long pos = 0; pos < n; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *) (buf + pos);
+            pos += d->d_reclen;
+
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' ||
+                                   (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            size_t len = strlen(name) + 1;
+            if (names_size + len > names_capacity) {
+                names_capacity = names_capacity ? 2 * names_capacity : 64 * 1024;
+                while (names_size + len > names_capacity)
+                    names_capacity *= 2;
+                dir->names = xrealloc(dir->names, names_capacity);
+            }
+            if (dir->count == capacity) {
+                capacity = capacity ? 2 * capacity : 256;
+                dir->offsets = xrealloc(dir->offsets, capacity * sizeof *dir->offsets);
+                dir->types = xrealloc(dir->types, capacity);
+            }
+
+            memcpy(dir->names + names_size, name, len);
+            dir->offsets[dir->count] = names_size;
+            dir->types[dir->count] = d->d_type;
+            dir->count++;
+            names_size += len;
+        }
+    }
+    free(buf);
+}
+
+/* Return the listing of directory path ("" for the current directory),
+ * reading it if it is not cached or has changed.  Returns NULL if the
+ * directory cannot be read. */
+static struct dir_listing *
+get_listing(const char *path)
+{
+    int fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    struct dir_listing **link = &cache;
+    for (; *link != NULL; link = &(*link)->next) {
+        struct dir_listing *dir = *link;
+        if (strcmp(dir->path, path) != 0)
+            continue;
+
+        if (dir->dev == st.st_dev && dir->ino == st.st_ino
+            && dir->mtime.tv_sec == st.st_mtim.tv_sec
+            && dir->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            close(fd);
+            return dir;
+        }
+
+        /* Stale; read it again */
+        *link = dir->next;
+        free_listing(dir);
+        break;
+    }
+
+    struct dir_listing *dir = calloc(1, sizeof *dir);
+    if (dir == NULL)
+        utils_fatal_error("out of memory: ");
+    dir->path = strdup(path);
+    dir->dev = st.st_dev;
+    dir->ino = st.st_ino;
+    dir->mtime = st.st_mtim;
+    read_listing(dir, fd);
+    close(fd);
+
+    dir->next = cache;
+    cache = dir;
+    return dir;
+}
+
+/* Return true if pattern contains an unescaped *, ?, or [ */
+bool
+fastglob_has_magic(const char *pattern)
+{
+    for (const char *p = pattern; *p; p++) {
+        if (*p == '\\' && p[1] != '\0')
+            p++;
+        else if (*p == '*' || *p == '?' || *p == '[')
+            return true;
+    }
+    return false;
+}
+
+/* Match the bracket expression starting after the '[' at *pp against
+ * c, and advance *pp past it.  Returns -1 if the bracket is not
+ * closed, in which case '[' is an ordinary character. */
+static int
+match_bracket(const char **pp, unsigned char c)
+{
+    const char *p = *pp;
+    bool negate = *p == '!' || *p == '^';
+    bool matched = false;
+
+    if (negate)
+        p++;
+
+    /* A ']' right after the '[' is part of the set */
+    const char *first = p;
+    while (*p && (*p != ']' || p == first)) {
+        unsigned char lo = *p, hi;
+        if (lo == '\\' && p[1])
+            lo = *++p;
+        p++;
+
+        hi = lo;
+        if (*p == '-' && p[1] && p[1] != ']') {
+            if (p[1] == '\\' && p[2])
+                p++;
+            hi = p[1];
+            p += 2;
+        }
+        if (lo <= c && c <= hi)
+            matched = true;
+    }
+
+    if (*p != ']')
+        return -1;
+
+    *pp = p + 1;
+    return matched != negate;
+}
+
+/* Match name against pattern, a single path component.  A '*' matches
+ * any sequence of characters; on a mismatch the matcher backtracks to
+ * the most recent '*' only, which is sufficient for wildcards. */
+static bool
+match_general(const char *pattern, const char *name)
+{
+    const char *p = pattern, *n = name;
+    const char *star_p = NULL, *star_n = NULL;
+
+    while (*n) {
+        if (*p == '*') {
+            star_p = ++p;
+            star_n = n;
+            continue;
+        }
+
+        bool ok;
+        const char *next = p + 1;
+        if (*p == '?') {
+            ok = true;
+        } else if (*p == '[') {
+            const char *q = p + 1;
+            int m = match_bracket(&q, *n);
+            ok = m == -1 ? *n == '[' : m;
+            if (m != -1)
+                next = q;
+        } else if (*p == '\\' && p[1]) {
+            ok = p[1] == *n;
+            next = p + 2;
+        } else {
+            ok = *p != '\0' && *p == *n;
+        }
+
+        if (ok) {
+            p = next;
+            n++;
+        } else if (star_p != NULL) {
+            p = star_p;
+            n = ++star_n;
+        } else {
+            return false;
+        }
+    }
+
+    while (*p == '*')
+        p++;
+    return *p == '\0';
+}
+
+/* A path component compiled for matching */
+struct matcher {
+    enum {
+        MATCH_ALL,          /* '*' */
+        MATCH_AFFIXES,      /* 'prefix*suffix', either may be empty */
+        MATCH_GENERAL,      /* anything else */
+    } kind;
+    const char *pattern;
+    const char *prefix, *suffix;
+    size_t prefix_len, suffix_len;
+    bool dot_ok;            /* pattern may match names starting with '.' */
+};
+
+static void
+compile_matcher(struct matcher *m, const char *component)
+{
+    m->pattern = component;
+    m->dot_ok = component[0] == '.';
+
+    const char *star = strchr(component, '*');
+    bool simple = star != NULL && strchr(star + 1, '*') == NULL
+                  && strpbrk(component, "?[\\") == NULL;
+
+    if (strcmp(component, "*") == 0) {
+        m->kind = MATCH_ALL;
+    } else if (simple) {
+        m->kind = MATCH_AFFIXES;
+        m->prefix = component;
+        m->prefix_len = star - component;
+        m->suffix = star + 1;
+        m->suffix_len = strlen(star + 1);
+    } else {
+        m->kind = MATCH_GENERAL;
+    }
+}
+
+static bool
+matches(struct matcher *m, const char *name)
+{
+    if (name[0] == '.' && !m->dot_ok)
+        return false;
+
+    switch (m->kind) {
+    case MATCH_ALL:
+        return true;
+    case MATCH_AFFIXES: {
+        size_t len = strlen(name);
+        return len >= m->prefix_len + m->suffix_len
+            && memcmp(name, m->prefix, m->prefix_len) == 0
+            && memcmp(name + len - m->suffix_len, m->suffix, m->suffix_len) == 0;
+    }
+    default:
+        return match_general(m->pattern, name);
+    }
+}
+
+/* Remove the backslashes that escape characters of component */
+static void
+unescape(char *s)
+{
+    char *d = s;
+    for (; *s; s++) {
+        if (*s == '\\' && s[1] != '\0')
+            s++;
+        *d++ = *s;
+    }
+    *d = '\0';
+}
+
+/* A growing list of path strings */
+struct path_list {
+    char **paths;
+    size_t count, capacity;
+};
+
+static void
+path_list_add(struct path_list *list, char *path)
+{
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 16;
+        list->paths = xrealloc(list->paths, list->capacity * sizeof *list->paths);
+    }
+    list->paths[list->count++] = path;
+}
+
+static char *
+concat(const char *a, size_t alen, const char *b, size_t blen, bool slash)
+{
+    char *s = malloc(alen + blen + slash + 1);
+    if (s == NULL)
+        utils_fatal_error("out of memory: ");
+    memcpy(s, a, alen);
+    memcpy(s + alen, b, blen);
+    if (slash)
+        s[alen + blen] = '/';
+    s[alen + blen + slash] = '\0';
+    return s;
+}
+
+/* Return true if entry i of dir is a directory, following symlinks */
+static bool
+entry_is_dir(struct dir_listing *dir, size_t i, const char *path)
+{
+    if (dir->types[i] == DT_DIR)
+        return true;
+    if (dir->types[i] != DT_LNK && dir->types[i] != DT_UNKNOWN)
+        return false;
+
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static inline int
+char_at(const char *s, size_t depth)
+{
+    return (unsigned char) s[depth];
+}
+
+/* Sort strings that agree in their first depth bytes by insertion */
+static void
+insertion_sort(char **a, size_t n, size_t depth)
+{
+    for (size_t i = 1; i < n; i++) {
+        char *s = a[i];
+        size_t j = i;
+        while (j > 0 && strcmp(a[j - 1] + depth, s + depth) > 0) {
+            a[j] = a[j - 1];
+            j--;
+        }
+        a[j] = s;
+    }
+}
+
+/* MSD radix sort of strings that agree in their first depth bytes,
+ * using tmp (of size n) as scratch space */
+static void
+radix_sort(char **a, char **tmp, size_t n, size_t depth)
+{
+    while (n >= 32) {
+        size_t count[257] = { 0 };
+        for (size_t i = 0; i < n; i++)
+            count[char_at(a[i], depth) + 1]++;
+
+        /* All strings share this byte: move on without redistributing */
+        if (count[char_at(a[0], depth) + 1] == n) {
+            if (char_at(a[0], depth) == '\0')
+                return;
+            depth++;
+            continue;
+        }
+
+        for (int c = 1; c < 257; c++)
+            count[c] += count[c - 1];
+        for (size_t i = 0; i < n; i++)
+            tmp[count[char_at(a[i], depth)]++] = a[i];
+        memcpy(a, tmp, n * sizeof *a);
+
+        /* count[c] is now the end of bucket c; bucket 0 holds strings
+         * that ended and needs no further sorting */
+        for (int c = 1; c < 256; c++) {
+            size_t start = count[c - 1], end = count[c];
+            if (end - start > 1)
+                radix_sort(a + start, tmp, end - start, depth + 1);
+        }
+        return;
+    }
+    insertion_sort(a, n, depth);
+}
+
+/* Append the sorted paths that match pattern to builder */
+size_t
+fastglob_expand(const char *pattern, struct argv_builder *builder)
+{
+    char *copy = strdup(pattern);
+    struct path_list current = { NULL, 0, 0 };
+
+    /* Start from the root for absolute patterns, else from "" */
+    char *rest = copy;
+    if (*rest == '/') {
+        path_list_add(&current, strdup("/"));
+        while (*rest == '/')
+            rest++;
+    } else {
+        path_list_add(&current, strdup(""));
+    }
+
+    bool need_exists_check = false;
+    while (*rest && current.count > 0) {
+        char *slash = strchr(rest, '/');
+        bool last = slash == NULL || slash[strspn(slash, "/")] == '\0';
+        bool want_dir = slash != NULL;
+        if (slash)
+            *slash = '\0';
+
+        struct path_list next = { NULL, 0, 0 };
+        if (!fastglob_has_magic(rest)) {
+            /* Literal components need no directory read */
+            unescape(rest);
+            size_t rlen = strlen(rest);
+            for (size_t i = 0; i < current.count; i++) {
+                char *p = current.paths[i];
+                path_list_add(&next, concat(p, strlen(p), rest, rlen, want_dir));
+                free(p);
+            }
+            need_exists_check = true;
+        } else {
+            struct matcher m;
+            compile_matcher(&m, rest);
+            for (size_t i = 0; i < current.count; i++) {
+                char *p = current.paths[i];
+                size_t plen = strlen(p);
+                struct dir_listing *dir = get_listing(p);
+                for (size_t j = 0; dir != NULL && j < dir->count; j++) {
+                    const char *name = dir->names + dir->offsets[j];
+                    if (!matches(&m, name))
+                        continue;
+
+                    char *path = concat(p, plen, name, strlen(name), want_dir);
+                    if (want_dir && !entry_is_dir(dir, j, path))
+                        free(path);
+                    else
+                        path_list_add(&next, path);
+                }
+                free(p);
+            }
+            need_exists_check = false;
+        }
+        free(current.paths);
+        current = next;
+
+        if (last)
+            break;
+        rest = slash + 1;
+        while (*rest == '/')
+            rest++;
+    }
+
+    /* A trailing literal component was not looked up yet */
+    size_t n = 0;
+    for (size_t i = 0; i < current.count; i++) {
+        struct stat st;
+        if (need_exists_check && lstat(current.paths[i], &st) == -1)
+            free(current.paths[i]);
+        else
+            current.paths[n++] = current.paths[i];
+    }
+
+    if (n > 1) {
+        char **tmp = malloc(n * sizeof *tmp);
+        if (tmp == NULL)
+            utils_fatal_error("out of memory: ");
+        radix_sort(current.paths, tmp, n, 0);
+        free(tmp);
+    }
+
+    for (size_t i = 0; i < n; i++)
+        argv_builder_push(builder, current.paths[i]);
+
+    free(current.paths);
+    free(copy);
+    return n;
+}
@@ -0,0 +1,30 @@
+#ifndef __FASTGLOB_H
+#define __FASTGLOB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct argv_builder;
+
+/*
+ * Pathname expansion of *, ?, and [...] patterns.
+ *
+ * Directories are read with getdents64 into a cache that lives until
+ * fastglob_cache_clear() is called, which the shell does after each
+ * command line.  A cached listing is reused as long as the directory's
+ * modification time is unchanged.  Matches are sorted in byte order.
+ * A backslash makes the next character literal; names starting with
+ * a dot are only matched by patterns that start with a dot.
+ */
+
+/* Return true if pattern contains an unescaped *, ?, or [ */
+bool fastglob_has_magic(const char *pattern);
+
+/* Append the sorted paths that match pattern to builder.  Returns the
+ * number of paths appended, 0 if nothing matched. */
+size_t fastglob_expand(const char *pattern, struct argv_builder *builder);
+
+/* Drop all cached directory listings */
+void fastglob_cache_clear(void);
+
+#endif /* __FASTGLOB_H */
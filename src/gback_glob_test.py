@@ -63,5 +63,21 @@ sendline("echo %s/a?" % (tmpdir))
 
 expectedoutput = " ".join(tmpdir + "/" + f for f in testfiles if f.startswith("a") and len(f) == 2)
 expect_exact(expectedoutput, "echo a? does not work correctly")
+expect_prompt("Shell did not print expected prompt (5)")
+
+#################################################################
+# Step 5. Quoted patterns and patterns without a match stay as they are
+#
+sendline('echo "%s/a*" %s/x*' % (tmpdir, tmpdir))
+
+expectedoutput = "%s/a* %s/x*" % (tmpdir, tmpdir)
+expect_exact(expectedoutput, "quoted or unmatched pattern was expanded")
+expect_prompt("Shell did not print expected prompt (6)")
+
+# so do patterns that come from a quoted variable
+sendline('X=%s/a*; echo "[$X]"' % (tmpdir))
+
+expectedoutput = "[%s/a*]" % (tmpdir)
+expect_exact(expectedoutput, "pattern in a quoted variable was expanded")
 
 test_success()
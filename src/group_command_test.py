@@ -0,0 +1,64 @@
+#!/usr/bin/python
+#
+# group_command_test: tests subshells '( list )' and groups '{ list; }'.
+#
+# Both kinds of group can be piped and redirected as a whole, and a
+# subshell can run in the background as a single job.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# the output of every command in a subshell goes through the pipe
+sendline("(echo first; echo second) | tr a-z A-Z")
+expect_exact("FIRST", "subshell output was not piped")
+expect_exact("SECOND", "second command of subshell was not piped")
+expect_prompt()
+
+# a group's redirection applies to the whole list
+tmpfile = "/tmp/cush_group_test_%d" % os.getpid()
+sendline("{ echo one; echo two; } > " + tmpfile)
+expect_prompt()
+sendline("cat " + tmpfile)
+expect_exact("one", "group redirection lost the first command's output")
+expect_exact("two", "group redirection lost the second command's output")
+expect_prompt()
+os.unlink(tmpfile)
+
+# a group can read from a pipe
+sendline("echo piped | { cat; echo after; }")
+expect_exact("piped", "group did not read from the pipe")
+expect_exact("after", "group did not run its second command")
+expect_prompt()
+
+# the exit status of a subshell is that of its last command
+sendline("(true; false) || echo failed")
+expect_exact("failed", "subshell status was not taken from its last command")
+expect_prompt()
+
+# a background subshell is a single job
+sendline("(sleep 1; echo done-bg) &")
+expect(r"\[1\] \d+", "background subshell did not print its job")
+expect_prompt()
+sendline("jobs")
+expect(r"\[1\]\s+Running", "background subshell is not listed as a job")
+expect_prompt()
+sendline("wait")
+expect_exact("done-bg", "background subshell did not finish")
+expect_prompt()
+
+# empty groups and words after a group are syntax errors
+sendline("( )")
+expect_exact("Invalid null command.", "empty subshell was accepted")
+expect_prompt()
+
+sendline("(echo a) b")
+expect_exact("Badly placed ()'s.", "word after a subshell was accepted")
+expect_prompt()
+
+test_success()
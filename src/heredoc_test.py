@@ -0,0 +1,60 @@
+#!/usr/bin/python
+#
+# heredoc_test: tests <<word here-documents, quoted delimiters, and
+# <<<word here-strings.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# the lines up to the delimiter are the input, with variables expanded
+sendline("X=there")
+expect_prompt()
+sendline("cat <<END | tr a-z A-Z")
+sendline("hello $X")
+sendline("END")
+expect_exact("HELLO THERE", "here-document was not read")
+expect_prompt()
+
+# a quoted delimiter keeps the text as it is
+sendline('cat <<"END"')
+sendline("$X stays")
+sendline("END")
+expect_exact("$X stays", "quoted here-document was expanded")
+expect_prompt()
+
+# a here-string is the expanded word and a newline
+sendline('wc -c <<<"$X"')
+expect_exact("6", "here-string has the wrong length")
+expect_prompt()
+
+# a group reads the document once; a loop reads it on every iteration
+sendline("for i in 1 2; do cat <<END; done")
+sendline("line $i")
+sendline("END")
+expect_exact("line 1", "here-document was not expanded in the loop")
+expect_exact("line 2", "here-document was not expanded in the loop")
+expect_prompt()
+
+# only $ and backslash are special in the text
+sendline("cat <<END")
+sendline("\\* \\? \\[ \\{ \\} \\$X \\\\ $X")
+sendline("END")
+expect_exact("\\* \\? \\[ \\{ \\} $X \\ there", "here-document escapes were changed")
+expect_prompt()
+
+# the document of a line with a syntax error is skipped, not run
+sendline("cat <<END )")
+sendline("echo not-$X-run")
+sendline("END")
+sendline("echo after")
+expect("\rafter\r\n", "shell did not continue after the syntax error")
+assert "not-there-run" not in console.before, "here-document text ran as a command"
+expect_prompt()
+
+test_success()
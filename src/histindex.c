@@ -0,0 +1,608 @@
+/*
+ * Trigram index of a history log, kept in appended segments.
+ */
+#define _GNU_SOURCE 1
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "histindex.h"
+#include "utils.h"
+
+#define MAGIC 0x31584948        /* "HIX1" */
+
+/* A segment of the index file.  The header is followed by the table of
+ * trigrams, sorted, and then by the list of lines of each trigram: the
+ * offsets of the lines from log_start, increasing, stored as
+ * differences in LEB128. */
+struct segment_header {
+    uint32_t magic;
+    uint32_t num_trigrams;
+    uint64_t log_ino;           /* Inode of the log it indexes */
+    uint64_t log_start, log_end;
+    uint64_t log_check;         /* Hash of the log's last bytes before log_end */
+    uint64_t size;              /* Of the whole segment, a multiple of 8 */
+};
+
+struct segment_entry {
+    uint32_t trigram;
+    uint32_t count;             /* Lines that contain it */
+    uint64_t offset;            /* Of its list, from the segment's start */
+};
+
+/* The lines indexed in memory that contain a trigram */
+struct postings {
+    uint32_t trigram;
+    uint32_t count, capacity;   /* capacity is 0 for a free slot */
+    uint32_t *lines;            /* Offsets from delta_start */
+};
+
+struct histindex {
+    int log_fd, fd;
+    uint64_t log_ino;
+    const char *log_map;        /* The log, mapped for searches */
+    size_t log_mapped;
+    const char *map;            /* The index file */
+    size_t mapped;
+    size_t *segments;           /* Offsets of the segments in use */
+    int num_segments, segment_capacity;
+    size_t walked;              /* End of the last complete segment */
+    uint64_t covered;           /* The segments cover the log up to here */
+
+    uint64_t delta_start, delta_end;    /* Range of the log indexed in memory;
+                                           a backlog being indexed by another
+                                           process may precede it */
+    struct postings *table;     /* Open addressing, by trigram */
+    size_t table_size, table_used, num_postings;
+};
+
+/* Map the first size bytes of fd, replacing a shorter mapping */
+static void
+remap(const char **map, size_t *mapped, int fd, size_t size)
+{
+    if (size <= *mapped)
+        return;
+    if (*map != NULL)
+        munmap((void *) *map, *mapped);
+    *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    *mapped = size;
+    if (*map == MAP_FAILED) {
+        utils_error("history index: mmap: ");
+        *map = NULL;
+        *mapped = 0;
+    }
+}
+
+/* Hash the bytes of the log that end at end, up to 64 of them after
+ * start, so that a segment of a log since rewritten in place is told
+ * apart */
+static uint64_t
+log_check(int log_fd, uint64_t start, uint64_t end)
+{
+    unsigned char buf[64];
+    size_t want = end - start < sizeof buf ? end - start : sizeof buf;
+    ssize_t n = pread(log_fd, buf, want, end - want);
+    uint64_t hash = 14695981039346656037ULL;
+    for (ssize_t i = 0; i < n; i++)
+        hash = (hash ^ buf[i]) * 1099511628211ULL;
+    return n == (ssize_t) want ? hash : 0;
+}
+
+/* Forget the lines indexed in memory and start over at the end of the
+ * segments */
+static void
+clear_delta(struct histindex *index)
+{
+    for (size_t i = 0; i < index->table_size; i++) {
+        free(index->table[i].lines);
+        index->table[i] = (struct postings) { 0 };
+    }
+    index->table_used = 0;
+    index->num_postings = 0;
+    index->delta_start = index->delta_end = index->covered;
+}
+
+/* Take up the segments that were appended to the index file */
+static void
+walk(struct histindex *index)
+{
+    struct stat st;
+    if (fstat(index->fd, &st) == -1)
+        return;
+    remap(&index->map, &index->mapped, index->fd, st.st_size);
+
+    uint64_t covered = index->covered;
+    while (index->walked + sizeof(struct segment_header) <= index->mapped) {
+        const struct segment_header *h = (const void *) (index->map + index->walked);
+        if (h->magic != MAGIC || h->size % 8 != 0
+            || h->size < sizeof *h + h->num_trigrams * sizeof(struct segment_entry)
+            || h->size > index->mapped - index->walked)
+            break;
+
+        /* Segments of an earlier log of the same name are skipped */
+        if (h->log_ino == index->log_ino && h->log_start == index->covered
+            && h->log_check == log_check(index->log_fd, h->log_start, h->log_end)) {
+            if (index->num_segments == index->segment_capacity) {
+                index->segment_capacity = index->segment_capacity ? 2 * index->segment_capacity : 16;
+                index->segments = realloc(index->segments,
+                                          index->segment_capacity * sizeof *index->segments);
+            }
+            index->segments[index->num_segments++] = index->walked;
+            index->covered = h->log_end;
+        }
+        index->walked += h->size;
+    }
+
+    /* Another session indexed the lines we hold in memory */
+    if (index->covered != covered && index->covered > index->delta_start)
+        clear_delta(index);
+}
+
+/* Return the in-memory list of trigram, creating it if create is true */
+static struct postings *
+lookup(struct histindex *index, uint32_t trigram, bool create)
+{
+    if (create && 2 * (index->table_used + 1) > index->table_size) {
+        struct postings *old = index->table;
+        size_t old_size = index->table_size;
+        index->table_size = old_size ? 2 * old_size : 4096;
+        index->table = calloc(index->table_size, sizeof *index->table);
+        index->table_used = 0;
+        for (size_t i = 0; i < old_size; i++) {
+            if (old[i].capacity > 0) {
+                *lookup(index, old[i].trigram, true) = old[i];
+            }
+        }
+        free(old);
+    }
+    if (index->table_size == 0)
+        return NULL;
+
+    size_t mask = index->table_size - 1;
+    for (size_t i = (trigram * 2654435761u) & mask; ; i = (i + 1) & mask) {
+        struct postings *p = &index->table[i];
+        if (p->capacity > 0 && p->trigram == trigram)
+            return p;
+        if (p->capacity == 0) {
+            if (!create)
+                return NULL;
+            p->trigram = trigram;
+            p->capacity = 1;
+            index->table_used++;
+            return p;
+        }
+    }
+}
+
+/* Add the trigrams of a line at offset line from delta_start */
+static void
+index_line(struct histindex *index, const unsigned char *text, size_t len, uint32_t line)
+{
+    for (size_t i = 0; i + 3 <= len; i++) {
+        uint32_t trigram = text[i] << 16 | text[i + 1] << 8 | text[i + 2];
+        struct postings *p = lookup(index, trigram, true);
+        if (p->count > 0 && p->lines[p->count - 1] == line)
+            continue;
+        if (p->lines == NULL || p->count == p->capacity) {
+            p->capacity = p->lines == NULL ? 4 : 2 * p->capacity;
+            p->lines = realloc(p->lines, p->capacity * sizeof *p->lines);
+        }
+        p->lines[p->count++] = line;
+        index->num_postings++;
+    }
+}
+
+/* Order postings by trigram */
+static int
+compare_postings(const void *a, const void *b)
+{
+    const struct postings *p = *(struct postings * const *) a, *q = *(struct postings * const *) b;
+    return p->trigram < q->trigram ? -1 : p->trigram > q->trigram;
+}
+
+/* Append the lines indexed in memory to the index file as a segment */
+static void
+flush(struct histindex *index)
+{
+    if (index->delta_end == index->delta_start)
+        return;
+
+    /* Until the backlog's segments have arrived, a segment of these lines
+     * would not follow the others, so they stay in memory */
+    flock(index->fd, LOCK_EX);
+    walk(index);
+    if (index->delta_end > index->delta_start && index->covered == index->delta_start) {
+        struct postings **sorted = malloc(index->table_used * sizeof *sorted);
+        size_t n = 0;
+        for (size_t i = 0; i < index->table_size; i++) {
+            if (index->table[i].capacity > 0)
+                sorted[n++] = &index->table[i];
+        }
+        qsort(sorted, n, sizeof *sorted, compare_postings);
+
+        size_t size = sizeof(struct segment_header) + n * sizeof(struct segment_entry)
+             + 5 * index->num_postings;
+        unsigned char *segment = calloc(1, size + 8);
+        struct segment_header *h = (void *) segment;
+        struct segment_entry *table = (void *) (h + 1);
+        unsigned char *out = (unsigned char *) (table + n);
+        for (size_t i = 0; i < n; i++) {
+            table[i].trigram = sorted[i]->trigram;
+            table[i].count = sorted[i]->count;
+            table[i].offset = out - segment;
+            for (uint32_t k = 0, last = 0; k < sorted[i]->count; k++) {
+                uint32_t delta = sorted[i]->lines[k] - last;
+                last = sorted[i]->lines[k];
+                for (; delta >= 0x80; delta >>= 7)
+                    *out++ = delta | 0x80;
+                *out++ = delta;
+            }
+        }
+        free(sorted);
+
+        *h = (struct segment_header) {
+            .magic = MAGIC, .num_trigrams = n, .log_ino = index->log_ino,
+            .log_start = index->delta_start, .log_end = index->delta_end,
+            .log_check = log_check(index->log_fd, index->delta_start, index->delta_end),
+            .size = (out - segment + 7) / 8 * 8,
+        };
+
+        /* A segment cut short by a crash is dropped before appending */
+        struct stat st;
+        if (fstat(index->fd, &st) == 0 && (size_t) st.st_size > index->walked
+            && ftruncate(index->fd, index->walked) == -1)
+            utils_error("history index: ");
+        if (write(index->fd, segment, h->size) != (ssize_t) h->size)
+            utils_error("history index: ");
+        free(segment);
+        walk(index);
+    }
+    flock(index->fd, LOCK_UN);
+}
+
+/* Open the index of the log at log_path */
+struct histindex *
+histindex_open(const char *log_path)
+{
+    struct histindex *index = calloc(1, sizeof *index);
+    struct stat st;
+    size_t len = strlen(log_path);
+    char path[len + sizeof ".idx"];
+    memcpy(path, log_path, len);
+    strcpy(path + len, ".idx");
+
+    index->log_fd = open(log_path, O_RDONLY | O_CLOEXEC);
+    index->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (index->log_fd == -1 || index->fd == -1 || fstat(index->log_fd, &st) == -1) {
+        utils_error("%s: ", index->log_fd == -1 ? log_path : path);
+        if (index->log_fd != -1)
+            close(index->log_fd);
+        if (index->fd != -1)
+            close(index->fd);
+        free(index);
+        return NULL;
+    }
+
+    index->log_ino = st.st_ino;
+    walk(index);
+    clear_delta(index);
+    return index;
+}
+
+/* Index the lines of the log after delta_end that end before end */
+static void
+index_lines(struct histindex *index, uint64_t end)
+{
+    static char buf[1 << 20];
+
+    while (index->delta_end < end) {
+        size_t want = end - index->delta_end < sizeof buf ? end - index->delta_end : sizeof buf;
+        ssize_t n = pread(index->log_fd, buf, want, index->delta_end);
+        if (n <= 0)
+            break;
+
+        /* Lines are indexed once their newline has been written; one
+         * longer than the buffer is passed over */
+        char *last = memrchr(buf, '\n', n);
+        if (last == NULL) {
+            if ((size_t) n < sizeof buf || want < sizeof buf)
+                break;
+            last = buf + n - 1;
+        }
+        for (char *line = buf; line <= last; ) {
+            char *end = memchr(line, '\n', last + 1 - line);
+            if (end == NULL)
+                end = last;
+            index_line(index, (unsigned char *) line, end - line,
+                       index->delta_end + (line - buf) - index->delta_start);
+            line = end + 1;
+        }
+        index->delta_end += last + 1 - buf;
+
+        if (index->num_postings >= HISTINDEX_FLUSH)
+            flush(index);
+    }
+}
+
+/* Index the lines appended to the log since the last update */
+void
+histindex_update(struct histindex *index)
+{
+    walk(index);
+    index_lines(index, UINT64_MAX);
+}
+
+/* Return the end of the last complete line of the log */
+static uint64_t
+log_end(struct histindex *index)
+{
+    struct stat st;
+    if (fstat(index->log_fd, &st) == -1)
+        return index->delta_end;
+    remap(&index->log_map, &index->log_mapped, index->log_fd, st.st_size);
+    if (index->log_map == NULL || (uint64_t) st.st_size <= index->delta_end)
+        return index->delta_end;
+
+    const char *text = index->log_map + index->delta_end;
+    const char *last = memrchr(text, '\n', st.st_size - index->delta_end);
+    return last != NULL ? (uint64_t) (last + 1 - index->log_map) : index->delta_end;
+}
+
+/* Index the lines of the log that no segment covers yet */
+void
+histindex_build(struct histindex *index, bool background)
+{
+    walk(index);
+    uint64_t end = log_end(index);
+    if (!background || end - index->delta_end <= HISTINDEX_BACKGROUND
+        || index->delta_end != index->delta_start) {
+        index_lines(index, end);
+        return;
+    }
+
+    /* The grandchild is not the caller's child, and is left running in
+     * a session of its own, where Ctrl-C and hangups do not reach it */
+    pid_t child = fork();
+    if (child == 0) {
+        if (fork() == 0) {
+            setsid();
+            int null = open("/dev/null", O_RDWR);
+            for (int fd = 0; fd < 3 && null != -1; fd++)
+                dup2(null, fd);
+            index_lines(index, end);
+            flush(index);
+        }
+        _exit(0);
+    }
+    if (child == -1) {
+        utils_error("history index: fork: ");
+        index_lines(index, end);
+        return;
+    }
+    waitpid(child, NULL, 0);
+    index->delta_start = index->delta_end = end;
+}
+
+/* Report every line of the log between start and end that contains
+ * pattern, by scanning */
+static size_t
+scan(struct histindex *index, const char *pattern, size_t len, uint64_t start,
+     uint64_t end, void (*found)(const char *, size_t, void *), void *ctx)
+{
+    size_t matches = 0;
+    const char *text = index->log_map;
+    while (start < end) {
+        const char *hit = memmem(text + start, end - start, pattern, len);
+        if (hit == NULL)
+            break;
+        const char *line = memrchr(text + start, '\n', hit - (text + start));
+        line = line != NULL ? line + 1 : text + start;
+        const char *eol = memchr(hit, '\n', text + end - hit);
+        eol = eol != NULL ? eol : text + end;
+        found(line, eol - line, ctx);
+        matches++;
+        start = eol - text + 1;
+    }
+    return matches;
+}
+
+/* Find the entry of trigram in segment h, or return NULL if no line of
+ * the segment contains it */
+static const struct segment_entry *
+segment_entry(const struct segment_header *h, uint32_t trigram)
+{
+    const struct segment_entry *table = (const void *) (h + 1);
+    size_t lo = 0, hi = h->num_trigrams;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (table[mid].trigram < trigram)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < h->num_trigrams && table[lo].trigram == trigram ? &table[lo] : NULL;
+}
+
+/* Decode the list of lines of entry e of segment h */
+static uint32_t *
+segment_lines(const struct segment_header *h, const struct segment_entry *e)
+{
+    const unsigned char *in = (const unsigned char *) h + e->offset;
+    uint32_t *lines = malloc(e->count * sizeof *lines);
+    for (uint32_t k = 0, last = 0; k < e->count; k++) {
+        uint32_t delta = 0;
+        for (int shift = 0; ; shift += 7) {
+            delta |= (uint32_t) (*in & 0x7f) << shift;
+            if (!(*in++ & 0x80))
+                break;
+        }
+        lines[k] = last += delta;
+    }
+    return lines;
+}
+
+/* Order segment entries by the length of their lists */
+static int
+compare_entries(const void *a, const void *b)
+{
+    const struct segment_entry *e = *(const struct segment_entry * const *) a;
+    const struct segment_entry *f = *(const struct segment_entry * const *) b;
+    return e->count < f->count ? -1 : e->count > f->count;
+}
+
+/* Intersect the n increasing lists into the first, smallest one, and
+ * return the length of the result */
+static uint32_t
+intersect(uint32_t **lists, uint32_t *counts, int n)
+{
+    for (int i = 1; i < n; i++) {
+        if (counts[i] < counts[0]) {
+            uint32_t *l = lists[0], c = counts[0];
+            lists[0] = lists[i], counts[0] = counts[i];
+            lists[i] = l, counts[i] = c;
+        }
+    }
+
+    uint32_t count = counts[0];
+    for (int i = 1; i < n && count > 0; i++) {
+        uint32_t kept = 0;
+        for (uint32_t a = 0, b = 0; a < count && b < counts[i]; ) {
+            if (lists[0][a] < lists[i][b])
+                a++;
+            else if (lists[0][a] > lists[i][b])
+                b++;
+            else
+                lists[0][kept++] = lists[0][a++], b++;
+        }
+        count = kept;
+    }
+    return count;
+}
+
+/* Report the lines at the given offsets from base that contain pattern */
+static size_t
+verify(struct histindex *index, const char *pattern, size_t len, uint64_t base,
+       const uint32_t *lines, uint32_t count,
+       void (*found)(const char *, size_t, void *), void *ctx)
+{
+    size_t matches = 0;
+    for (uint32_t k = 0; k < count; k++) {
+        const char *line = index->log_map + base + lines[k];
+        const char *eol = memchr(line, '\n', index->delta_end - (base + lines[k]));
+        size_t line_len = eol != NULL ? (size_t) (eol - line) : 0;
+        if (memmem(line, line_len, pattern, len) != NULL) {
+            found(line, line_len, ctx);
+            matches++;
+        }
+    }
+    return matches;
+}
+
+/* Report every line of the log that contains pattern */
+size_t
+histindex_search(struct histindex *index, const char *pattern,
+                 void (*found)(const char *line, size_t len, void *ctx),
+                 void *ctx)
+{
+    histindex_update(index);
+    remap(&index->log_map, &index->log_mapped, index->log_fd, index->delta_end);
+    if (index->log_map == NULL)
+        return 0;
+
+    size_t len = strlen(pattern);
+    if (len < 3)
+        return scan(index, pattern, len, 0, index->delta_end, found, ctx);
+
+    /* The distinct trigrams of the pattern */
+    int n = 0;
+    uint32_t trigrams[len - 2];
+    for (size_t i = 0; i + 3 <= len; i++) {
+        const unsigned char *p = (const unsigned char *) pattern + i;
+        uint32_t trigram = p[0] << 16 | p[1] << 8 | p[2];
+        int k = 0;
+        while (k < n && trigrams[k] != trigram)
+            k++;
+        if (k == n)
+            trigrams[n++] = trigram;
+    }
+
+    /* In a segment, the lists are decoded from the shortest, and only
+     * while the next one is not much longer than the lines left: those
+     * are cheaper to check than a long list is to decode */
+    uint32_t *lists[n], counts[n];
+    const struct segment_entry *entries[n];
+    size_t matches = 0;
+    for (int s = 0; s < index->num_segments; s++) {
+        const struct segment_header *h = (const void *) (index->map + index->segments[s]);
+        int got = 0;
+        while (got < n && (entries[got] = segment_entry(h, trigrams[got])) != NULL)
+            got++;
+        if (got < n)
+            continue;
+        qsort(entries, n, sizeof *entries, compare_entries);
+
+        lists[0] = segment_lines(h, entries[0]);
+        counts[0] = entries[0]->count;
+        for (int k = 1; k < n && entries[k]->count / 16 < counts[0]; k++) {
+            lists[1] = segment_lines(h, entries[k]);
+            counts[1] = entries[k]->count;
+            counts[0] = intersect(lists, counts, 2);
+            free(lists[1]);
+        }
+        matches += verify(index, pattern, len, h->log_start, lists[0], counts[0], found, ctx);
+        free(lists[0]);
+    }
+
+    /* The backlog that another process is indexing */
+    matches += scan(index, pattern, len, index->covered, index->delta_start, found, ctx);
+
+    /* The lines indexed in memory.  Their lists are used in place,
+     * except for the smallest one, which receives the result. */
+    int got = 0, smallest = 0;
+    struct postings *p;
+    while (got < n && (p = lookup(index, trigrams[got], false)) != NULL) {
+        lists[got] = p->lines;
+        counts[got] = p->count;
+        if (counts[got] < counts[smallest])
+            smallest = got;
+        got++;
+    }
+    if (got == n) {
+        uint32_t first_count = counts[smallest];
+        uint32_t *first = malloc((first_count + 1) * sizeof *first);
+        memcpy(first, lists[smallest], first_count * sizeof *first);
+        lists[smallest] = lists[0];
+        counts[smallest] = counts[0];
+        lists[0] = first;
+        counts[0] = first_count;
+        uint32_t count = intersect(lists, counts, n);
+        matches += verify(index, pattern, len, index->delta_start, lists[0], count, found, ctx);
+        free(lists[0]);
+    }
+    return matches;
+}
+
+/* Save the lines indexed in memory and close the index */
+void
+histindex_close(struct histindex *index)
+{
+    flush(index);
+    clear_delta(index);
+    free(index->table);
+    free(index->segments);
+    if (index->map != NULL)
+        munmap((void *) index->map, index->mapped);
+    if (index->log_map != NULL)
+        munmap((void *) index->log_map, index->log_mapped);
+    close(index->fd);
+    close(index->log_fd);
+    free(index);
+}
@@ -0,0 +1,62 @@
+#ifndef __HISTINDEX_H
+#define __HISTINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A trigram index over the lines of a history log (see histlog.h),
+ * for substring searches that do not scan the whole log.
+ *
+ * The index maps each sequence of three bytes to the offsets of the
+ * log lines that contain it.  It is kept in <log>.idx as a series of
+ * immutable segments, each covering the next range of the log; a
+ * session appends a segment for the lines it indexed whenever it has
+ * indexed HISTINDEX_FLUSH offsets, and when it closes the index.
+ * Lines not covered by a segment yet are read from the log and
+ * indexed in memory, so the lines of a session that ended without
+ * closing the index are indexed again by the next one.  Segments are
+ * appended under flock(2), so concurrent sessions never index the
+ * same range twice.  Segments that do not match the log, as when it
+ * was replaced or rewritten, are ignored.
+ *
+ * A search looks up the pattern's trigrams in every segment and
+ * intersects their lists of lines, then checks each remaining line
+ * for the pattern.  Patterns shorter than three bytes are found by
+ * scanning the log.
+ */
+#define HISTINDEX_FLUSH (8 << 20)
+
+/* Bytes of unindexed log above which histindex_build indexes them in
+ * the background */
+#define HISTINDEX_BACKGROUND (1 << 20)
+
+struct histindex;
+
+/* Open the index of the log at log_path, creating it if needed.
+ * Returns NULL after printing an error. */
+struct histindex *histindex_open(const char *log_path);
+
+/* Index the lines of the log that no segment covers.  If background
+ * is true and there are more than HISTINDEX_BACKGROUND bytes of them,
+ * as for a log that was never indexed, a detached process indexes them
+ * and appends their segments, while this index goes on with the lines
+ * appended after them; until the segments have arrived, searches scan
+ * those lines.  Forks a child that it reaps itself, so a SIGCHLD
+ * handler that reaps all children must be blocked. */
+void histindex_build(struct histindex *index, bool background);
+
+/* Index the lines appended to the log since the last update */
+void histindex_update(struct histindex *index);
+
+/* Call found for every line of the log that contains pattern, oldest
+ * first.  The line is not NUL-terminated.  Returns the number of
+ * matching lines. */
+size_t histindex_search(struct histindex *index, const char *pattern,
+                        void (*found)(const char *line, size_t len, void *ctx),
+                        void *ctx);
+
+/* Save the lines indexed in memory as a segment, and close the index */
+void histindex_close(struct histindex *index);
+
+#endif /* __HISTINDEX_H */
@@ -0,0 +1,127 @@
+/*
+ * An append-only history log, mapped and indexed from its end.
+ */
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "histlog.h"
+#include "utils.h"
+
+struct histlog {
+    int fd;                     /* Opened with O_APPEND */
+    const char *map;            /* The log as of opening, or NULL if empty */
+    size_t size;                /* Bytes mapped */
+    size_t end;                 /* End of the last complete line */
+    size_t *starts;             /* Start of each indexed line, newest first */
+    size_t count, capacity;
+    size_t scanned;             /* Lines that start at or after this offset
+                                   have all been indexed */
+    bool unfinished;            /* The log ends in an unfinished record */
+};
+
+/* Open or create the log at path */
+struct histlog *
+histlog_open(const char *path)
+{
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        utils_error("%s: ", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        utils_error("%s: ", path);
+        close(fd);
+        return NULL;
+    }
+
+    struct histlog *log = calloc(1, sizeof *log);
+    log->fd = fd;
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            utils_error("%s: ", path);
+        } else {
+            log->map = map;
+            log->size = st.st_size;
+        }
+    }
+
+    /* A record is complete once its newline is written */
+    const char *nl = log->size > 0 ? memrchr(log->map, '\n', log->size) : NULL;
+    log->end = nl != NULL ? nl - log->map + 1 : 0;
+    log->scanned = log->end;
+    log->unfinished = log->end < log->size;
+    return log;
+}
+
+/* Index the last n lines of the mapping */
+size_t
+histlog_tail(struct histlog *log, size_t n)
+{
+    while (log->count < n && log->scanned > 0) {
+        /* The line that ends at scanned - 1 starts after the previous
+         * newline, or at the start of the file */
+        const char *nl = log->scanned > 1
+                       ? memrchr(log->map, '\n', log->scanned - 1) : NULL;
+        size_t start = nl != NULL ? nl - log->map + 1 : 0;
+
+        if (log->count == log->capacity) {
+            log->capacity = log->capacity ? 2 * log->capacity : 256;
+            log->starts = realloc(log->starts, log->capacity * sizeof *log->starts);
+        }
+        log->starts[log->count++] = start;
+        log->scanned = start;
+    }
+    return log->count < n ? log->count : n;
+}
+
+/* Return line k, counting back from the newest */
+const char *
+histlog_line(struct histlog *log, size_t k, size_t *len)
+{
+    size_t end = k == 0 ? log->end : log->starts[k - 1];
+    *len = end - log->starts[k] - 1;
+    return log->map + log->starts[k];
+}
+
+/* Append a line with a single write */
+int
+histlog_append(struct histlog *log, const char *line)
+{
+    /* An unfinished record is ended, so that it is not joined with
+     * this one */
+    size_t skip = log->unfinished ? 1 : 0;
+    size_t len = skip + strlen(line) + 1;
+    char *record = malloc(len);
+    record[0] = '\n';
+    memcpy(record + skip, line, len - skip - 1);
+    record[len - 1] = '\n';
+
+    ssize_t n;
+    while ((n = write(log->fd, record, len)) == -1 && errno == EINTR)
+        ;
+    free(record);
+    if (n != (ssize_t) len)
+        return -1;
+    log->unfinished = false;
+    return 0;
+}
+
+/* Unmap and close the log */
+void
+histlog_close(struct histlog *log)
+{
+    if (log->map != NULL)
+        munmap((void *) log->map, log->size);
+    close(log->fd);
+    free(log->starts);
+    free(log);
+}
@@ -0,0 +1,43 @@
+#ifndef __HISTLOG_H
+#define __HISTLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A persistent history log shared by concurrent sessions.
+ *
+ * The log is a file of command lines, one per line.  Each session
+ * appends its lines with a single write to a descriptor opened with
+ * O_APPEND, so records of concurrent sessions never interleave.  An
+ * unfinished last record, as left by a crash, is not loaded; the next
+ * append ends it first.
+ *
+ * At startup the log is mapped, not read, and its lines are indexed
+ * backwards from the end only as far as they are asked for, so the
+ * cost of opening it does not depend on its size.  Lines appended
+ * after it was opened are not part of the mapping.
+ */
+struct histlog;
+
+/* Open or create the log at path.  Returns NULL after printing an
+ * error. */
+struct histlog *histlog_open(const char *path);
+
+/* Index the last n lines of the mapping if needed, and return how
+ * many of them exist */
+size_t histlog_tail(struct histlog *log, size_t n);
+
+/* Return line k of the mapping, counting back from the newest line
+ * as 0, and store its length in *len.  k must be below the count
+ * returned by histlog_tail.  The line is not NUL-terminated and may
+ * be empty. */
+const char *histlog_line(struct histlog *log, size_t k, size_t *len);
+
+/* Append a line to the log.  Returns 0, or -1 if the write fails. */
+int histlog_append(struct histlog *log, const char *line);
+
+/* Unmap and close the log */
+void histlog_close(struct histlog *log);
+
+#endif /* __HISTLOG_H */
@@ -0,0 +1,102 @@
+#!/usr/bin/python
+#
+# history_index_test: tests history -s, which searches the whole
+# history log named by HISTFILE through its trigram index.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+import tempfile
+
+# a log much longer than the part loaded at startup, and large enough
+# to be indexed in the background
+fd, histfile = tempfile.mkstemp("-cush-history-index")
+with os.fdopen(fd, "w") as f:
+    f.write("expr 20 + 22\n")
+    for i in range(20000):
+        f.write("echo entry-%d\n" % i)
+    f.write("make needle-early\n")
+    for i in range(20000, 80000):
+        f.write("echo entry-%d\n" % i)
+
+def cleanup():
+    for path in [histfile, histfile + ".idx"]:
+        if os.path.exists(path):
+            os.unlink(path)
+
+atexit.register(cleanup)
+
+# the shell inherits HISTFILE from the environment
+os.environ["HISTFILE"] = histfile
+
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+start = time.time()
+expect_prompt()
+assert time.time() - start < 1, "shell indexed the log before the prompt"
+
+# lines far older than the loaded ones are found
+sendline("history -s needle-early")
+expect_exact("make needle-early\r\n", "old line was not found")
+expect_prompt()
+
+# all matches are printed, oldest first
+sendline("history -s entry-1234")
+expect_exact("echo entry-1234\r\necho entry-12340\r\n", "matches are missing or out of order")
+expect_exact("echo entry-12349\r\n", "last match is missing")
+expect_prompt()
+
+# patterns shorter than a trigram are searched too
+sendline("history -s y-7")
+expect_exact("echo entry-7\r\necho entry-70\r\n", "short pattern was not found")
+expect_prompt()
+
+# lines added in this session are indexed, and the search line itself
+# matches
+sendline("echo needle-late")
+expect_exact("needle-late\r\n")
+expect_prompt()
+sendline("history -s needle-")
+expect_exact("make needle-early\r\n", "old line was not found after new lines")
+expect_exact("echo needle-late\r\n", "new line was not indexed")
+expect_exact("history -s needle-\r\n", "search line was not indexed")
+expect_prompt()
+
+sendline("history -s")
+expect_exact("usage: history", "missing pattern was not reported")
+expect_prompt()
+
+# !string and !?string? find lines older than the loaded ones
+sendline("!expr")
+expect_exact("42\r\n", "!string did not find an old line of the log")
+expect_prompt()
+sendline("echo !?ke needle-e?")
+expect_exact("make needle-early\r\n", "!?string? did not find an old line of the log")
+expect_prompt()
+
+# the lines found are not left in the history list
+sendline("history 3")
+expect_exact("expr 20 + 22\r\n", "expanded line was not recorded")
+expect_exact("echo make needle-early\r\n", "expanded line was not recorded")
+expect_prompt()
+assert "echo entry" not in console.before, "history list was changed"
+
+# the log is indexed in the background while the shell runs
+for i in range(50):
+    if os.path.getsize(histfile + ".idx") > 0:
+        break
+    time.sleep(0.1)
+assert os.path.getsize(histfile + ".idx") > 0, "log was not indexed in the background"
+sendline("history -s needle-early")
+expect_exact("make needle-early\r\n", "old line was not found in the saved index")
+expect_prompt()
+
+sendline("exit")
+expect(pexpect.EOF)
+
+# the index is saved next to the log
+assert os.path.getsize(histfile + ".idx") > 0, "index was not saved"
+
+test_success()
@@ -0,0 +1,56 @@
+#!/usr/bin/python
+#
+# history_log_test: tests the persistent history log named by HISTFILE,
+# whose newest lines are loaded at startup and to which every command
+# line is appended.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+import tempfile
+
+# a log left by earlier sessions, ending in an unfinished record
+fd, histfile = tempfile.mkstemp("-cush-history-log")
+with os.fdopen(fd, "w") as f:
+    for i in range(5000):
+        f.write("echo old-%d\n" % i)
+    f.write("echo torn")
+
+def cleanup():
+    os.unlink(histfile)
+
+atexit.register(cleanup)
+
+# the shell inherits HISTFILE from the environment
+os.environ["HISTFILE"] = histfile
+
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# only the newest 1000 complete lines are loaded
+sendline("history")
+expect_exact("    1  echo old-4000\r\n", "newest lines of the log were not loaded")
+expect_exact(" 1000  echo old-4999\r\n", "last complete line was not loaded")
+expect_exact(" 1001  history\r\n", "new line does not follow the loaded ones")
+expect_prompt()
+assert "torn" not in console.before, "unfinished record was loaded"
+
+# loaded lines are available to history expansion
+sendline("!?old-4998")
+expect_exact("old-4998\r\n", "loaded line was not found by expansion")
+expect_prompt()
+
+sendline("echo new-entry")
+expect_exact("new-entry\r\n")
+expect_prompt()
+
+# every line is appended to the log, after the unfinished record
+with open(histfile) as f:
+    lines = f.read().split("\n")
+assert lines[5000:] == ["echo torn", "history", "echo old-4998", "echo new-entry", ""], \
+    "log has the wrong tail: %s" % lines[5000:]
+
+test_success()
@@ -0,0 +1,60 @@
+#!/usr/bin/python
+#
+# history_range_test: tests history N, history -r A..B, and history -c,
+# and the histsize option that bounds the history list.
+#
+
+import sys, os, re, atexit, pexpect, proc_check, signal, time, threading
+
+# the history list starts empty
+os.environ.pop("HISTFILE", None)
+
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+for word in ["one", "two", "three"]:
+    sendline("echo %s" % word)
+    expect_exact("%s\r\n" % word)
+    expect_prompt()
+
+# runs a history command and returns the entries it printed
+def entries(command):
+    sendline(command)
+    expect_exact(command + "\r\n")
+    expect_prompt()
+    return "".join(line + "\n" for line in re.findall(r" *\d+  [^\r\n]*", console.before))
+
+# the last N entries, including the history command itself
+assert entries("history 2") == "    3  echo three\n    4  history 2\n", \
+    "last entries were not printed"
+
+# a range of entry numbers; either bound may be left out
+assert entries("history -r 2..3") == "    2  echo two\n    3  echo three\n", \
+    "range was not printed"
+assert entries("history -r ..1") == "    1  echo one\n", \
+    "range without a start was not printed"
+assert entries("history -r 6..") == "    6  history -r ..1\n    7  history -r 6..\n", \
+    "range without an end was not printed"
+
+sendline("history -r 5")
+expect_exact("usage: history", "invalid range was accepted")
+expect_prompt()
+
+# entries over histsize are dropped, oldest first, and keep their numbers
+sendline("set -o histsize=3")
+expect_prompt()
+sendline("echo four")
+expect_prompt()
+assert entries("history") == "    9  set -o histsize=3\n   10  echo four\n   11  history\n", \
+    "history list was not bounded"
+
+# -c clears the list
+sendline("history -c")
+expect_prompt()
+assert entries("history") == "    1  history\n", "history list was not cleared"
+
+test_success()
@@ -0,0 +1,151 @@
+/*
+ * Block-buffered line reader for non-interactive input.
+ *
+ * Reads input in large chunks and hands out lines that are
+ * NUL-terminated in place, so that scripts are processed without
+ * a read system call or a copy per line.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "line_reader.h"
+#include "utils.h"
+
+#define LINE_READER_BLOCK (64 * 1024)   /* Initial buffer and read size */
+
+/* Initialize a reader that reads lines from file descriptor fd */
+void
+line_reader_init_fd(struct line_reader *reader, int fd)
+{
+    reader->fd = fd;
+    reader->capacity = LINE_READER_BLOCK;
+    reader->buf = malloc(reader->capacity);
+    reader->start = reader->end = 0;
+    reader->eof = false;
+    reader->shared = false;
+    reader->seekable = false;
+}
+
+/* Initialize a reader for fd, which commands read as well */
+void
+line_reader_init_shared(struct line_reader *reader, int fd)
+{
+    line_reader_init_fd(reader, fd);
+    reader->shared = true;
+    reader->seekable = lseek(fd, 0, SEEK_CUR) != -1;
+}
+
+/* Initialize a reader that returns the lines contained in string s */
+void
+line_reader_init_string(struct line_reader *reader, const char *s)
+{
+    size_t len = strlen(s);
+
+    reader->fd = -1;
+    reader->capacity = len + 1;
+    reader->buf = malloc(reader->capacity);
+    memcpy(reader->buf, s, len);
+    reader->start = 0;
+    reader->end = len;
+    reader->eof = true;
+    reader->shared = false;
+    reader->seekable = false;
+}
+
+/* Read the next block of input, moving any partial line to the front
+ * of the buffer first and growing the buffer if the partial line
+ * fills it.  One byte is always kept free for a terminating NUL. */
+static void
+fill_buffer(struct line_reader *reader)
+{
+    if (reader->start > 0) {
+        memmove(reader->buf, reader->buf + reader->start,
+                reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    if (reader->end + 1 >= reader->capacity) {
+        reader->capacity *= 2;
+        reader->buf = realloc(reader->buf, reader->capacity);
+    }
+
+    /* Read-ahead on a shared pipe could not be given back */
+    size_t size = reader->shared && !reader->seekable
+                  ? 1 : reader->capacity - reader->end - 1;
+    ssize_t n;
+    do {
+        n = read(reader->fd, reader->buf + reader->end, size);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1)
+        utils_error("read failed: ");
+
+    if (n <= 0)
+        reader->eof = true;
+    else
+        reader->end += n;
+}
+
+/* Return the next line without its trailing newline, or NULL at end
+ * of input.  The line is only valid until the next call. */
+char *
+line_reader_next(struct line_reader *reader)
+{
+    for (;;) {
+        char *line = reader->buf + reader->start;
+        char *nl = memchr(line, '\n', reader->end - reader->start);
+        if (nl != NULL) {
+            *nl = '\0';
+            reader->start = nl - reader->buf + 1;
+            return line;
+        }
+
+        if (reader->eof) {
+            /* Final line lacks a newline; fill_buffer and
+             * line_reader_init_string leave room for the NUL. */
+            if (reader->start == reader->end)
+                return NULL;
+
+            reader->buf[reader->end] = '\0';
+            reader->start = reader->end;
+            return line;
+        }
+
+        fill_buffer(reader);
+    }
+}
+
+/* Give back the input read past the last line returned */
+void
+line_reader_sync(struct line_reader *reader)
+{
+    if (!reader->shared || !reader->seekable || reader->start == reader->end)
+        return;
+
+    off_t ahead = reader->end - reader->start;
+    if (lseek(reader->fd, -ahead, SEEK_CUR) != -1) {
+        reader->end = reader->start;
+        reader->eof = false;
+    }
+}
+
+/* Return true if no further lines remain */
+bool
+line_reader_at_eof(struct line_reader *reader)
+{
+    while (reader->start == reader->end && !reader->eof)
+        fill_buffer(reader);
+
+    return reader->start == reader->end;
+}
+
+/* Release the reader's buffer */
+void
+line_reader_destroy(struct line_reader *reader)
+{
+    free(reader->buf);
+    reader->buf = NULL;
+}
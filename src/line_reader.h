@@ -0,0 +1,56 @@
+#ifndef __LINE_READER_H
+#define __LINE_READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A block-buffered line reader used when the shell is not reading
+ * from a terminal (scripts, -c strings, and piped stdin).
+ * Input is read in large chunks and split into lines in place,
+ * avoiding readline's per-character terminal handling.
+ *
+ * A script read from the shell's standard input shares it with the
+ * commands it runs, which must start reading after the script's
+ * current line.  Input read past that line is given back with
+ * line_reader_sync if the descriptor is seekable; a pipe is read a
+ * byte at a time, so that nothing past the line is taken from it.
+ */
+struct line_reader {
+    int fd;                 /* Descriptor to read from, -1 if reading
+                               from a fixed string */
+    char *buf;              /* Buffered input */
+    size_t capacity;        /* Allocated size of buf */
+    size_t start;           /* Offset of first unconsumed byte */
+    size_t end;             /* Offset one past the last valid byte */
+    bool eof;               /* True once fd has reported end of file */
+    bool shared;            /* fd is also the commands' standard input */
+    bool seekable;          /* Read-ahead on fd can be given back */
+};
+
+/* Initialize a reader that reads lines from file descriptor fd */
+void line_reader_init_fd(struct line_reader *reader, int fd);
+
+/* Initialize a reader that reads lines from fd, which the commands
+ * run between lines read as well */
+void line_reader_init_shared(struct line_reader *reader, int fd);
+
+/* Initialize a reader that returns the lines contained in string s */
+void line_reader_init_string(struct line_reader *reader, const char *s);
+
+/* Return the next line without its trailing newline, or NULL at end
+ * of input.  The line is stored in the reader's buffer and remains
+ * valid only until the next call. */
+char *line_reader_next(struct line_reader *reader);
+
+/* Give back the input read past the last line returned, so that a
+ * command reading the shared descriptor starts right after it */
+void line_reader_sync(struct line_reader *reader);
+
+/* Return true if no further lines remain */
+bool line_reader_at_eof(struct line_reader *reader);
+
+/* Release the reader's buffer.  Does not close the file descriptor. */
+void line_reader_destroy(struct line_reader *reader);
+
+#endif /* __LINE_READER_H */
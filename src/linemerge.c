@@ -0,0 +1,259 @@
+/*
+ * Merging the output of background jobs line by line.
+ */
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "linemerge.h"
+#include "ringbuf.h"
+#include "utils.h"
+
+struct linemerge_source {
+    struct linemerge_source *next;
+    int fd;                 /* Read end of the job's pipe; -1 at end of file */
+    bool released;          /* The job has ended */
+    bool print;             /* Lines are printed */
+    struct ringbuf *ring;   /* If not NULL, everything read is copied here */
+    char prefix[16];        /* "[jid] " */
+    size_t len;             /* Bytes in buf */
+    char buf[LINEMERGE_BUFFER];
+};
+
+static struct linemerge_source *sources;
+
+/* Create a pipe for the output of job jid */
+struct linemerge_source *
+linemerge_open(int jid, struct ringbuf *ring, bool print, int *write_fd)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        utils_error("pipe: ");
+        return NULL;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    struct linemerge_source *source = malloc(sizeof *source);
+    source->fd = fds[0];
+    source->released = false;
+    source->print = print;
+    source->ring = ring;
+    snprintf(source->prefix, sizeof source->prefix, "[%d] ", jid);
+    source->len = 0;
+    source->next = sources;
+    sources = source;
+
+    *write_fd = fds[1];
+    return source;
+}
+
+/* Read what is available from the source's pipe into its buffer.
+ * Returns true if anything was read. */
+static bool
+read_source(struct linemerge_source *source)
+{
+    if (source->len == sizeof source->buf)
+        return false;
+
+    ssize_t n = read(source->fd, source->buf + source->len,
+                     sizeof source->buf - source->len);
+    if (n > 0) {
+        if (source->ring)
+            ringbuf_append(source->ring, source->buf + source->len, n);
+        if (source->print)
+            source->len += n;
+        return true;
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        close(source->fd);
+        source->fd = -1;
+    }
+    return false;
+}
+
+/* True if the source has a line to print: a complete line, a full
+ * buffer, or the unfinished line of an ended job */
+static bool
+has_line(struct linemerge_source *source)
+{
+    return source->len > 0
+        && (source->len == sizeof source->buf || source->fd == -1
+            || source->released || memchr(source->buf, '\n', source->len));
+}
+
+/* Write all of iov to fd, continuing after short writes */
+static void
+write_lines(int fd, struct iovec *iov, int n)
+{
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w == -1 && errno == EINTR)
+            continue;
+        if (w == -1)
+            return;
+        for (; n > 0 && (size_t) w >= iov->iov_len; iov++, n--)
+            w -= iov->iov_len;
+        if (n > 0) {
+            iov->iov_base = (char *) iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+}
+
+/* Print the source's complete lines, each after its prefix.  A full
+ * buffer or the rest of an ended job is printed as a line of its own. */
+static void
+print_lines(struct linemerge_source *source, int out_fd)
+{
+    static char newline[] = "\n";
+    struct iovec iov[IOV_MAX];
+    int n = 0;
+    size_t start = 0;
+
+    while (start < source->len) {
+        char *nl = memchr(source->buf + start, '\n', source->len - start);
+        size_t end = nl ? (size_t) (nl - source->buf) + 1 : source->len;
+        if (!nl && source->len < sizeof source->buf
+            && source->fd != -1 && !source->released)
+            break;
+
+        if (n + 3 > IOV_MAX) {
+            write_lines(out_fd, iov, n);
+            n = 0;
+        }
+        iov[n++] = (struct iovec) { source->prefix, strlen(source->prefix) };
+        iov[n++] = (struct iovec) { source->buf + start, end - start };
+        if (!nl)
+            iov[n++] = (struct iovec) { newline, 1 };
+        start = end;
+    }
+    write_lines(out_fd, iov, n);
+
+    source->len -= start;
+    memmove(source->buf, source->buf + start, source->len);
+}
+
+/* Free the sources of ended jobs whose pipes are closed */
+static void
+free_closed_sources(void)
+{
+    for (struct linemerge_source **p = &sources; *p != NULL; ) {
+        struct linemerge_source *source = *p;
+        if (source->fd == -1 && source->released && source->len == 0) {
+            *p = source->next;
+            free(source);
+        } else {
+            p = &source->next;
+        }
+    }
+}
+
+/* Print the rest of an ended job's output */
+void
+linemerge_release(struct linemerge_source *source, int out_fd)
+{
+    while (source->fd != -1 && read_source(source)) {
+        if (has_line(source))
+            print_lines(source, out_fd);
+    }
+    source->released = true;
+    source->ring = NULL;
+    print_lines(source, out_fd);
+    free_closed_sources();
+}
+
+/* Close and forget the parent's sources */
+void
+linemerge_reset(void)
+{
+    while (sources != NULL) {
+        struct linemerge_source *source = sources;
+        sources = source->next;
+        if (source->fd != -1)
+            close(source->fd);
+        free(source);
+    }
+}
+
+/* Return true if any source's pipe is open */
+bool
+linemerge_active(void)
+{
+    for (struct linemerge_source *source = sources; source != NULL; source = source->next) {
+        if (source->fd != -1)
+            return true;
+    }
+    return false;
+}
+
+/* Wait until fd is readable, printing merged lines meanwhile */
+int
+linemerge_wait(int fd, int timeout, const sigset_t *wait_mask,
+               int out_fd, void (*hide)(void), void (*show)(void))
+{
+    static struct pollfd *fds;
+    static int capacity;
+    struct timespec now, deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += timeout % 1000 * 1000000L;
+
+    for (;;) {
+        int n = 1;
+        for (struct linemerge_source *s = sources; s != NULL; s = s->next)
+            n++;
+        if (n > capacity)
+            fds = realloc(fds, (capacity = 2 * n) * sizeof *fds);
+
+        /* Sources are polled in list order, after fd */
+        n = 0;
+        fds[n++] = (struct pollfd) { .fd = fd, .events = POLLIN };
+        for (struct linemerge_source *s = sources; s != NULL; s = s->next)
+            fds[n++] = (struct pollfd) { .fd = s->fd, .events = POLLIN };
+
+        struct timespec wait = { 0, 0 };
+        if (timeout >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long ms = (deadline.tv_sec - now.tv_sec) * 1000
+                    + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+            if (ms > 0)
+                wait = (struct timespec) { ms / 1000, ms % 1000 * 1000000L };
+        }
+
+        int ready_fds = ppoll(fds, n, timeout >= 0 ? &wait : NULL, wait_mask);
+        if (ready_fds == -1)
+            return -1;
+
+        bool ready = false;
+        n = 1;
+        for (struct linemerge_source *s = sources; s != NULL; s = s->next) {
+            if (fds[n++].revents != 0)
+                read_source(s);
+            ready |= has_line(s);
+        }
+        if (ready) {
+            if (hide)
+                hide();
+            for (struct linemerge_source *s = sources; s != NULL; s = s->next) {
+                if (has_line(s))
+                    print_lines(s, out_fd);
+            }
+            if (show)
+                show();
+        }
+        free_closed_sources();
+        if (fds[0].revents != 0)
+            return 1;
+        if (ready_fds == 0)
+            return 0;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef __LINEMERGE_H
+#define __LINEMERGE_H
+
+#include <signal.h>
+#include <stdbool.h>
+
+struct ringbuf;
+
+/*
+ * Merging the output of concurrent background jobs into the terminal
+ * a line at a time.
+ *
+ * Each job writes into its own pipe, whose read end the shell polls
+ * while it waits for input or for children.  Complete lines are
+ * written to the terminal prefixed with "[jid] ", so the lines of
+ * different jobs do not interleave.  Each job has a buffer of
+ * LINEMERGE_BUFFER bytes; the shell reads no more than fits, so a job
+ * that writes faster than its lines are printed blocks on its full
+ * pipe.  A line longer than the buffer is printed in pieces.
+ *
+ * A source can also copy everything its job writes into a ring
+ * buffer, with or without printing it.  A source that only captures
+ * is read as fast as the job writes.
+ */
+#define LINEMERGE_BUFFER (64 << 10)
+
+struct linemerge_source;
+
+/* Create a pipe for the output of job jid and store its write end in
+ * *write_fd.  Output is copied into ring unless it is NULL, and
+ * printed if print is true.  Returns NULL after printing an error. */
+struct linemerge_source *linemerge_open(int jid, struct ringbuf *ring,
+                                        bool print, int *write_fd);
+
+/* The job has ended: print the rest of what it wrote to out_fd, ending
+ * an unfinished last line, and stop copying into its ring buffer.  A
+ * source whose pipe is still open in some other process stays merged
+ * until it is closed, then it is freed. */
+void linemerge_release(struct linemerge_source *source, int out_fd);
+
+/* In a forked child of the shell: close and forget all sources, which
+ * belong to the parent */
+void linemerge_reset(void);
+
+/* Return true if any source's pipe is open */
+bool linemerge_active(void);
+
+/* Wait until fd is readable or timeout milliseconds have passed (no
+ * limit if -1), printing the lines of all sources to out_fd meanwhile.
+ * The signal mask is replaced by wait_mask while waiting, as by ppoll,
+ * unless it is NULL.  hide and show, unless NULL, are called before and
+ * after each batch of lines.  Returns 1 if fd is readable, 0 on timeout,
+ * or -1 if poll fails, with errno set to EINTR if a signal arrived. */
+int linemerge_wait(int fd, int timeout, const sigset_t *wait_mask,
+                   int out_fd, void (*hide)(void), void (*show)(void));
+
+#endif /* __LINEMERGE_H */
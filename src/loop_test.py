@@ -0,0 +1,60 @@
+#!/usr/bin/python
+#
+# loop_test: tests for and while loops and $variable expansion.
+#
+# The loop body is parsed once and its words are expanded on every
+# iteration. Keywords are only special where a command may start.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# the body runs once per word, with the variable set to that word
+sendline("for f in alpha beta gamma; do echo item-$f; done")
+expect_exact("item-alpha", "first iteration did not run")
+expect_exact("item-beta", "second iteration did not run")
+expect_exact("item-gamma", "third iteration did not run")
+expect_prompt()
+
+# ${name} and redirections are expanded as well
+tmpdir = "/tmp/cush_loop_test_%d" % os.getpid()
+os.mkdir(tmpdir)
+sendline("for f in a b; do echo ${f}x > %s/$f.out; done" % tmpdir)
+expect_prompt()
+assert open(tmpdir + "/a.out").read() == "ax\n", "redirection was not expanded"
+assert open(tmpdir + "/b.out").read() == "bx\n", "second redirection was not expanded"
+
+# a while loop runs until its condition fails
+marker = tmpdir + "/marker"
+sendline("while test ! -e %s; do echo once; touch %s; done" % (marker, marker))
+expect_exact("once", "while loop did not run its body")
+expect_prompt()
+assert console.before.count("once") == 1, "while loop ran more than once"
+
+# a loop can be part of a pipeline
+sendline("for n in 3 1 2; do echo $n; done | sort | tr -d '\\n'; echo")
+expect_exact("123", "loop output was not piped")
+expect_prompt()
+
+# keywords are only recognized in command position
+sendline("echo for done in")
+expect_exact("for done in", "keywords were recognized as arguments")
+expect_prompt()
+
+# Ctrl-C stops the whole loop
+sendline("for i in 1 2 3; do sleep 10; echo not-reached-$i; done")
+time.sleep(1)
+console.sendintr()
+expect_prompt("Shell did not print prompt after loop was interrupted")
+assert "not-reached" not in console.before, "loop continued after Ctrl-C"
+
+for f in os.listdir(tmpdir):
+    os.unlink(os.path.join(tmpdir, f))
+os.rmdir(tmpdir)
+
+test_success()
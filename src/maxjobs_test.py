@@ -0,0 +1,51 @@
+#!/usr/bin/python
+#
+# maxjobs_test: tests the maxjobs option, which queues background jobs.
+#
+# Checks that a background job started beyond the limit is queued, and
+# that it starts when an earlier job finishes, also while the shell is
+# waiting at the prompt.
+#
+
+import sys, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# an invalid value fails the set command
+sendline("set -o maxjobs=bogus && echo accepted || echo rejected")
+expect_exact("\nrejected", "set did not fail on an invalid value")
+expect_prompt()
+
+sendline("set -o maxjobs=1")
+expect_prompt("Shell did not print expected prompt after set")
+
+# the second job waits for the first
+sendline("sleep 1 &")
+expect_prompt("Shell did not print expected prompt after first job")
+sendline("sleep 1 &")
+expect_exact("[2] Queued", "Shell did not queue the second job")
+expect_prompt()
+
+sendline("jobs")
+expect(r"\[1\]\s+Running", "jobs did not show the first job running")
+expect(r"\[2\]\s+Queued", "jobs did not show the second job queued")
+expect_prompt()
+
+# the queued job starts while the shell sits at the prompt
+time.sleep(1.5)
+sendline("jobs")
+expect(r"\[2\]\s+Running", "queued job did not start after the first finished")
+expect_prompt()
+
+# and runs to completion
+start = time.time()
+sendline("wait")
+expect_prompt("Shell did not print expected prompt after wait")
+elapsed = time.time() - start
+assert elapsed < 1.0, "queued job started late, wait took %.1fs" % elapsed
+
+test_success()
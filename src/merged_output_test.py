@@ -0,0 +1,45 @@
+#!/usr/bin/python
+#
+# merged_output_test: tests the mergeoutput option, which prints the
+# output of background jobs a line at a time, prefixed with [jid].
+#
+
+import sys, os, re, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("set -o mergeoutput")
+expect_prompt()
+sendline("E=end")
+expect_prompt()
+
+# each job writes its lines in small pieces; no line may be torn apart
+writer = "for i in 1 2 3 4 5 6 7 8 9 10; do printf %s-; printf $i; sleep 0.01; echo; done"
+sendline("{ %s; } & { %s; } & wait; echo merged-$E" % (writer.replace("%s", "A"), writer.replace("%s", "B")))
+expect_exact("merged-end", "background jobs did not finish")
+output = console.before
+expect_prompt()
+
+lines = re.findall(r"^\[(\d+)\] (\D.*?)\r$", output, re.M)
+for jid, line in lines:
+    assert line in ["A-%d" % i for i in range(1, 11)] + ["B-%d" % i for i in range(1, 11)], \
+        "torn line '%s'" % line
+assert len(lines) == 20, "expected 20 lines, got %d" % len(lines)
+assert set(jid for jid, line in lines if line.startswith("A")) == {"1"}, "wrong prefix for job 1"
+assert set(jid for jid, line in lines if line.startswith("B")) == {"2"}, "wrong prefix for job 2"
+
+# an unfinished last line is ended when the job is done
+sendline("printf partial & wait")
+expect_exact("partial\r\n", "unfinished line was not printed")
+expect_prompt()
+
+# foreground jobs still write to the terminal directly
+sendline("echo direct")
+expect("\rdirect\r\n", "foreground output was prefixed")
+expect_prompt()
+
+test_success()
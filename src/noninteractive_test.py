@@ -0,0 +1,72 @@
+#!/usr/bin/python
+#
+# noninteractive_test: tests the shell reading commands from a -c string,
+# from a script file, and from a standard input that is not a terminal.
+#
+# Checks that the commands run in order and that the shell exits with the
+# status of the last one. A command that reads the shell's standard input
+# must start at the line after its own, whether that input is a pipe or a
+# file the shell has read ahead in.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+import subprocess, tempfile, shutil
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# the non-interactive shells run the binary under test
+shell = os.readlink("/proc/%d/exe" % console.pid)
+
+tmpdir = tempfile.mkdtemp("-cush-noninteractive-tests")
+atexit.register(lambda: shutil.rmtree(tmpdir))
+
+def run(args, **kwargs):
+    p = subprocess.run([shell] + args, stdout=subprocess.PIPE,
+                       stderr=subprocess.STDOUT, timeout=10, **kwargs)
+    return p.returncode, p.stdout.decode()
+
+# -c runs every line of its argument
+status, out = run(["-c", "echo one; echo two\nfalse"])
+assert out == "one\ntwo\n", "-c did not run its commands in order: %r" % out
+assert status == 1, "-c did not exit with the last status (%d)" % status
+
+# a script file runs the same way
+script = os.path.join(tmpdir, "script")
+with open(script, "w") as f:
+    f.write("echo first\nfalse\necho last\n")
+status, out = run([script], stdin=subprocess.DEVNULL)
+assert out == "first\nlast\n", "script did not run its commands in order: %r" % out
+assert status == 0, "script did not exit with the last status (%d)" % status
+
+# a command reading stdin gets the line after its own, and the shell
+# continues with the line after that
+reader = os.path.join(tmpdir, "readone")
+with open(reader, "w") as f:
+    f.write('#!/bin/sh\nread line\necho "got $line"\n')
+os.chmod(reader, 0o755)
+
+# pad the script so that the shell would read past the data line if it
+# read its input in blocks
+lines = ["echo start", reader, "data line", "echo end"]
+lines += ["true"] * 1000 + ["echo done"]
+text = "\n".join(lines) + "\n"
+expected = "start\ngot data line\nend\ndone\n"
+
+# from a pipe, which the shell must not read past the current line
+status, out = run([], input=text.encode())
+assert out == expected, "command did not read the line after its own from a pipe: %r" % out
+assert status == 0, "piped script failed with status %d" % status
+
+# from a file, whose read-ahead the shell must give back
+with open(script, "w") as f:
+    f.write(text)
+with open(script) as f:
+    status, out = run([], stdin=f)
+assert out == expected, "command did not read the line after its own from a file: %r" % out
+assert status == 0, "redirected script failed with status %d" % status
+
+test_success()
@@ -0,0 +1,48 @@
+#!/usr/bin/python
+#
+# output_builtin_test: tests the capture option and the output builtin,
+# which shows the output kept in a background job's ring buffer.
+#
+
+import sys, os, re, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("set -o capture=4k")
+expect_prompt()
+
+# the output of a background job is kept instead of printed
+sendline("seq 1 5 & wait")
+expect_exact("Done", "background job did not finish")
+output = console.before
+expect_prompt()
+assert "3\r\n" not in output, "captured output was printed"
+
+# a finished job stays listed until its output was shown
+sendline("jobs")
+expect(r"\[1\]\s+Done", "finished job with captured output was removed")
+expect_prompt()
+
+sendline("output %1 --tail 2")
+expect_exact("4\r\n5\r\n", "output --tail did not show the last lines")
+expect_prompt()
+
+sendline("output %1")
+expect_exact("No captured output", "job was not removed after its output was shown")
+expect_prompt()
+
+# the ring buffer keeps only the last output
+sendline("seq 1 100000 & wait")
+expect_exact("Done", "background job did not finish")
+expect_prompt()
+sendline("output %1")
+expect_exact("99999\r\n100000\r\n", "output did not end with the last lines")
+output = console.before
+expect_prompt()
+assert "\r\n1\r\n" not in output, "ring buffer kept more than its size"
+
+test_success()
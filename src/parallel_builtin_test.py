@@ -0,0 +1,72 @@
+#!/usr/bin/python
+#
+# parallel_builtin_test: tests the "parallel" custom cush shell built-in command.
+#
+# Runs a command template once per input line with a bounded number of
+# tasks in flight, and checks that each task's output is printed in one piece.
+#
+
+import sys, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+import tempfile, os
+fd, inputfile = tempfile.mkstemp("-cush-parallel-test")
+os.write(fd, b"one\ntwo\nthree\nfour\n")
+os.close(fd)
+
+# lines that the shell would expand if they were words
+fd, datafile = tempfile.mkstemp("-cush-parallel-data")
+marker = datafile + "-injected"
+os.write(fd, ("$(touch %s)\n*\n$HOME\n" % marker).encode())
+os.close(fd)
+
+def cleanup():
+    os.unlink(inputfile)
+    os.unlink(datafile)
+    if os.path.exists(marker):
+        os.unlink(marker)
+
+atexit.register(cleanup)
+
+# each line is appended to the command when the template has no {}
+sendline("parallel -j 2 -a %s echo line" % inputfile)
+for word in ["one", "two", "three", "four"]:
+    expect_exact("line " + word, "parallel did not run a task for '%s'" % word)
+expect_prompt("Shell did not print expected prompt after parallel")
+
+# {} is replaced by the line; a task's two output lines must not be split
+sendline("parallel -j 4 sh -c \"echo {}-a; sleep 0.5; echo {}-b\" < %s" % inputfile)
+for word in ["one", "two", "three", "four"]:
+    expect("%s-a\r\n%s-b" % (word, word), "output of task '%s' was interleaved" % word)
+expect_prompt("Shell did not print expected prompt after grouped parallel")
+
+# at most N tasks may run at once: 4 tasks of 0.5s with -j 2 take about 1s
+start = time.time()
+sendline("parallel -j 2 -a %s sleep 0.5" % inputfile)
+expect_prompt("Shell did not print expected prompt after timed parallel")
+elapsed = time.time() - start
+assert 0.9 < elapsed < 1.9, "parallel -j 2 ran for %.1fs, expected about 1s" % elapsed
+
+# input lines are data and the template was already expanded, so the
+# words of the tasks are used as they are
+sendline('parallel -j 1 -a %s echo "*" got' % datafile)
+expect_exact("* got $(touch %s)\r\n" % marker, "parallel expanded a substitution in its input")
+expect_exact("* got *\r\n", "parallel globbed its input or its template")
+expect_exact("* got $HOME\r\n", "parallel expanded a variable in its input")
+expect_prompt()
+assert not os.path.exists(marker), "parallel ran a command substitution from its input"
+
+# an oversized -j is capped, and an invalid one is rejected
+sendline("parallel -j 99999999999 -a %s echo capped" % inputfile)
+expect_prompt("Shell did not print expected prompt after capped parallel")
+assert console.before.count("capped ") == 4, "parallel with a huge -j did not run every task"
+sendline("parallel -j 2x -a %s echo invalid" % inputfile)
+expect_exact("usage: parallel", "parallel accepted an invalid -j")
+expect_prompt()
+
+test_success()
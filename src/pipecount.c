@@ -0,0 +1,205 @@
+/*
+ * Counting relays for the pipes of a job.
+ */
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pipecount.h"
+#include "utils.h"
+
+/* The counters of one pipe.  The relay updates them with atomic
+ * stores, and the shell reads them at any time. */
+struct counter {
+    unsigned long long bytes;   /* Moved so far */
+    unsigned long long sampled; /* Bytes of the sample */
+    unsigned long long lines;   /* Newlines in the sample */
+    unsigned long long window_bytes;    /* bytes at the start of the current */
+    long long window_start;             /* one-second window, in ns */
+    unsigned long long rate;    /* Bytes per second in the last window */
+    bool done;
+};
+
+struct pipecount {
+    size_t size;                /* Of the mapping */
+    bool lines;
+    struct counter counters[];
+};
+
+#define LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+/* Monotonic time in nanoseconds */
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Create the shared counters for n pipes */
+struct pipecount *
+pipecount_create(int n, bool lines)
+{
+    size_t size = sizeof(struct pipecount) + n * sizeof(struct counter);
+    struct pipecount *counters = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (counters == MAP_FAILED) {
+        utils_error("mmap: ");
+        return NULL;
+    }
+
+    counters->size = size;
+    counters->lines = lines;
+    long long now = now_ns();
+    for (int i = 0; i < n; i++)
+        counters->counters[i].window_start = now;
+    return counters;
+}
+
+/* Tee the next bytes of in_fd into the pipe sample and count their
+ * newlines.  Returns the number of bytes, 0 at the end of in_fd, or
+ * -1 after printing an error. */
+static ssize_t
+count_sample(struct counter *c, int in_fd, int sample[2])
+{
+    char buf[1 << 16];
+    ssize_t len;
+    while ((len = tee(in_fd, sample[1], sizeof buf, 0)) == -1 && errno == EINTR)
+        ;
+    if (len <= 0) {
+        if (len == -1)
+            utils_error("relay: ");
+        return len;
+    }
+
+    unsigned long long lines = 0;
+    for (ssize_t got = 0; got < len; ) {
+        ssize_t n = read(sample[0], buf, len - got);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            utils_error("relay: ");
+            return -1;
+        }
+        for (char *p = buf; (p = memchr(p, '\n', buf + n - p)) != NULL; p++)
+            lines++;
+        got += n;
+    }
+    STORE(c->lines, LOAD(c->lines) + lines);
+    STORE(c->sampled, LOAD(c->sampled) + len);
+    return len;
+}
+
+/* Move everything from in_fd to out_fd, counting it in counter i */
+int
+pipecount_relay(struct pipecount *counters, int i, int in_fd, int out_fd)
+{
+    struct counter *c = &counters->counters[i];
+    unsigned long long bytes = 0, counted = 0, next_sample = 0;
+    int sample[2] = { -1, -1 };
+    int rc = 0;
+
+    /* A reader that exits ends the relay; the writer then gets SIGPIPE */
+    signal(SIGPIPE, SIG_IGN);
+    if (counters->lines && pipe2(sample, O_CLOEXEC) == -1) {
+        utils_error("relay: pipe: ");
+        return -1;
+    }
+
+    for (;;) {
+        size_t want = 1 << 20;
+        if (counters->lines && bytes >= counted
+            && (bytes < PIPECOUNT_EXACT || bytes >= next_sample)) {
+            ssize_t len = count_sample(c, in_fd, sample);
+            if (len <= 0) {
+                rc = len;
+                break;
+            }
+            counted = bytes + len;
+            next_sample = bytes + PIPECOUNT_SAMPLE;
+        }
+        /* Stop at the end of the sample, so that the next one starts
+         * right after it while lines are still counted exactly */
+        if (bytes < counted)
+            want = counted - bytes;
+
+        ssize_t n = splice(in_fd, NULL, out_fd, NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == 0 || (n == -1 && errno == EPIPE))
+            break;
+        if (n == -1) {
+            utils_error("relay: ");
+            rc = -1;
+            break;
+        }
+        bytes += n;
+        STORE(c->bytes, bytes);
+
+        long long now = now_ns();
+        long long start = LOAD(c->window_start);
+        if (now - start >= 1000000000LL) {
+            unsigned long long window_bytes = LOAD(c->window_bytes);
+            STORE(c->rate, (bytes - window_bytes) * 1000000000ULL / (now - start));
+            STORE(c->window_bytes, bytes);
+            STORE(c->window_start, now);
+        }
+    }
+
+    STORE(c->done, true);
+    if (sample[0] != -1) {
+        close(sample[0]);
+        close(sample[1]);
+    }
+    return rc;
+}
+
+/* Print the counts and current rate of counter i */
+void
+pipecount_print(struct pipecount *counters, int i, FILE *stream)
+{
+    struct counter *c = &counters->counters[i];
+    unsigned long long bytes = LOAD(c->bytes);
+    char buf[16];
+
+    fprintf(stream, "%s bytes", utils_format_bytes(bytes, buf, sizeof buf));
+
+    unsigned long long sampled = LOAD(c->sampled);
+    if (counters->lines && sampled > 0) {
+        unsigned long long lines = LOAD(c->lines);
+        if (sampled < bytes)
+            lines = (double) lines / sampled * bytes;
+        fprintf(stream, ", %s%llu lines", sampled < bytes ? "~" : "", lines);
+    }
+
+    if (LOAD(c->done)) {
+        fprintf(stream, ", done\n");
+        return;
+    }
+
+    /* Until the first window is complete, and while the stream stalls,
+     * the rate is taken over the current window */
+    long long now = now_ns();
+    long long start = LOAD(c->window_start);
+    unsigned long long rate = LOAD(c->rate);
+    if (rate == 0 || now - start >= 2000000000LL) {
+        unsigned long long window_bytes = LOAD(c->window_bytes);
+        rate = now > start && bytes > window_bytes
+             ? (bytes - window_bytes) * 1e9 / (now - start) : 0;
+    }
+    fprintf(stream, ", %s/s\n", utils_format_bytes(rate, buf, sizeof buf));
+}
+
+/* Unmap the counters */
+void
+pipecount_free(struct pipecount *counters)
+{
+    munmap(counters, counters->size);
+}
@@ -0,0 +1,40 @@
+#ifndef __PIPECOUNT_H
+#define __PIPECOUNT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Counting the bytes and lines that pass through the pipes of a job,
+ * like inserting pv between its commands.
+ *
+ * Each counted pipe is split in two by a relay process of the job,
+ * which moves the data from one to the other with splice(2) without
+ * copying it through user space.  The relay adds what it moves to a
+ * counter in memory shared with the shell.  To count lines, it peeks
+ * at a sample of the stream with tee(2): everything up to
+ * PIPECOUNT_EXACT bytes, then at most one pipe buffer every
+ * PIPECOUNT_SAMPLE bytes, and estimates the number of lines from the
+ * share of newlines in the sample.
+ */
+#define PIPECOUNT_EXACT (1 << 20)
+#define PIPECOUNT_SAMPLE (1 << 20)
+
+struct pipecount;
+
+/* Create the shared counters for the n pipes of a job.  Lines are
+ * counted if lines is true.  Returns NULL after printing an error. */
+struct pipecount *pipecount_create(int n, bool lines);
+
+/* In the relay process: move everything from in_fd to out_fd,
+ * counting it in counter i.  Returns 0 once in_fd is at its end or
+ * out_fd has no reader, or -1 after printing an error. */
+int pipecount_relay(struct pipecount *counters, int i, int in_fd, int out_fd);
+
+/* Print the counts and current rate of counter i to stream */
+void pipecount_print(struct pipecount *counters, int i, FILE *stream);
+
+/* Unmap the counters */
+void pipecount_free(struct pipecount *counters);
+
+#endif /* __PIPECOUNT_H */
@@ -0,0 +1,57 @@
+#!/usr/bin/python
+#
+# pipecount_test: tests the pipecount option, which inserts a counting
+# splice relay into every pipe of a job, shown by jobs -l.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("set -o pipecount=2")
+expect_prompt()
+
+# the relay passes the stream through unchanged
+sendline("seq 1 200000 | cat | wc -l")
+expect_exact("200000", "counted pipes changed the stream")
+expect_prompt()
+
+# jobs -l shows the bytes and lines that went through each pipe
+sendline("( seq 1 100; sleep 30 ) | cat > /dev/null &")
+expect(r"\[(\d+)\] (\d+)", "missing job announcement")
+jid = console.match.group(1)
+expect_prompt()
+time.sleep(0.5)
+
+sendline("jobs -l")
+expect_exact("pipe 1: 292 bytes, 100 lines", "jobs -l did not show the counts")
+expect_prompt()
+
+# plain jobs does not
+sendline("jobs")
+expect_exact("Running")
+expect_prompt()
+assert "pipe 1" not in console.before, "jobs showed the counts"
+
+sendline("kill " + jid)
+expect_prompt()
+
+# with pipecount=1, only bytes are counted
+sendline("set -o pipecount=1")
+expect_prompt()
+sendline("( seq 1 100; sleep 30 ) | cat > /dev/null &")
+expect(r"\[(\d+)\] (\d+)", "missing job announcement")
+jid = console.match.group(1)
+expect_prompt()
+time.sleep(0.5)
+sendline("jobs -l")
+expect(r"pipe 1: 292 bytes, [0-9.]+[KMG]?/s\r\n", "jobs -l showed more than bytes")
+expect_prompt()
+sendline("kill " + jid)
+expect_prompt()
+
+test_success()
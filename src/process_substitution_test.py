@@ -0,0 +1,50 @@
+#!/usr/bin/python
+#
+# process_substitution_test: tests <(cmd) and >(cmd) words, and that
+# their processes belong to the job.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# two inputs are read concurrently
+sendline("paste <(echo a) <(echo b)")
+expect_exact("a\tb", "<(...) did not provide the command's output")
+expect_prompt()
+
+# redirections can read from a process substitution
+sendline("wc -l < <(seq 1 7)")
+expect_exact("7", "input redirection from <(...) failed")
+expect_prompt()
+
+# >(...) receives what the command writes
+sendline("echo hello > >(tr a-z A-Z)")
+expect_exact("HELLO", ">(...) did not receive the command's output")
+expect_prompt()
+
+# the substituted processes are part of the job and are killed with it
+sendline("cat <(sleep 100) &")
+expect(r"\[1\] (\d+)", "background job did not print its process group")
+pgid = int(console.match.group(1))
+expect_prompt()
+time.sleep(0.5)
+
+# the Done notice comes at the next prompt, or from jobs if the job
+# finishes later
+sendline("kill 1")
+time.sleep(0.5)
+sendline("jobs")
+expect_exact("Done", "job with a process substitution did not finish after kill")
+expect_prompt()
+try:
+    os.killpg(pgid, 0)
+    assert False, "substituted process survived kill"
+except ProcessLookupError:
+    pass
+
+test_success()
@@ -0,0 +1,253 @@
+/*
+ * Sampling the stages and pipes of a pipeline.
+ */
+#define _GNU_SOURCE 1
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "profile.h"
+#include "utils.h"
+
+/* A process of the pipeline */
+struct stage {
+    pid_t pid;                  /* 0 if not a process */
+    char *name;
+    bool exited;
+    double end;                 /* Seconds after the start when it exited */
+    long ticks;                 /* CPU time of it and its reaped children */
+    unsigned long long read, written;   /* Bytes, from /proc/<pid>/io */
+    double wait_in, wait_out;   /* Seconds asleep on an empty input pipe
+                                   or a full output pipe */
+};
+
+/* A pipe between two stages */
+struct pipe {
+    int fd;                     /* Our read end, -1 once closed */
+    int capacity;
+    int fill;                   /* Bytes in it at the last sample */
+    double fill_sum;            /* Integral of the fill over time */
+};
+
+struct profile {
+    int n;
+    struct stage *stages;
+    struct pipe *pipes;         /* n - 1 pipes */
+    struct timespec start, last;
+};
+
+/* Seconds from a to b */
+static double
+seconds(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+/* Read the first line of /proc/<pid>/<file> into buf, or everything
+ * that fits.  Returns false if it cannot be read. */
+static bool
+read_proc(pid_t pid, const char *file, char *buf, size_t size)
+{
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/%s", (int) pid, file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    ssize_t len = read(fd, buf, size - 1);
+    close(fd);
+    if (len <= 0)
+        return false;
+    buf[len] = '\0';
+    return true;
+}
+
+/* Update the counters of a stage and return its scheduler state, or
+ * '?' if it cannot be read */
+static char
+sample_stage(struct stage *s)
+{
+    char buf[1024];
+    char state = '?';
+
+    /* The command name in parentheses may contain anything, so fields
+     * are counted from the last ')': state is field 3, and utime,
+     * stime, cutime, and cstime are fields 14 to 17 */
+    char *p;
+    if (read_proc(s->pid, "stat", buf, sizeof buf) && (p = strrchr(buf, ')')) != NULL) {
+        long fields[18];
+        char *end;
+        state = p[2];
+        p += 3;
+        for (int k = 4; k < 18; k++) {
+            fields[k] = strtol(p, &end, 10);
+            p = end;
+        }
+        s->ticks = fields[14] + fields[15] + fields[16] + fields[17];
+    }
+
+    if (read_proc(s->pid, "io", buf, sizeof buf)) {
+        if ((p = strstr(buf, "rchar: ")) != NULL)
+            s->read = strtoull(p + 7, NULL, 10);
+        if ((p = strstr(buf, "wchar: ")) != NULL)
+            s->written = strtoull(p + 7, NULL, 10);
+    }
+    return state;
+}
+
+/* Start profiling a pipeline of n stages */
+struct profile *
+profile_start(int n)
+{
+    struct profile *p = calloc(1, sizeof *p);
+    p->n = n;
+    p->stages = calloc(n, sizeof *p->stages);
+    p->pipes = calloc(n, sizeof *p->pipes);
+    for (int i = 0; i < n; i++)
+        p->pipes[i].fd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    p->last = p->start;
+    return p;
+}
+
+/* Record the process and name of stage i */
+void
+profile_set_stage(struct profile *p, int i, pid_t pid, const char *name)
+{
+    p->stages[i].pid = pid;
+    p->stages[i].name = strdup(name);
+    p->stages[i].exited = pid == 0;
+}
+
+/* Keep a duplicate of the read end of pipe i */
+void
+profile_set_pipe(struct profile *p, int i, int fd)
+{
+    /* Nobody else reads a pipe whose reader is not a process; holding
+     * it open would block its writer forever */
+    if (p->stages[i + 1].pid == 0)
+        return;
+
+    p->pipes[i].fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    p->pipes[i].capacity = fcntl(fd, F_GETPIPE_SZ);
+}
+
+/* Take a sample of all stages and pipes */
+void
+profile_sample(struct profile *p)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double dt = seconds(&p->last, &now);
+    p->last = now;
+
+    for (int i = 0; i < p->n - 1; i++) {
+        struct pipe *pp = &p->pipes[i];
+        if (pp->fd == -1 || ioctl(pp->fd, FIONREAD, &pp->fill) == -1)
+            pp->fill = 0;
+        pp->fill_sum += pp->fill * dt;
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < p->n; i++) {
+        struct stage *s = &p->stages[i];
+        if (s->exited)
+            continue;
+
+        if (sample_stage(s) != 'S')
+            continue;
+
+        /* A writer sleeps once no free page is left in the pipe */
+        struct pipe *out = i < p->n - 1 ? &p->pipes[i] : NULL;
+        struct pipe *in = i > 0 ? &p->pipes[i - 1] : NULL;
+        if (out != NULL && out->fd != -1 && out->fill > out->capacity - page)
+            s->wait_out += dt;
+        else if (in != NULL && in->fd != -1 && in->fill == 0)
+            s->wait_in += dt;
+    }
+}
+
+/* Take the final sample of process pid and close its input pipe */
+void
+profile_exited(struct profile *p, pid_t pid)
+{
+    for (int i = 0; i < p->n; i++) {
+        struct stage *s = &p->stages[i];
+        if (s->pid != pid || s->exited)
+            continue;
+
+        profile_sample(p);
+        s->exited = true;
+        s->end = seconds(&p->start, &p->last);
+        if (i > 0 && p->pipes[i - 1].fd != -1) {
+            close(p->pipes[i - 1].fd);
+            p->pipes[i - 1].fd = -1;
+        }
+    }
+}
+
+/* Print the per-stage report to stream */
+void
+profile_report(struct profile *p, FILE *stream)
+{
+    profile_sample(p);
+    double total = seconds(&p->start, &p->last);
+    if (total <= 0)
+        total = 1e-9;
+    double hz = sysconf(_SC_CLK_TCK);
+    int bottleneck = -1;
+    double least_wait = 0;
+
+    fprintf(stream, "profile: %.3fs real\n", total);
+    fprintf(stream, "%2s %-16s %8s %5s %8s %8s %8s %8s %8s\n", "#", "command",
+            "cpu", "cpu%", "read", "written", "in-wait", "out-wait", "out-fill");
+    for (int i = 0; i < p->n; i++) {
+        struct stage *s = &p->stages[i];
+        if (s->pid == 0) {
+            fprintf(stream, "%2d %-16.16s %8s\n", i + 1, s->name, "-");
+            continue;
+        }
+
+        double lifetime = s->exited ? s->end : total;
+        if (lifetime <= 0)
+            lifetime = 1e-9;
+        double cpu = s->ticks / hz;
+        double wait = (s->wait_in + s->wait_out) / lifetime;
+        char rbuf[16], wbuf[16], fill[16] = "-";
+        if (i < p->n - 1 && p->pipes[i].capacity > 0)
+            snprintf(fill, sizeof fill, "%.0f%%",
+                     100 * p->pipes[i].fill_sum / total / p->pipes[i].capacity);
+
+        fprintf(stream, "%2d %-16.16s %7.2fs %4.0f%% %8s %8s %7.0f%% %7.0f%% %8s\n",
+                i + 1, s->name, cpu, 100 * cpu / lifetime,
+                utils_format_bytes(s->read, rbuf, sizeof rbuf),
+                utils_format_bytes(s->written, wbuf, sizeof wbuf),
+                100 * s->wait_in / lifetime, 100 * s->wait_out / lifetime, fill);
+
+        if (bottleneck == -1 || wait < least_wait) {
+            bottleneck = i;
+            least_wait = wait;
+        }
+    }
+
+    if (p->n > 1 && bottleneck != -1)
+        fprintf(stream, "bottleneck: %d %s\n", bottleneck + 1,
+                p->stages[bottleneck].name);
+}
+
+/* Close the pipes and free the profile */
+void
+profile_free(struct profile *p)
+{
+    for (int i = 0; i < p->n; i++) {
+        if (p->pipes[i].fd != -1)
+            close(p->pipes[i].fd);
+        free(p->stages[i].name);
+    }
+    free(p->stages);
+    free(p->pipes);
+    free(p);
+}
@@ -0,0 +1,49 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Profiling the stages of a foreground pipeline, as in
+ * 'profile cmd1 | cmd2 | cmd3'.
+ *
+ * While the pipeline runs, the shell samples every PROFILE_INTERVAL_MS
+ * milliseconds the CPU time and I/O counters of each stage from
+ * /proc/<pid>/stat and /proc/<pid>/io, and the fill of every pipe
+ * between stages with FIONREAD on a duplicate of its read end.  A
+ * stage that is asleep while its input pipe is empty counts as
+ * waiting for input; one that is asleep while its output pipe is full
+ * counts as waiting for output.  The stage that waits least is the
+ * bottleneck of the pipeline.
+ */
+#define PROFILE_INTERVAL_MS 10
+
+struct profile;
+
+/* Start profiling a pipeline of n stages */
+struct profile *profile_start(int n);
+
+/* Stage i runs as process pid, or pid is 0 if it is run by the shell
+ * itself or could not be started.  The name is copied. */
+void profile_set_stage(struct profile *p, int i, pid_t pid, const char *name);
+
+/* The pipe from stage i to stage i + 1 has the read end fd, which is
+ * duplicated; call after the stages have been set */
+void profile_set_pipe(struct profile *p, int i, int fd);
+
+/* Take a sample of all stages and pipes */
+void profile_sample(struct profile *p);
+
+/* Process pid has exited but not been reaped yet: take its final
+ * sample, and stop holding the read end of its input pipe so that
+ * the previous stage gets SIGPIPE if it writes more */
+void profile_exited(struct profile *p, pid_t pid);
+
+/* Print the per-stage report to stream */
+void profile_report(struct profile *p, FILE *stream);
+
+/* Close the pipes and free the profile */
+void profile_free(struct profile *p);
+
+#endif /* __PROFILE_H */
@@ -0,0 +1,42 @@
+#!/usr/bin/python
+#
+# profile_test: tests the profile prefix, which reports the CPU time,
+# bytes, and pipe waits of each stage of a pipeline when it ends.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# every stage has a row, and the pipeline's output is unaffected
+sendline("profile head -c 50000000 /dev/zero | tr x y | wc -c")
+expect_exact("50000000", "profiled pipeline printed the wrong output")
+expect(r"profile: [0-9.]+s real", "missing profile report")
+expect(r"1 head +[0-9.]+s", "missing row of the first stage")
+expect(r"2 tr +[0-9.]+s", "missing row of the second stage")
+expect(r"3 wc +[0-9.]+s", "missing row of the third stage")
+expect(r"bottleneck: \d \w+", "missing bottleneck")
+expect_prompt()
+
+# an exited reader closes the pipe, so the writer still ends
+sendline("profile yes | head -1")
+expect_exact("y", "profiled pipeline printed the wrong output")
+expect_exact("bottleneck:", "writer did not end after its reader exited")
+expect_prompt()
+
+# groups are profiled as one stage
+sendline("profile ( echo hi ) | cat")
+expect_exact("hi")
+expect(r"1 \( \.\.\. \) ", "missing row of the group")
+expect_prompt()
+
+# the word profile is only a keyword where a command starts
+sendline("echo profile")
+expect_exact("profile\r\n", "profile was taken as a keyword")
+expect_prompt()
+
+test_success()
@@ -0,0 +1,113 @@
+/*
+ * Ring buffers in a memfd mapped twice.
+ */
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "ringbuf.h"
+#include "utils.h"
+
+struct ringbuf {
+    int fd;                 /* The memfd */
+    char *base;             /* Two consecutive mappings of it */
+    size_t size;            /* Size of the memfd, a multiple of the page size */
+    size_t total;           /* Bytes appended in total */
+};
+
+/* Create a ring buffer holding the last size bytes */
+struct ringbuf *
+ringbuf_create(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) / page * page;
+
+    int fd = memfd_create("cush-output", MFD_CLOEXEC);
+    if (fd == -1) {
+        utils_error("memfd_create: ");
+        return NULL;
+    }
+    if (ftruncate(fd, size) == -1) {
+        utils_error("ftruncate: ");
+        close(fd);
+        return NULL;
+    }
+
+    /* Reserve twice the size, then map the memfd into both halves */
+    char *base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED
+        || mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        utils_error("mmap: ");
+        if (base != MAP_FAILED)
+            munmap(base, 2 * size);
+        close(fd);
+        return NULL;
+    }
+
+    struct ringbuf *ring = malloc(sizeof *ring);
+    ring->fd = fd;
+    ring->base = base;
+    ring->size = size;
+    ring->total = 0;
+    return ring;
+}
+
+/* Append len bytes, overwriting the oldest ones */
+void
+ringbuf_append(struct ringbuf *ring, const char *data, size_t len)
+{
+    if (len > ring->size) {
+        ring->total += len - ring->size;
+        data += len - ring->size;
+        len = ring->size;
+    }
+    /* The second mapping catches what runs past the end */
+    size_t pos = ring->total % ring->size;
+    memcpy(ring->base + pos, data, len);
+    ring->total += len;
+}
+
+/* Write the contents, or their last tail lines, to fd */
+int
+ringbuf_write(struct ringbuf *ring, int fd, long tail)
+{
+    size_t len = ring->total < ring->size ? ring->total : ring->size;
+    char *start = ring->base + (ring->total - len) % ring->size;
+    char *end = start + len;
+
+    if (tail > 0) {
+        /* A last line without a newline counts as a line */
+        char *p = end;
+        if (p > start && p[-1] == '\n')
+            p--;
+        while (p > start) {
+            char *nl = memrchr(start, '\n', p - start);
+            if (nl == NULL || --tail == 0) {
+                p = nl != NULL ? nl + 1 : start;
+                break;
+            }
+            p = nl;
+        }
+        start = p;
+    }
+
+    while (start < end) {
+        ssize_t n = write(fd, start, end - start);
+        if (n == -1)
+            return -1;
+        start += n;
+    }
+    return 0;
+}
+
+/* Unmap and close a ring buffer */
+void
+ringbuf_free(struct ringbuf *ring)
+{
+    munmap(ring->base, 2 * ring->size);
+    close(ring->fd);
+    free(ring);
+}
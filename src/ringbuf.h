@@ -0,0 +1,30 @@
+#ifndef __RINGBUF_H
+#define __RINGBUF_H
+
+#include <stddef.h>
+
+/*
+ * A fixed-size ring buffer in a memfd, keeping the last bytes written
+ * to it, as used to capture the output of background jobs.
+ *
+ * The memfd is mapped twice, back to back, so that the contents are
+ * always contiguous in memory even after they wrap around the end of
+ * the buffer.
+ */
+struct ringbuf;
+
+/* Create a ring buffer holding the last size bytes, rounded up to
+ * whole pages.  Returns NULL after printing an error. */
+struct ringbuf *ringbuf_create(size_t size);
+
+/* Append len bytes, overwriting the oldest ones if the buffer is full */
+void ringbuf_append(struct ringbuf *ring, const char *data, size_t len);
+
+/* Write the contents to fd, or only their last tail lines if tail > 0.
+ * Returns 0, or -1 if the write fails. */
+int ringbuf_write(struct ringbuf *ring, int fd, long tail);
+
+/* Unmap and close a ring buffer */
+void ringbuf_free(struct ringbuf *ring);
+
+#endif /* __RINGBUF_H */
@@ -20,10 +20,64 @@ ast_command_create(char ** argv, bool dup_stderr_to_stdout)
     struct ast_command *cmd = malloc(sizeof *cmd);
 
     cmd->argv = argv;
+    cmd->num_assignments = 0;
+    cmd->group = NULL;
+    cmd->subshell = false;
+    cmd->loop = NULL;
     cmd->dup_stderr_to_stdout = dup_stderr_to_stdout;
+    cmd->pipe_size = 0;
     return cmd;
 }
 
+/* Create a group command.  Takes ownership of group. */
+struct ast_command *
+ast_command_create_group(struct ast_command_line *group, bool subshell,
+                         bool dup_stderr_to_stdout)
+{
+    struct ast_command *cmd = ast_command_create(calloc(1, sizeof(char *)),
+                                                 dup_stderr_to_stdout);
+    cmd->group = group;
+    cmd->subshell = subshell;
+    return cmd;
+}
+
+/* Create a loop command.  Takes ownership of loop. */
+struct ast_command *
+ast_command_create_loop(struct ast_loop *loop, bool dup_stderr_to_stdout)
+{
+    struct ast_command *cmd = ast_command_create(calloc(1, sizeof(char *)),
+                                                 dup_stderr_to_stdout);
+    cmd->loop = loop;
+    return cmd;
+}
+
+/* Create a for loop.  Takes ownership of variable, words, and body. */
+struct ast_loop *
+ast_loop_create_for(char *variable, char **words,
+                    struct ast_command_line *body)
+{
+    struct ast_loop *loop = calloc(1, sizeof *loop);
+
+    loop->kind = AST_LOOP_FOR;
+    loop->variable = variable;
+    loop->words = words;
+    loop->body = body;
+    return loop;
+}
+
+/* Create a while loop.  Takes ownership of condition and body. */
+struct ast_loop *
+ast_loop_create_while(struct ast_command_line *condition,
+                      struct ast_command_line *body)
+{
+    struct ast_loop *loop = calloc(1, sizeof *loop);
+
+    loop->kind = AST_LOOP_WHILE;
+    loop->condition = condition;
+    loop->body = body;
+    return loop;
+}
+
 /* Create a new pipeline */
 struct ast_pipeline * ast_pipeline_create(char *iored_input, 
                                           char *iored_output, 
@@ -34,8 +88,15 @@ struct ast_pipeline * ast_pipeline_create(char *iored_input,
     list_init(&pipe->commands);
     pipe->iored_output = iored_output;
     pipe->iored_input = iored_input;
+    pipe->input_kind = AST_INPUT_FILE;
     pipe->append_to_output = append_to_output;
+    pipe->extra_outputs = NULL;
+    pipe->num_extra_outputs = 0;
     pipe->bg_job = false;
+    pipe->profile = false;
+    pipe->literal = false;
+    pipe->list_op = AST_LIST_SEQUENCE;
+    pipe->refcount = 1;
     return pipe;
 }
 
@@ -72,14 +133,43 @@ ast_command_print(struct ast_command *cmd)
 {
     char **p = cmd->argv;
 
+    if (cmd->group) {
+        printf("  %s group {\n", cmd->subshell ? "Subshell" : "Command");
+        ast_command_line_print(cmd->group);
+        printf("  }\n");
+    }
+
+    if (cmd->loop) {
+        struct ast_loop *loop = cmd->loop;
+        if (loop->kind == AST_LOOP_FOR) {
+            printf("  For loop over %s in", loop->variable);
+            for (char **w = loop->words; *w; w++)
+                printf(" %s", *w);
+            printf(" {\n");
+        } else {
+            printf("  While loop, condition {\n");
+            ast_command_line_print(loop->condition);
+            printf("  } body {\n");
+        }
+        ast_command_line_print(loop->body);
+        printf("  }\n");
+    }
+
     printf("  Command:");
     while (*p)
         printf(" %s", *p++);
 
     printf("\n");
 
+    if (cmd->num_assignments)
+        printf("  the first %d words are variable assignments\n",
+               cmd->num_assignments);
+
     if (cmd->dup_stderr_to_stdout)
         printf("  stderr shall also be redirected\n");
+
+    if (cmd->pipe_size)
+        printf("  the pipe to the next command holds %ld bytes\n", cmd->pipe_size);
 }
   
 /* Print ast_pipeline structure to stdout */
@@ -103,8 +193,25 @@ ast_pipeline_print(struct ast_pipeline *pipe)
                 pipe->append_to_output ? "append" : "write",
                 pipe->iored_output);
 
-    if (pipe->iored_input)
+    for (int j = 0; j < pipe->num_extra_outputs; j++)
+        printf("  and also %ss to %s\n",
+                pipe->extra_outputs[j].append ? "append" : "write",
+                pipe->extra_outputs[j].path);
+
+    if (pipe->iored_input && pipe->input_kind == AST_INPUT_FILE)
         printf("  stdin of the first command reads from %s\n", pipe->iored_input);
+    else if (pipe->iored_input)
+        printf("  stdin of the first command reads the %stext:\n%s",
+               pipe->input_kind != AST_INPUT_HEREDOC_LITERAL ? "expanded " : "",
+               pipe->iored_input);
+
+    if (pipe->list_op == AST_LIST_AND)
+        printf("  - runs only if the previous pipeline succeeded\n");
+    else if (pipe->list_op == AST_LIST_OR)
+        printf("  - runs only if the previous pipeline failed\n");
+
+    if (pipe->profile)
+        printf("  - is profiled\n");
 
     if (pipe->bg_job)
         printf("  - is a background job\n");
@@ -140,9 +247,19 @@ ast_command_line_free(struct ast_command_line *cmdline)
     free(cmdline);
 }
 
+struct ast_pipeline *
+ast_pipeline_ref(struct ast_pipeline *pipe)
+{
+    pipe->refcount++;
+    return pipe;
+}
+
 void 
 ast_pipeline_free(struct ast_pipeline *pipe)
 {
+    if (--pipe->refcount > 0)
+        return;
+
     for (struct list_elem * e = list_begin(&pipe->commands); e != list_end(&pipe->commands); ) {
         struct ast_command *cmd = list_entry(e, struct ast_command, elem);
         e = list_remove(e);
@@ -154,6 +271,10 @@ ast_pipeline_free(struct ast_pipeline *pipe)
     if (pipe->iored_output)
         free(pipe->iored_output);
 
+    for (int i = 0; i < pipe->num_extra_outputs; i++)
+        free(pipe->extra_outputs[i].path);
+    free(pipe->extra_outputs);
+
     free(pipe);
 }
 
@@ -165,5 +286,24 @@ ast_command_free(struct ast_command * cmd)
         free(*p++);
     }
     free(cmd->argv);
+    if (cmd->group)
+        ast_command_line_free(cmd->group);
+    if (cmd->loop)
+        ast_loop_free(cmd->loop);
     free(cmd);
 }
+
+void
+ast_loop_free(struct ast_loop *loop)
+{
+    if (loop->words) {
+        for (char **p = loop->words; *p; p++)
+            free(*p);
+        free(loop->words);
+    }
+    free(loop->variable);
+    if (loop->condition)
+        ast_command_line_free(loop->condition);
+    ast_command_line_free(loop->body);
+    free(loop);
+}
@@ -7,12 +7,41 @@
 struct ast_command;
 struct ast_pipeline;
 struct ast_command_line;
+struct ast_loop;
 
 /* A command line may contain multiple pipelines. */
 struct ast_command_line {
     struct list/* <ast_pipeline> */ pipes;        /* List of pipelines */
 };
 
+/* How a pipeline is connected to the pipeline before it.
+ * Together with the exit status of the previous pipeline, this
+ * forms a conditional list such as 'a && b || c'.
+ */
+enum ast_list_op {
+    AST_LIST_SEQUENCE,       /* ';', '&', or first pipeline: always run */
+    AST_LIST_AND,            /* '&&': run if the previous status was 0 */
+    AST_LIST_OR,             /* '||': run if the previous status was not 0 */
+};
+
+/* Where the first command of a pipeline reads its input from */
+enum ast_input_kind {
+    AST_INPUT_FILE,          /* '< file': iored_input names a file */
+    AST_INPUT_HEREDOC,       /* '<<word': iored_input is the text, whose
+                                variables and substitutions are expanded
+                                when the pipeline runs */
+    AST_INPUT_HERESTRING,    /* '<<<word': iored_input is the word and a
+                                newline, expanded like a word */
+    AST_INPUT_HEREDOC_LITERAL, /* '<<"word"': iored_input is the text,
+                                used as it is */
+};
+
+/* A further target of a multi-target output redirection, 'cmd >a >>b' */
+struct ast_output {
+    char *path;
+    bool append;
+};
+
 /* A pipeline is a list of one or more commands. 
  * For the purposes of job control, a pipeline forms one job.
  */
@@ -20,25 +49,76 @@ struct ast_pipeline {
     struct list/* <ast_command> */ commands;    /* List of commands */
     char *iored_input;       /* If non-NULL, first command should read from
                                 file 'iored_input' */
+    enum ast_input_kind input_kind; /* How iored_input is interpreted */
     char *iored_output;      /* If non-NULL, last command should write to
                                 file 'iored_output' */
     bool append_to_output;   /* True if user typed >> to append */
+    struct ast_output *extra_outputs; /* Further targets that receive the
+                                same output as iored_output */
+    int num_extra_outputs;
     bool bg_job;             /* True if user entered & */
+    bool profile;            /* True if prefixed with 'profile' */
+    bool literal;            /* True if the words are used as they are,
+                                without expansion */
+    enum ast_list_op list_op; /* Condition under which this pipeline runs */
+    int refcount;            /* Number of owners: the command line it was
+                                parsed into and any jobs running it */
     struct list_elem elem;   /* Link element. */
 };
 
 /* A command is part of a pipeline. */
 struct ast_command {
     char **argv;             /* NULL terminated array of pointers to words
-                                making up this command. */
+                                making up this command. Empty for groups. */
+    int num_assignments;     /* Number of leading name=value words in argv,
+                                which set variables for this command */
+    struct ast_command_line *group; /* If non-NULL, the list of a
+                                '( list )' or '{ list; }' group */
+    bool subshell;           /* True if the group runs in a child shell */
+    struct ast_loop *loop;   /* If non-NULL, the for or while loop this
+                                command runs. argv is empty. */
     bool dup_stderr_to_stdout; /* True if stderr should be redirected as well */
+    long pipe_size;          /* Capacity requested with |[size] for the pipe
+                                to the next command, 0 if none */
     struct list_elem elem;   /* Link element to link commands in pipeline. */
 };
 
+/* A loop is parsed once and its body is executed for every iteration. */
+enum ast_loop_kind {
+    AST_LOOP_FOR,            /* 'for name in words; do body; done' */
+    AST_LOOP_WHILE,          /* 'while condition; do body; done' */
+};
+
+struct ast_loop {
+    enum ast_loop_kind kind;
+    char *variable;          /* for: name of the loop variable */
+    char **words;            /* for: NULL terminated list of words, expanded
+                                each time the loop starts */
+    struct ast_command_line *condition; /* while: list whose exit status
+                                decides whether the body runs again */
+    struct ast_command_line *body; /* Commands run on each iteration */
+};
+
 /* Create new command structure and initialize it */
 struct ast_command * ast_command_create(char ** argv,
                                         bool dup_stderr_to_stdout);
 
+/* Create a command that runs a group of pipelines.  Takes ownership of
+ * group. */
+struct ast_command * ast_command_create_group(struct ast_command_line *group,
+                                              bool subshell,
+                                              bool dup_stderr_to_stdout);
+
+/* Create a command that runs a loop.  Takes ownership of loop. */
+struct ast_command * ast_command_create_loop(struct ast_loop *loop,
+                                             bool dup_stderr_to_stdout);
+
+/* Create loops.  Take ownership of all arguments. */
+struct ast_loop * ast_loop_create_for(char *variable, char **words,
+                                      struct ast_command_line *body);
+struct ast_loop * ast_loop_create_while(struct ast_command_line *condition,
+                                        struct ast_command_line *body);
+
 /* Create a new pipeline containing only one command */
 struct ast_pipeline * ast_pipeline_create(char *iored_input, 
                                           char *iored_output, 
@@ -53,18 +133,32 @@ struct ast_command_line * ast_command_line_create_empty(void);
 /* Create a command line with a single pipeline */
 struct ast_command_line * ast_command_line_create(struct ast_pipeline *pipe);
 
+/* Add a reference to a pipeline; ast_pipeline_free drops one */
+struct ast_pipeline * ast_pipeline_ref(struct ast_pipeline *pipe);
+
 /* Deallocation functions */
 void ast_command_line_free(struct ast_command_line *);
 void ast_pipeline_free(struct ast_pipeline *);
 void ast_command_free(struct ast_command *);
+void ast_loop_free(struct ast_loop *);
 
 /* Print functions */
 void ast_command_print(struct ast_command *cmd);
 void ast_pipeline_print(struct ast_pipeline *pipe);
 void ast_command_line_print(struct ast_command_line *line);
 
+/* Return the next line of input without its newline in a string that
+ * the caller frees, or NULL at the end of input */
+typedef char *ast_next_line_fn(void *ctx);
+
 /* Parse a command line.  Implemented in shell-grammar.y */
 struct ast_command_line * ast_parse_command_line(char * line);
 
+/* Parse a command line whose here-documents are read from the lines
+ * that follow it, which next_line returns */
+struct ast_command_line * ast_parse_command_line_from(char *line,
+                                                      ast_next_line_fn *next_line,
+                                                      void *ctx);
+
 /** ----------------------------------------------------------- */
 #endif /* __SHELL_AST_H */
@@ -26,8 +26,13 @@ int yylex(void);
 #define INVNUL  "Invalid null command."
 #define AMBINP  "Ambiguous input redirect."
 #define AMBOUT  "Ambiguous output redirect."
+#define BADPAR  "Badly placed ()'s."
+#define BADLOOP "Badly formed loop."
+#define BADVAR  "Variable name must begin with a letter."
+#define HEREEOF "Here-document ended by end of input."
 
 #include "shell-ast.h"
+#include "variables.h"
 #include <obstack.h>
 #include <assert.h>
 
@@ -37,9 +42,17 @@ int yylex(void);
 struct cmd_helper {
     struct obstack words;   /* an obstack of char * to collect argv */
     char *iored_input;
+    enum ast_input_kind input_kind;
+    int heredoc;             /* index in heredocs, or -1 */
     char *iored_output;
     bool append_to_output;
+    struct ast_output *extra_outputs; /* targets after the first of 'a >b >c' */
+    int num_extra_outputs;
     bool redirect_stderr;
+    long pipe_size;          /* capacity of the pipe to the next command */
+    struct ast_command_line *group;  /* body of ( list ) or { list; } */
+    bool subshell;                   /* true for ( list ) */
+    struct ast_loop *loop;           /* for or while loop */
     struct list_elem elem;
 };
 
@@ -47,6 +60,15 @@ struct pipe_helper {
     struct list commands;
 };
 
+/* The here-documents of the line being parsed, in the order in which
+ * they appear.  Their text follows the line and is read after it has
+ * been parsed. */
+static struct heredoc {
+    char *delimiter;
+    char **text;            /* iored_input of the pipeline that reads it */
+} *heredocs;
+static int num_heredocs, max_heredocs;
+
 static struct pipe_helper *
 init_pipe()
 {
@@ -68,19 +90,27 @@ init_cmd(char *firstcmd,
 
     cmd->iored_output = iored_output;
     cmd->iored_input = iored_input;
+    cmd->input_kind = AST_INPUT_FILE;
+    cmd->heredoc = -1;
     cmd->append_to_output = append_to_output;
+    cmd->extra_outputs = NULL;
+    cmd->num_extra_outputs = 0;
     cmd->redirect_stderr = include_stderr;
+    cmd->pipe_size = 0;
+    cmd->group = NULL;
+    cmd->subshell = false;
+    cmd->loop = NULL;
     return cmd;
 }
 
 /* print error message */
 static void p_error(char *msg);
 
-/* Convert cmd_helper to ast_command.
- * Ensures NULL-terminated argv[] array
+/* Convert the words collected in cmd_helper into a
+ * NULL-terminated argv[] array
  */
-static struct ast_command * 
-make_ast_command(struct cmd_helper *cmd)
+static char **
+make_argv(struct cmd_helper *cmd)
 {
     obstack_ptr_grow(&cmd->words, NULL);
 
@@ -88,19 +118,45 @@ make_ast_command(struct cmd_helper *cmd)
     char **argv = malloc(sz);
     memcpy(argv, obstack_finish(&cmd->words), sz);
     obstack_free(&cmd->words, NULL);
+    return argv;
+}
+
+/* Convert cmd_helper to ast_command.
+ * Ensures NULL-terminated argv[] array
+ */
+static struct ast_command * 
+make_ast_command(struct cmd_helper *cmd)
+{
+    char **argv = make_argv(cmd);
+    struct ast_command *command;
 
-    if (*argv == NULL) {
+    if (cmd->loop) {
+        free(argv);
+        command = ast_command_create_loop(cmd->loop, cmd->redirect_stderr);
+    } else if (cmd->group) {
+        free(argv);
+        command = ast_command_create_group(cmd->group, cmd->subshell,
+                                           cmd->redirect_stderr);
+    } else if (*argv == NULL) {
         free(argv);
         return NULL; 
+    } else {
+        command = ast_command_create(argv, cmd->redirect_stderr);
+        while (argv[command->num_assignments] &&
+               variable_assignment_length(argv[command->num_assignments]) > 0)
+            command->num_assignments++;
     }
 
-    return ast_command_create(argv, cmd->redirect_stderr);
+    command->pipe_size = cmd->pipe_size;
+    return command;
 }
 
+/* Append cmd to pipe.  redirect_stderr and pipe_size describe the pipe
+ * from the previous command, if there is one. */
 static bool
 add_to_pipeline(struct pipe_helper *pipe,
                 struct cmd_helper *cmd,
-                bool redirect_stderr)
+                bool redirect_stderr, long pipe_size)
 {
     if (!list_empty(&pipe->commands)) {
         struct cmd_helper * last;
@@ -109,21 +165,61 @@ add_to_pipeline(struct pipe_helper *pipe,
         /* Error: 'ls >x | wc' */
         if (last->iored_output) { p_error(AMBOUT); return false; }
         last->redirect_stderr = redirect_stderr;
+        last->pipe_size = pipe_size;
 
         /* Error: 'ls | <x wc' */
         if (cmd->iored_input) { p_error(AMBINP); return false; }
     }
 
     int sz = obstack_object_size(&cmd->words);
-    if (sz == 0) { p_error(INVNUL); return false; }
+    if (sz == 0 && cmd->group == NULL && cmd->loop == NULL) {
+        p_error(INVNUL);
+        return false;
+    }
 
     list_push_back(&pipe->commands, &cmd->elem);
     return true;
 }
 
+/* Run the and-or list at the end of cline in the background, as '&'
+ * does.  A list of several pipelines, as in 'a && b &', is moved into a
+ * subshell group, so that all of it runs in the background and not
+ * only its last pipeline. */
+static void
+background_last_list(struct ast_command_line *cline)
+{
+    if (list_empty(&cline->pipes))
+        return;
+
+    struct list_elem *first = list_back(&cline->pipes);
+    while (list_entry(first, struct ast_pipeline, elem)->list_op
+           != AST_LIST_SEQUENCE)
+        first = list_prev(first);
+
+    if (first != list_back(&cline->pipes)) {
+        struct ast_command_line *group = ast_command_line_create_empty();
+        while (first != list_end(&cline->pipes)) {
+            struct list_elem *next = list_remove(first);
+            list_push_back(&group->pipes, first);
+            first = next;
+        }
+        struct ast_pipeline *pipe = ast_pipeline_create(NULL, NULL, false);
+        ast_pipeline_add_command(pipe,
+                                 ast_command_create_group(group, true, false));
+        list_push_back(&cline->pipes, &pipe->elem);
+    }
+
+    struct ast_pipeline *last;
+    last = list_entry(list_back(&cline->pipes), struct ast_pipeline, elem);
+    last->bg_job = true;
+}
+
 /* Called by parser when command line is complete */
 static void cmdline_complete(struct ast_command_line *);
 
+/* True if the last word was quoted; defined in shell-grammar.l */
+static bool word_quoted;
+
 /* work-around for bug in flex 2.31 and later */
 static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
 
@@ -136,11 +232,12 @@ static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
   struct ast_pipeline *ast_pipe;
   struct ast_command_line *cmdline;
   char *word;
+  long size;
 }
 
 /* Nonterminals */
 %type <command> input output
-%type <command> command
+%type <command> command group loop for_words
 %type <pipe> pipeline
 %type <ast_pipe> ast_pipeline
 %type <cmdline> cmd_list
@@ -148,6 +245,10 @@ static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
 /* Terminals */
 %token <word> WORD
 %token GREATER_GREATER GREATER_AMPERSAND PIPE_AMPERSAND
+%token <size> PIPE_SIZED PIPE_AMPERSAND_SIZED   /* |[size] and |&[size] */
+%token LESS_LESS LESS_LESS_LESS
+%token AND_AND OR_OR
+%token FOR WHILE DO DONE IN PROFILE
 
 %%
 cmd_line: cmd_list { cmdline_complete($1); }
@@ -159,28 +260,33 @@ cmd_list:	/* Null Command */ { $$ = ast_command_line_create_empty(); }
 |		cmd_list ';'
 |		cmd_list '&' {
             $$ = $1;
-            if (!list_empty(&$1->pipes)) {
-                struct ast_pipeline * last;
-                last = list_entry(list_back(&$1->pipes),
-                                  struct ast_pipeline, elem);
-                last->bg_job = true;
-            }
+            background_last_list($$);
         }
 |		cmd_list ';' ast_pipeline	{ 
             $$ = $1;
             list_push_back(&$$->pipes, &$3->elem);
         }
 |		cmd_list '&' ast_pipeline	{ 
-            if (!list_empty(&$1->pipes)) {
-                struct ast_pipeline * last;
-                last = list_entry(list_back(&$1->pipes),
-                                  struct ast_pipeline, elem);
-                last->bg_job = true;
-            }
-
             $$ = $1;
+            background_last_list($$);
+            list_push_back(&$$->pipes, &$3->elem);
+        }
+|		cmd_list AND_AND ast_pipeline	{
+            /* Error: '&& b' */
+            if (list_empty(&$1->pipes)) { p_error(INVNUL); YYABORT; }
+            $$ = $1;
+            $3->list_op = AST_LIST_AND;
             list_push_back(&$$->pipes, &$3->elem);
         }
+|		cmd_list OR_OR ast_pipeline	{
+            /* Error: '|| b' */
+            if (list_empty(&$1->pipes)) { p_error(INVNUL); YYABORT; }
+            $$ = $1;
+            $3->list_op = AST_LIST_OR;
+            list_push_back(&$$->pipes, &$3->elem);
+        }
+|		cmd_list AND_AND error	{ p_error(INVNUL); YYABORT; }
+|		cmd_list OR_OR error	{ p_error(INVNUL); YYABORT; }
 
 ast_pipeline: pipeline {
             struct pipe_helper * pipe = $1;
@@ -195,6 +301,11 @@ ast_pipeline: pipeline {
                 last->iored_output,
                 last->append_to_output
             );
+            $$->extra_outputs = last->extra_outputs;
+            $$->num_extra_outputs = last->num_extra_outputs;
+            $$->input_kind = first->input_kind;
+            if (first->heredoc != -1)
+                heredocs[first->heredoc].text = &$$->iored_input;
             for (struct list_elem * e = list_begin(&pipe->commands);
                                     e != list_end(&pipe->commands);) {
                 struct cmd_helper * cmd = list_entry(e, struct cmd_helper, elem);
@@ -204,19 +315,33 @@ ast_pipeline: pipeline {
             }
             free(pipe);
         }
+|       PROFILE ast_pipeline {
+            $$ = $2;
+            $$->profile = true;
+        }
 
 pipeline: command {
             $$ = init_pipe();
-            if (!add_to_pipeline($$, $1, false))
+            if (!add_to_pipeline($$, $1, false, 0))
                 YYABORT;
 		}
 |		pipeline '|' command {
-            if (!add_to_pipeline($1, $3, false))
+            if (!add_to_pipeline($1, $3, false, 0))
                 YYABORT;
             $$ = $1;
 		}
 |		pipeline PIPE_AMPERSAND command {
-            if (!add_to_pipeline($1, $3, true))
+            if (!add_to_pipeline($1, $3, true, 0))
+                YYABORT;
+            $$ = $1;
+		}
+|		pipeline PIPE_SIZED command {
+            if (!add_to_pipeline($1, $3, false, $2))
+                YYABORT;
+            $$ = $1;
+		}
+|		pipeline PIPE_AMPERSAND_SIZED command {
+            if (!add_to_pipeline($1, $3, true, $2))
                 YYABORT;
             $$ = $1;
 		}
@@ -226,9 +351,15 @@ pipeline: command {
 command:   WORD { 
             $$ = init_cmd($1, NULL, NULL, false, false);
         }
+|		group
+|		loop
 |		input   
 |		output
 |		command WORD {
+            /* Error: '(a) b' */
+            if ($1->group) { p_error(BADPAR); YYABORT; }
+            /* Error: 'for ...; done b' */
+            if ($1->loop) { p_error(BADLOOP); YYABORT; }
             $$ = $1;
             obstack_ptr_grow(&$$->words, $2);
 		}
@@ -238,23 +369,102 @@ command:   WORD {
             if ($1->iored_input)   { p_error(AMBINP); YYABORT; }
             $$ = $1; 
             $$->iored_input = $2->iored_input;
+            $$->input_kind = $2->input_kind;
+            $$->heredoc = $2->heredoc;
             free($2);
 		}
 |		command output {
             obstack_free(&$2->words, NULL);
-            /* Error: ambiguous redirect 'a >b >c' */
-            if ($1->iored_output) { p_error(AMBOUT); YYABORT; }
             $$ = $1; 
-            $$->iored_output = $2->iored_output;
-            $$->append_to_output = $2->append_to_output;
-            $$->redirect_stderr = $2->redirect_stderr;
+            if ($$->iored_output) {
+                /* 'a >b >c' writes to both b and c */
+                int n = $$->num_extra_outputs++;
+                $$->extra_outputs = realloc($$->extra_outputs,
+                                            (n + 1) * sizeof *$$->extra_outputs);
+                $$->extra_outputs[n].path = $2->iored_output;
+                $$->extra_outputs[n].append = $2->append_to_output;
+                $$->redirect_stderr |= $2->redirect_stderr;
+            } else {
+                $$->iored_output = $2->iored_output;
+                $$->append_to_output = $2->append_to_output;
+                $$->redirect_stderr = $2->redirect_stderr;
+            }
             free($2);
 		}
 
+group:	'(' cmd_list ')' {
+            /* Error: '()' */
+            if (list_empty(&$2->pipes)) { p_error(INVNUL); YYABORT; }
+            $$ = init_cmd(NULL, NULL, NULL, false, false);
+            $$->group = $2;
+            $$->subshell = true;
+        }
+|		'{' cmd_list '}' {
+            /* Error: '{ }' */
+            if (list_empty(&$2->pipes)) { p_error(INVNUL); YYABORT; }
+            $$ = init_cmd(NULL, NULL, NULL, false, false);
+            $$->group = $2;
+            $$->subshell = false;
+        }
+|		'(' error	{ p_error(BADPAR); YYABORT; }
+
+loop:	FOR WORD IN for_words ';' DO cmd_list DONE {
+            /* Error: 'for 1 in ...' */
+            if (!variable_name_valid($2)) { p_error(BADVAR); YYABORT; }
+            /* Error: 'for x in a; do done' */
+            if (list_empty(&$7->pipes)) { p_error(INVNUL); YYABORT; }
+            $$ = init_cmd(NULL, NULL, NULL, false, false);
+            $$->loop = ast_loop_create_for($2, make_argv($4), $7);
+            free($4);
+        }
+|		WHILE cmd_list DO cmd_list DONE {
+            /* Error: 'while do ...' or 'while a; do done' */
+            if (list_empty(&$2->pipes) || list_empty(&$4->pipes)) {
+                p_error(INVNUL);
+                YYABORT;
+            }
+            $$ = init_cmd(NULL, NULL, NULL, false, false);
+            $$->loop = ast_loop_create_while($2, $4);
+        }
+|		FOR error	{ p_error(BADLOOP); YYABORT; }
+|		WHILE error	{ p_error(BADLOOP); YYABORT; }
+
+for_words: /* no words */ {
+            $$ = init_cmd(NULL, NULL, NULL, false, false);
+        }
+|		for_words WORD {
+            $$ = $1;
+            obstack_ptr_grow(&$$->words, $2);
+        }
+
 input:	'<' WORD { 
             $$ = init_cmd(NULL, $2, NULL, false, false);
         }
+|		LESS_LESS WORD {
+            /* The delimiter stands in for the text until it is read.
+             * The scanner has not looked past WORD, so word_quoted
+             * describes it. */
+            if (num_heredocs == max_heredocs) {
+                max_heredocs = 2 * max_heredocs + 4;
+                heredocs = realloc(heredocs, max_heredocs * sizeof *heredocs);
+            }
+            heredocs[num_heredocs] = (struct heredoc) { $2, NULL };
+            $$ = init_cmd(NULL, $2, NULL, false, false);
+            $$->input_kind = word_quoted ? AST_INPUT_HEREDOC_LITERAL
+                                         : AST_INPUT_HEREDOC;
+            $$->heredoc = num_heredocs++;
+        }
+|		LESS_LESS_LESS WORD {
+            /* A here-string is the word followed by a newline */
+            char *text = malloc(strlen($2) + 2);
+            strcat(strcpy(text, $2), "\n");
+            free($2);
+            $$ = init_cmd(NULL, text, NULL, false, false);
+            $$->input_kind = AST_INPUT_HERESTRING;
+        }
 |		'<' error	  { p_error(MISRED); YYABORT; }
+|		LESS_LESS error	  { p_error(MISRED); YYABORT; }
+|		LESS_LESS_LESS error	  { p_error(MISRED); YYABORT; }
 
 output:	'>' WORD { 
             $$ = init_cmd(NULL, NULL, $2, false, false);
@@ -276,7 +486,6 @@ static char * inputline;    /* currently processed input line */
         result = *inputline ? (buf[0] = *inputline++, 1) : YY_NULL; \
     }
 
-#define YY_NO_INPUT
 #include "lex.yy.c"
 
 static void
@@ -298,16 +507,88 @@ static void cmdline_complete(struct ast_command_line *cline)
     commandline = cline;
 }
 
+/* Read the lines of a here-document up to its delimiter and make them
+ * the text of the pipeline that reads it */
+static void
+read_heredoc(struct heredoc *doc, ast_next_line_fn *next_line, void *ctx)
+{
+    char *text;
+    size_t size;
+    FILE *f = open_memstream(&text, &size);
+
+    for (;;) {
+        char *line = next_line != NULL ? next_line(ctx) : NULL;
+        if (line == NULL) {
+            p_error(HEREEOF);
+            break;
+        }
+        bool end = strcmp(line, doc->delimiter) == 0;
+        if (!end)
+            fprintf(f, "%s\n", line);
+        free(line);
+        if (end)
+            break;
+    }
+    fclose(f);
+
+    assert(*doc->text == doc->delimiter);
+    free(doc->delimiter);
+    *doc->text = text;
+}
+
+/* Read and drop the lines of a here-document up to its delimiter */
+static void
+skip_heredoc(const char *delimiter, ast_next_line_fn *next_line, void *ctx)
+{
+    for (char *line; next_line != NULL && (line = next_line(ctx)) != NULL; ) {
+        bool end = strcmp(line, delimiter) == 0;
+        free(line);
+        if (end)
+            break;
+    }
+}
+
 /* 
  * parse a commandline.
  */
 struct ast_command_line *
 ast_parse_command_line(char * line)
+{
+    return ast_parse_command_line_from(line, NULL, NULL);
+}
+
+/*
+ * parse a commandline, followed by the text of its here-documents.
+ */
+struct ast_command_line *
+ast_parse_command_line_from(char *line, ast_next_line_fn *next_line, void *ctx)
 {
     inputline = line;
     commandline = NULL;
+    command_start = true;
+    for_state = FOR_NONE;
+    num_heredocs = 0;
 
     int error = yyparse();
+    if (error) {
+        /* The here-documents of a line with an error follow it all the
+         * same, and are skipped so that their text does not run as
+         * commands.  Those after the error are found by scanning the
+         * rest of the line. */
+        for (int i = 0; i < num_heredocs; i++)
+            skip_heredoc(heredocs[i].delimiter, next_line, ctx);
+        for (int token, last = 0; (token = yylex()) != 0; last = token) {
+            if (token != WORD)
+                continue;
+            if (last == LESS_LESS)
+                skip_heredoc(yylval.word, next_line, ctx);
+            free(yylval.word);
+        }
+        return NULL;
+    }
+
+    for (int i = 0; i < num_heredocs; i++)
+        read_heredoc(&heredocs[i], next_line, ctx);
 
-    return error ? NULL : commandline;
+    return commandline;
 }
@@ -0,0 +1,98 @@
+/*
+ * Tunable shell settings.
+ *
+ * Each option is an integer with a default value.  Options are kept
+ * in a table indexed by enum shell_option so that the shell can read
+ * them without a lookup on its fast paths.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shell_options.h"
+
+static struct {
+    const char *name;           /* Name used with 'set -o' */
+    long value;                 /* Current value */
+    const char *description;    /* Shown by 'set' */
+} options[NUM_SHELL_OPTIONS] = {
+    [OPT_MAXJOBS] = { "maxjobs", 0,
+                      "maximum number of running background jobs (0: no limit)" },
+    [OPT_ARGCHUNK] = { "argchunk", 0,
+                       "split too long argument lists into this many parallel runs (0: off)" },
+    [OPT_BRACEMAX] = { "bracemax", 64 << 20,
+                       "memory limit in bytes for one brace expansion (0: no limit)" },
+    [OPT_PIPESIZE] = { "pipesize", 0,
+                       "capacity in bytes of the pipes the shell creates (0: kernel default)" },
+    [OPT_MERGEOUTPUT] = { "mergeoutput", 0,
+                          "print background job output by lines, prefixed with [jid] (0: off)" },
+    [OPT_CAPTURE] = { "capture", 0,
+                      "bytes of background job output kept for the output builtin (0: off)" },
+    [OPT_PIPECOUNT] = { "pipecount", 0,
+                        "count bytes (1) or bytes and lines (2) through pipes, shown by jobs -l (0: off)" },
+    [OPT_AUTOSUGGEST] = { "autosuggest", 0,
+                          "suggest the rest of a history line while typing (0: off)" },
+    [OPT_HISTSIZE] = { "histsize", 10000,
+                       "maximum number of entries in the history list (0: no limit)" },
+};
+
+/* Return the current value of option opt */
+long
+shell_option_get(enum shell_option opt)
+{
+    return options[opt].value;
+}
+
+/* Parse an option value with an optional k, m, or g suffix.
+ * Returns -1 if the value is not a non-negative number that fits in
+ * a long. */
+static long
+parse_value(const char *value)
+{
+    char *end;
+    int shift = 0;
+    errno = 0;
+    long v = strtol(value, &end, 10);
+    if (end == value || v < 0 || errno == ERANGE)
+        return -1;
+
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (v > LONG_MAX >> shift)
+        return -1;
+    return *end == '\0' ? v << shift : -1;
+}
+
+/* Set the option called name from a string value */
+int
+shell_option_set(const char *name, const char *value)
+{
+    for (int i = 0; i < NUM_SHELL_OPTIONS; i++) {
+        if (strcmp(options[i].name, name) != 0)
+            continue;
+
+        long v = parse_value(value);
+        if (v == -1) {
+            fprintf(stderr, "set: %s: invalid value '%s'\n", name, value);
+            return -1;
+        }
+        options[i].value = v;
+        return 0;
+    }
+    fprintf(stderr, "set: %s: no such option\n", name);
+    return -1;
+}
+
+/* Print all options and their values to stdout */
+void
+shell_options_print(void)
+{
+    for (int i = 0; i < NUM_SHELL_OPTIONS; i++)
+        printf("%-12s %-10ld # %s\n", options[i].name, options[i].value,
+               options[i].description);
+}
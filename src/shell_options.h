@@ -0,0 +1,45 @@
+#ifndef __SHELL_OPTIONS_H
+#define __SHELL_OPTIONS_H
+
+/*
+ * Tunable shell settings, changed with the 'set' builtin:
+ *
+ *   set                    list all options and their values
+ *   set -o name[=value]    set an option; a bare name sets it to 1
+ *   set +o name            set an option to 0
+ *
+ * Values are integers and accept k, m, and g suffixes.
+ */
+enum shell_option {
+    OPT_MAXJOBS,        /* Maximum number of running background jobs,
+                           0 for no limit */
+    OPT_ARGCHUNK,       /* Split commands whose argv exceeds ARG_MAX into
+                           invocations, this many at a time; 0 disables */
+    OPT_BRACEMAX,       /* Memory limit in bytes for the words of one
+                           brace expansion, 0 for no limit */
+    OPT_PIPESIZE,       /* Capacity in bytes of the pipes the shell
+                           creates, 0 for the kernel's default */
+    OPT_MERGEOUTPUT,    /* Print the output of background jobs a line at
+                           a time, prefixed with their job id */
+    OPT_CAPTURE,        /* Size in bytes of the ring buffer that keeps the
+                           output of each background job, 0 for none */
+    OPT_PIPECOUNT,      /* Count the bytes (1) or bytes and lines (2)
+                           through the pipes of jobs, 0 for off */
+    OPT_AUTOSUGGEST,    /* Suggest the rest of a history line while the
+                           command line is typed */
+    OPT_HISTSIZE,       /* Maximum number of entries in the history list,
+                           0 for no limit */
+    NUM_SHELL_OPTIONS
+};
+
+/* Return the current value of option opt */
+long shell_option_get(enum shell_option opt);
+
+/* Set the option called name from a string value.
+ * Returns -1 and prints an error if the name or value is invalid. */
+int shell_option_set(const char *name, const char *value);
+
+/* Print all options and their values to stdout */
+void shell_options_print(void);
+
+#endif /* __SHELL_OPTIONS_H */
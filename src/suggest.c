@@ -0,0 +1,202 @@
+/*
+ * A radix trie of history lines, ranked for suggestions.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "suggest.h"
+
+/* A node of the trie.  Node 0 is the root, which is never a child, so 0
+ * also stands for no node. */
+struct node {
+    uint32_t label, label_len;  /* The node's bytes, in the byte arena */
+    uint32_t parent, child, sibling;
+    uint32_t best;              /* Best-ranked line below, by its last node */
+    uint32_t last;              /* When the line that ends here was last added */
+    uint32_t count;             /* Times it was added, 0 if no line ends here */
+};
+
+struct suggest {
+    struct node *nodes;
+    size_t num_nodes, node_capacity;
+    char *bytes;
+    size_t num_bytes, byte_capacity;
+    uint32_t clock;             /* Lines added so far */
+};
+
+/* Create an empty set with only the root */
+struct suggest *
+suggest_create(void)
+{
+    struct suggest *s = calloc(1, sizeof *s);
+    s->node_capacity = 256;
+    s->nodes = calloc(s->node_capacity, sizeof *s->nodes);
+    s->num_nodes = 1;
+    return s;
+}
+
+/* Allocate a node, which may move the others */
+static uint32_t
+new_node(struct suggest *s)
+{
+    if (s->num_nodes == s->node_capacity) {
+        s->node_capacity *= 2;
+        s->nodes = realloc(s->nodes, s->node_capacity * sizeof *s->nodes);
+    }
+    s->nodes[s->num_nodes] = (struct node) { 0 };
+    return s->num_nodes++;
+}
+
+/* Store len bytes in the byte arena and return their offset */
+static uint32_t
+new_label(struct suggest *s, const char *text, size_t len)
+{
+    if (s->num_bytes + len > s->byte_capacity) {
+        s->byte_capacity = s->byte_capacity ? 2 * s->byte_capacity : 4096;
+        while (s->num_bytes + len > s->byte_capacity)
+            s->byte_capacity *= 2;
+        s->bytes = realloc(s->bytes, s->byte_capacity);
+    }
+    memcpy(s->bytes + s->num_bytes, text, len);
+    s->num_bytes += len;
+    return s->num_bytes - len;
+}
+
+/* Rank of the line that ends at node n */
+static uint64_t
+rank(struct suggest *s, uint32_t n)
+{
+    return s->nodes[n].last + (uint64_t) SUGGEST_FREQUENCY_WEIGHT * (s->nodes[n].count - 1);
+}
+
+/* Return the child of n whose label begins with c, or 0 */
+static uint32_t
+find_child(struct suggest *s, uint32_t n, char c)
+{
+    uint32_t child = s->nodes[n].child;
+    while (child != 0 && s->bytes[s->nodes[child].label] != c)
+        child = s->nodes[child].sibling;
+    return child;
+}
+
+/* Split the first k bytes of child's label into a new node that takes
+ * its place, and return the new node */
+static uint32_t
+split(struct suggest *s, uint32_t child, uint32_t k)
+{
+    uint32_t top = new_node(s);
+    struct node *c = &s->nodes[child], *t = &s->nodes[top];
+    uint32_t parent = c->parent;
+    *t = (struct node) {
+        .label = c->label, .label_len = k, .parent = parent,
+        .child = child, .sibling = c->sibling, .best = c->best,
+    };
+    c->label += k;
+    c->label_len -= k;
+    c->parent = top;
+    c->sibling = 0;
+
+    uint32_t *link = &s->nodes[parent].child;
+    while (*link != child)
+        link = &s->nodes[*link].sibling;
+    *link = top;
+    return top;
+}
+
+/* Add a line, or rank it higher */
+void
+suggest_add(struct suggest *s, const char *line, size_t len)
+{
+    if (len == 0 || len > UINT32_MAX)
+        return;
+
+    uint32_t n = 0;
+    size_t i = 0;
+    while (i < len) {
+        uint32_t child = find_child(s, n, line[i]);
+        if (child == 0) {
+            uint32_t label = new_label(s, line + i, len - i);
+            child = new_node(s);
+            s->nodes[child] = (struct node) {
+                .label = label, .label_len = len - i, .parent = n,
+                .sibling = s->nodes[n].child,
+            };
+            s->nodes[n].child = child;
+            n = child;
+            break;
+        }
+
+        const struct node *c = &s->nodes[child];
+        uint32_t k = 1;
+        while (k < c->label_len && i + k < len && s->bytes[c->label + k] == line[i + k])
+            k++;
+        n = k < c->label_len ? split(s, child, k) : child;
+        i += k;
+    }
+
+    s->nodes[n].count++;
+    s->nodes[n].last = ++s->clock;
+
+    /* The line's rank only grew, so it is now the best of any ancestor
+     * whose best it beats */
+    uint64_t r = rank(s, n);
+    for (uint32_t a = n; ; a = s->nodes[a].parent) {
+        uint32_t best = s->nodes[a].best;
+        if (best == 0 || best == n || rank(s, best) <= r)
+            s->nodes[a].best = n;
+        if (a == 0)
+            break;
+    }
+}
+
+/* Find the best line that begins with prefix, and copy its rest */
+size_t
+suggest_lookup(struct suggest *s, const char *prefix, size_t len,
+               char *buf, size_t size)
+{
+    uint32_t n = 0;
+    for (size_t i = 0; i < len; ) {
+        n = find_child(s, n, prefix[i]);
+        if (n == 0)
+            return 0;
+        const struct node *c = &s->nodes[n];
+        size_t k = 1;
+        while (k < c->label_len && i + k < len && s->bytes[c->label + k] == prefix[i + k])
+            k++;
+        if (k < c->label_len && i + k < len)
+            return 0;
+        i += k;
+    }
+
+    uint32_t best = s->nodes[n].best;
+    if (best == 0)
+        return 0;
+
+    /* The line is assembled from its last node up */
+    size_t total = 0;
+    for (uint32_t a = best; a != 0; a = s->nodes[a].parent)
+        total += s->nodes[a].label_len;
+    if (total <= len)
+        return 0;
+
+    size_t rest = total - len, end = total;
+    for (uint32_t a = best; end > len; a = s->nodes[a].parent) {
+        const struct node *c = &s->nodes[a];
+        size_t start = end - c->label_len;
+        for (size_t pos = start > len ? start : len; pos < end && pos - len < size - 1; pos++)
+            buf[pos - len] = s->bytes[c->label + pos - start];
+        end = start;
+    }
+    buf[rest < size - 1 ? rest : size - 1] = '\0';
+    return rest;
+}
+
+/* Free the set */
+void
+suggest_free(struct suggest *s)
+{
+    free(s->nodes);
+    free(s->bytes);
+    free(s);
+}
@@ -0,0 +1,42 @@
+#ifndef __SUGGEST_H
+#define __SUGGEST_H
+
+#include <stddef.h>
+
+/*
+ * Suggestions of history lines that begin with a given prefix.
+ *
+ * The lines are kept in a radix trie, in which every node holds the
+ * bytes its children have in common, so that a line shares its nodes
+ * with every line that begins the same way and an identical line adds
+ * nothing.  The nodes are packed into one array and refer to each
+ * other by index, and their bytes into another.
+ *
+ * Each line is ranked by when it was last added, plus
+ * SUGGEST_FREQUENCY_WEIGHT for every time it was added before.  Every
+ * node remembers the best-ranked line below it, which a line's
+ * ancestors update when it is added, since ranks only grow.  A lookup
+ * therefore only follows the prefix down the trie and the best line
+ * back up, whatever the number of lines.
+ */
+#define SUGGEST_FREQUENCY_WEIGHT 64
+
+struct suggest;
+
+/* Create an empty set of lines */
+struct suggest *suggest_create(void);
+
+/* Add the line of len bytes, or rank it higher if it is known */
+void suggest_add(struct suggest *s, const char *line, size_t len);
+
+/* Find the best-ranked line that begins with the len bytes of prefix
+ * and is longer.  Copies the rest of the line into buf, truncated to
+ * size - 1 bytes and NUL-terminated, and returns its full length, or 0
+ * if there is no such line. */
+size_t suggest_lookup(struct suggest *s, const char *prefix, size_t len,
+                      char *buf, size_t size);
+
+/* Free the set and its lines */
+void suggest_free(struct suggest *s);
+
+#endif /* __SUGGEST_H */
@@ -0,0 +1,74 @@
+#!/usr/bin/python
+#
+# tail_exec_test: tests that the last command of a -c string replaces the
+# shell instead of running in a child of it.
+#
+# Runs a command that prints its process id and its parent's. A command
+# run by tail exec has the shell's process id. Background jobs, pipelines,
+# builtins and commands split by argchunk must still run as children, and
+# the shell must stay around for them.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+import subprocess, tempfile, shutil
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# the non-interactive shells run the binary under test
+shell = os.readlink("/proc/%d/exe" % console.pid)
+
+tmpdir = tempfile.mkdtemp("-cush-tail-exec-tests")
+atexit.register(lambda: shutil.rmtree(tmpdir))
+
+command = os.path.join(tmpdir, "pids")
+with open(command, "w") as f:
+    f.write('#!/bin/sh\necho "$$ $PPID"\n')
+os.chmod(command, 0o755)
+
+# returns the shell's pid, its exit status, and the pids the commands printed
+def run(string):
+    p = subprocess.Popen([shell, "-c", string], stdin=subprocess.DEVNULL,
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    out, _ = p.communicate(timeout=20)
+    lines = out.decode().splitlines()
+    return p.pid, p.returncode, [l.split()[0] for l in lines if l[:1].isdigit()], lines
+
+# the last command takes over the shell's process
+pid, status, pids, lines = run("true; %s" % command)
+assert pids == [str(pid)], "last command did not replace the shell: %s" % lines
+assert status == 0, "tail exec changed the exit status (%d)" % status
+
+# and so does a command with redirections, which the shell applies first
+output = os.path.join(tmpdir, "output")
+pid, status, pids, lines = run("true; %s > %s" % (command, output))
+with open(output) as f:
+    assert f.read().split()[0] == str(pid), "redirected command did not replace the shell"
+
+# a command whose expansion failed is not run at all
+pid, status, pids, lines = run("true; %s {1..99999999}" % command)
+assert pids == [], "command ran without the word whose expansion failed: %s" % lines
+assert status == 1, "failed expansion did not fail the shell (%d)" % status
+
+# a background job, whatever follows it, runs in a child
+pid, status, pids, lines = run("true; %s &" % command)
+assert len(pids) == 1 and pids[0] != str(pid), "background job replaced the shell: %s" % lines
+
+# so do the commands of a pipeline
+pid, status, pids, lines = run("true; %s | cat" % command)
+assert len(pids) == 1 and pids[0] != str(pid), "pipeline replaced the shell: %s" % lines
+
+# a builtin runs in the shell itself, here after the job it waits for
+pid, status, pids, lines = run("%s & wait" % command)
+assert len(pids) == 1 and pids[0] != str(pid), "background job replaced the shell: %s" % lines
+assert len(lines) == 1 and status == 0, "builtin was not run by the shell: %s" % lines
+
+# a command split by argchunk runs once per chunk, each in a child
+pid, status, pids, lines = run("set -o argchunk=2; %s w{1..300000}" % command)
+assert len(pids) > 1, "command was not split: %s" % lines
+assert str(pid) not in pids, "one of the chunks replaced the shell: %s" % lines
+
+test_success()
@@ -10,6 +10,8 @@
 #include <stdarg.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
 
 #include "utils.h"
 
@@ -57,3 +59,70 @@ utils_set_cloexec(int fd)
     return fcntl(fd, F_SETFD, oldflags | FD_CLOEXEC);
 }
 
+
+/* Write all of buf, retrying short and interrupted writes */
+int
+utils_write_all(int fd, const void *buf, size_t len)
+{
+    for (size_t done = 0; done < len; ) {
+        ssize_t n = write(fd, (const char *) buf + done, len - done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+/* Copy len bytes starting at offset of in_fd to out_fd.  Uses sendfile
+ * and falls back to read/write for targets it does not support, such as
+ * descriptors opened with O_APPEND.  Returns -1 on error. */
+int
+utils_copy_range(int in_fd, off_t offset, off_t len, int out_fd)
+{
+    off_t end = offset + len;
+    while (offset < end) {
+        ssize_t n = sendfile(out_fd, in_fd, &offset, end - offset);
+        if (n > 0)
+            continue;
+        if (n == 0)
+            return 0;
+        if (errno == EINTR)
+            continue;
+        if (errno != EINVAL && errno != ENOSYS)
+            return -1;
+
+        char buf[64 * 1024];
+        while (offset < end) {
+            size_t want = end - offset < sizeof buf ? end - offset : sizeof buf;
+            ssize_t got = pread(in_fd, buf, want, offset);
+            if (got == -1 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                return got;
+            if (utils_write_all(out_fd, buf, got) == -1)
+                return -1;
+            offset += got;
+        }
+    }
+    return 0;
+}
+
+/* Format a byte count, with a K, M, or G suffix from 10000 on */
+const char *
+utils_format_bytes(unsigned long long bytes, char *buf, size_t size)
+{
+    const char *units = "KMG";
+    if (bytes < 10000) {
+        snprintf(buf, size, "%llu", bytes);
+        return buf;
+    }
+    double value = bytes / 1024.0;
+    while (value >= 10000 && units[1] != '\0') {
+        value /= 1024;
+        units++;
+    }
+    snprintf(buf, size, "%.*f%c", value < 100 ? 1 : 0, value, *units);
+    return buf;
+}
@@ -1,3 +1,5 @@
+#include <sys/types.h>
+
 /* Set the 'close-on-exec' flag on fd, return error indicator */
 int utils_set_cloexec(int fd);
 
@@ -6,3 +8,12 @@ void utils_error(char *fmt, ...);
 
 /* Print information about the last syscall error and then exit */
 void utils_fatal_error(char *fmt, ...);
+
+/* Write all len bytes of buf to fd, return error indicator */
+int utils_write_all(int fd, const void *buf, size_t len);
+
+/* Copy len bytes starting at offset of in_fd to out_fd, return error indicator */
+int utils_copy_range(int in_fd, off_t offset, off_t len, int out_fd);
+
+/* Format a byte count into buf, with a K, M, or G suffix if large, and return buf */
+const char *utils_format_bytes(unsigned long long bytes, char *buf, size_t size);
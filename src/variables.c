@@ -0,0 +1,355 @@
+/*
+ * Shell variables.
+ *
+ * Variables are kept in an open-addressing hash table with linear
+ * probing.  Removed entries leave a tombstone behind so that probe
+ * sequences stay intact; tombstones are dropped when the table grows.
+ *
+ * The environment for spawned commands is built from the exported
+ * variables.  Each exported variable caches its "name=value" string,
+ * and the envp array pointing to these strings is only rebuilt when
+ * an exported variable was set, unset, or exported since the last
+ * spawn.  Per-command assignments get a new array that shares all
+ * strings, so no spawn copies the environment's strings.
+ */
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "variables.h"
+#include "utils.h"
+
+struct variable {
+    char *name;             /* NULL if the slot is free, TOMBSTONE if
+                               the variable was removed */
+    char *value;            /* NULL if exported but not yet set */
+    bool exported;          /* Part of the environment of commands */
+    char *env;              /* Cached "name=value", built on demand */
+};
+
+static char tombstone;
+#define TOMBSTONE (&tombstone)
+
+#define MIN_CAPACITY 64
+
+static struct variable *table;
+static size_t capacity;     /* Number of slots, a power of two */
+static size_t used;         /* Slots that are in use or tombstones */
+
+static char **envp;         /* Cached environment */
+static bool envp_valid;     /* False after an exported variable changed */
+static size_t envp_capacity;
+
+/* FNV-1a */
+static size_t
+hash_name(const char *name)
+{
+    uint64_t h = 14695981039346656037ULL;
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Return the slot holding name, or NULL if it is not in the table */
+static struct variable *
+find_variable(const char *name)
+{
+    if (capacity == 0)
+        return NULL;
+
+    for (size_t i = hash_name(name) & (capacity - 1); ; i = (i + 1) & (capacity - 1)) {
+        struct variable *var = &table[i];
+        if (var->name == NULL)
+            return NULL;
+        if (var->name != TOMBSTONE && strcmp(var->name, name) == 0)
+            return var;
+    }
+}
+
+/* Rehash all live entries into a table of new_capacity slots */
+static void
+resize_table(size_t new_capacity)
+{
+    struct variable *old = table;
+    size_t old_capacity = capacity;
+
+    table = calloc(new_capacity, sizeof *table);
+    if (table == NULL)
+        utils_fatal_error("out of memory: ");
+    capacity = new_capacity;
+    used = 0;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].name == NULL || old[i].name == TOMBSTONE)
+            continue;
+
+        size_t j = hash_name(old[i].name) & (capacity - 1);
+        while (table[j].name != NULL)
+            j = (j + 1) & (capacity - 1);
+        table[j] = old[i];
+        used++;
+    }
+    free(old);
+}
+
+/* Return the slot for name, adding an unset entry if necessary */
+static struct variable *
+add_variable(const char *name)
+{
+    struct variable *var = find_variable(name);
+    if (var != NULL)
+        return var;
+
+    /* Keep the load factor, including tombstones, below 3/4 */
+    if ((used + 1) * 4 > capacity * 3)
+        resize_table(capacity ? 2 * capacity : MIN_CAPACITY);
+
+    size_t i = hash_name(name) & (capacity - 1);
+    while (table[i].name != NULL && table[i].name != TOMBSTONE)
+        i = (i + 1) & (capacity - 1);
+
+    if (table[i].name == NULL)
+        used++;
+    var = &table[i];
+    var->name = strdup(name);
+    var->value = NULL;
+    var->exported = false;
+    var->env = NULL;
+    return var;
+}
+
+/* Called whenever the value or export flag of var changes */
+static void
+variable_changed(struct variable *var)
+{
+    free(var->env);
+    var->env = NULL;
+    if (!var->exported)
+        return;
+
+    envp_valid = false;
+
+    /* Commands are looked up in the shell's own PATH */
+    if (strcmp(var->name, "PATH") == 0) {
+        if (var->value)
+            setenv("PATH", var->value, 1);
+        else
+            unsetenv("PATH");
+    }
+}
+
+/* Import the variables of the shell's own environment */
+void
+variables_init(char **env)
+{
+    for (char **p = env; *p; p++) {
+        char *eq = strchr(*p, '=');
+        if (eq == NULL)
+            continue;
+
+        char name[eq - *p + 1];
+        memcpy(name, *p, eq - *p);
+        name[eq - *p] = '\0';
+
+        struct variable *var = add_variable(name);
+        free(var->value);
+        var->value = strdup(eq + 1);
+        var->exported = true;
+        variable_changed(var);
+    }
+}
+
+/* Return the value of variable name, or NULL if it is not set */
+const char *
+variable_get(const char *name)
+{
+    struct variable *var = find_variable(name);
+    return var ? var->value : NULL;
+}
+
+/* Set variable name to a copy of value */
+void
+variable_set(const char *name, const char *value)
+{
+    struct variable *var = add_variable(name);
+    free(var->value);
+    var->value = strdup(value);
+    variable_changed(var);
+}
+
+/* Remove variable name */
+void
+variable_unset(const char *name)
+{
+    struct variable *var = find_variable(name);
+    if (var == NULL)
+        return;
+
+    free(var->value);
+    var->value = NULL;
+    variable_changed(var);
+
+    free(var->name);
+    var->name = TOMBSTONE;
+}
+
+/* Mark variable name for export */
+void
+variable_export(const char *name)
+{
+    struct variable *var = add_variable(name);
+    if (var->exported)
+        return;
+
+    var->exported = true;
+    variable_changed(var);
+}
+
+/* Return true if name is a letter or underscore followed by letters,
+ * digits, and underscores */
+bool
+variable_name_valid(const char *name)
+{
+    if (!isalpha((unsigned char) *name) && *name != '_')
+        return false;
+
+    while (*++name)
+        if (!isalnum((unsigned char) *name) && *name != '_')
+            return false;
+
+    return true;
+}
+
+/* If word is name=value, return the length of name, otherwise 0 */
+size_t
+variable_assignment_length(const char *word)
+{
+    const char *p = word;
+    if (!isalpha((unsigned char) *p) && *p != '_')
+        return 0;
+
+    while (isalnum((unsigned char) *++p) || *p == '_')
+        ;
+
+    return *p == '=' ? p - word : 0;
+}
+
+/* Return the cached "name=value" string of an exported variable */
+static char *
+env_string(struct variable *var)
+{
+    if (var->env == NULL) {
+        size_t nlen = strlen(var->name), vlen = strlen(var->value);
+        var->env = malloc(nlen + vlen + 2);
+        if (var->env == NULL)
+            utils_fatal_error("out of memory: ");
+        memcpy(var->env, var->name, nlen);
+        var->env[nlen] = '=';
+        memcpy(var->env + nlen + 1, var->value, vlen + 1);
+    }
+    return var->env;
+}
+
+/* Return the environment for spawned commands */
+char **
+variables_environ(void)
+{
+    if (envp_valid)
+        return envp;
+
+    size_t n = 0;
+    for (size_t i = 0; i < capacity; i++) {
+        struct variable *var = &table[i];
+        if (var->name == NULL || var->name == TOMBSTONE)
+            continue;
+        if (!var->exported || var->value == NULL)
+            continue;
+
+        if (n + 1 >= envp_capacity) {
+            envp_capacity = envp_capacity ? 2 * envp_capacity : MIN_CAPACITY;
+            envp = realloc(envp, envp_capacity * sizeof *envp);
+            if (envp == NULL)
+                utils_fatal_error("out of memory: ");
+        }
+        envp[n++] = env_string(var);
+    }
+
+    if (envp == NULL) {
+        envp_capacity = 1;
+        envp = malloc(sizeof *envp);
+    }
+    envp[n] = NULL;
+    envp_valid = true;
+    return envp;
+}
+
+/* Return true if the environment string env assigns one of the n
+ * variables in assignments */
+static bool
+is_overridden(const char *env, char **assignments, int n)
+{
+    size_t len = strchr(env, '=') - env;
+    for (int i = 0; i < n; i++)
+        if (strncmp(env, assignments[i], len + 1) == 0)
+            return true;
+
+    return false;
+}
+
+/* Return an environment in which assignments override the exported
+ * variables */
+char **
+variables_environ_with(char **assignments, int n)
+{
+    char **base = variables_environ();
+    size_t count = 0;
+    while (base[count])
+        count++;
+
+    char **env = malloc((count + n + 1) * sizeof *env);
+    if (env == NULL)
+        utils_fatal_error("out of memory: ");
+
+    size_t k = 0;
+    for (int i = 0; i < n; i++)
+        env[k++] = assignments[i];
+    for (size_t i = 0; i < count; i++)
+        if (!is_overridden(base[i], assignments, n))
+            env[k++] = base[i];
+    env[k] = NULL;
+    return env;
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+    const struct variable *va = *(const struct variable **) a;
+    const struct variable *vb = *(const struct variable **) b;
+    return strcmp(va->name, vb->name);
+}
+
+/* Print the exported variables, sorted by name */
+void
+variables_print_exported(void)
+{
+    struct variable **vars = malloc((capacity + 1) * sizeof *vars);
+    size_t n = 0;
+
+    for (size_t i = 0; i < capacity; i++)
+        if (table[i].name != NULL && table[i].name != TOMBSTONE
+            && table[i].exported)
+            vars[n++] = &table[i];
+
+    qsort(vars, n, sizeof *vars, compare_names);
+    for (size_t i = 0; i < n; i++) {
+        if (vars[i]->value)
+            printf("export %s=\"%s\"\n", vars[i]->name, vars[i]->value);
+        else
+            printf("export %s\n", vars[i]->name);
+    }
+    free(vars);
+}
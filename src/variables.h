@@ -0,0 +1,55 @@
+#ifndef __VARIABLES_H
+#define __VARIABLES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Shell variables and the environment of spawned commands.
+ *
+ * Variables live in an open-addressing hash table.  Exported variables
+ * form the environment of spawned commands; its envp array is only
+ * rebuilt after an exported variable changed, and is shared by all
+ * spawns until then.  Values are referenced in words as $name or
+ * ${name}.
+ */
+
+/* Import the variables of the shell's own environment, all exported */
+void variables_init(char **envp);
+
+/* Return the value of variable name, or NULL if it is not set */
+const char *variable_get(const char *name);
+
+/* Set variable name to a copy of value.  An exported variable stays
+ * exported. */
+void variable_set(const char *name, const char *value);
+
+/* Remove variable name */
+void variable_unset(const char *name);
+
+/* Mark variable name for export to spawned commands.  An unset variable
+ * is exported once it is given a value. */
+void variable_export(const char *name);
+
+/* Return true if name can be used as a variable name: a letter or
+ * underscore followed by letters, digits, and underscores. */
+bool variable_name_valid(const char *name);
+
+/* If word has the form name=value with a valid name, return the length
+ * of name, otherwise 0 */
+size_t variable_assignment_length(const char *word);
+
+/* Return the environment for spawned commands.  The array is owned by
+ * this module and stays valid until an exported variable changes. */
+char **variables_environ(void);
+
+/* Return an environment in which the n name=value strings in
+ * assignments replace or add to the exported variables.  Only the
+ * array is new; the caller frees it with free(), and it shares its
+ * strings with assignments and with variables_environ(). */
+char **variables_environ_with(char **assignments, int n);
+
+/* Print the exported variables in a form that can be read back */
+void variables_print_exported(void);
+
+#endif /* __VARIABLES_H */
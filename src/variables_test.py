@@ -0,0 +1,68 @@
+#!/usr/bin/python
+#
+# variables_test: tests shell variables, export, unset, and
+# per-command name=value assignments.
+#
+
+import sys, os, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# a shell variable is expanded but not exported
+sendline("GREETING=hello")
+expect_prompt()
+sendline("echo value-$GREETING")
+expect_exact("value-hello", "variable was not expanded")
+expect_prompt()
+sendline("env | grep -c ^GREETING=")
+expect_exact("0", "unexported variable appeared in the environment")
+expect_prompt()
+
+# export puts it into the environment of spawned commands
+sendline("export GREETING")
+expect_prompt()
+sendline("env | grep ^GREETING=")
+expect_exact("GREETING=hello", "exported variable is missing from the environment")
+expect_prompt()
+
+# export can set a value, and changes are seen by later commands
+sendline("export GREETING=bye")
+expect_prompt()
+sendline("env | grep ^GREETING=")
+expect_exact("GREETING=bye", "environment was not updated after export")
+expect_prompt()
+
+# an assignment in front of a command applies to that command only
+sendline("ONCE=1 env | grep ^ONCE=")
+expect_exact("ONCE=1", "per-command assignment is missing from the environment")
+expect_prompt()
+sendline("echo once-[$ONCE]")
+expect_exact("once-[]", "per-command assignment leaked into the shell")
+expect_prompt()
+
+# a per-command assignment overrides an exported variable
+sendline("GREETING=override env | grep ^GREETING=")
+expect_exact("GREETING=override", "per-command assignment did not override export")
+expect_prompt()
+
+# unset removes the variable from the shell and the environment
+sendline("unset GREETING")
+expect_prompt()
+sendline("env | grep -c ^GREETING=")
+expect_exact("0", "unset variable is still in the environment")
+expect_prompt()
+
+# a quoted reference keeps its value as it is, and stays a word if empty
+sendline("PATTERN=*\\?\\[x\\\\y")
+expect_prompt()
+sendline('printf "<%s>\\n" "$PATTERN" "${UNSET}" $UNSET')
+expect_exact("<*?[x\\y>", "quoted variable was globbed or changed")
+expect_exact("<>", "quoted empty variable was dropped")
+expect_prompt()
+assert "<>\r\n<>" not in console.before, "unquoted empty variable became a word"
+
+test_success()
@@ -0,0 +1,68 @@
+#!/usr/bin/python
+#
+# wait_builtin_test: tests the "wait" custom cush shell built-in command.
+#
+# Checks that wait blocks until all background jobs, the given jobs, or
+# (with -n) the next background job have finished.
+#
+
+import sys, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# wait with no arguments waits for every background job
+sendline("sleep 0.5 &")
+expect_prompt("Shell did not print expected prompt after first job")
+sendline("sleep 1 &")
+expect_prompt("Shell did not print expected prompt after second job")
+
+start = time.time()
+sendline("wait")
+expect_prompt("Shell did not print expected prompt after wait")
+elapsed = time.time() - start
+assert 0.8 < elapsed < 1.8, "wait returned after %.1fs, expected about 1s" % elapsed
+
+# waited-for jobs are removed from the job list
+sendline("jobs")
+expect_prompt("jobs printed output after all jobs were waited for")
+assert "Running" not in console.before, "wait left finished jobs in the job list"
+
+# wait -n returns as soon as the first job finishes
+sendline("sleep 0.3 &")
+expect_prompt()
+sendline("sleep 2 &")
+expect_prompt()
+
+start = time.time()
+sendline("wait -n")
+expect_prompt("Shell did not print expected prompt after wait -n")
+elapsed = time.time() - start
+assert elapsed < 1.5, "wait -n waited for more than one job (%.1fs)" % elapsed
+
+# the slower job is still listed and can be waited for by job id
+sendline("jobs")
+expect("Running", "wait -n removed a job that was still running")
+expect_prompt()
+
+sendline("wait")
+expect_prompt("Shell did not print expected prompt after wait")
+
+# a job that finished while a foreground job ran keeps its exit status
+sendline("false & sleep 0.5; wait %1 || echo wait returned failure")
+expect_exact("wait returned failure", "wait did not return the status of a failed job")
+assert "No such job" not in console.before, "finished job was dropped before wait"
+expect_prompt()
+
+sendline("true & sleep 0.5; wait %1 && echo wait returned success")
+expect_exact("wait returned success", "wait did not return the status of a successful job")
+expect_prompt()
+
+# unknown jobs are reported
+sendline("wait %42")
+expect_exact("wait: %42: No such job", "wait did not report an unknown job")
+
+test_success()